@@ -5,13 +5,35 @@
 #include <boost/filesystem.hpp>
 
 // local includes
+#include "linuxdeploy/core/dependencygraph.h"
 #include "linuxdeploy/core/desktopfile.h"
+#include "linuxdeploy/core/excludelist.h"
 
 #pragma once
 
 namespace linuxdeploy {
     namespace core {
         namespace appdir {
+            // ways to put files into the AppDir
+            enum DeployMode {
+                // copy all files
+                DEPLOY_COPY = 0,
+                // hardlink files, and copy them if that's not possible or they need to be modified
+                DEPLOY_HARDLINK,
+                // hardlink files to objects in a library store shared with other AppDirs, see setLibraryStore()
+                DEPLOY_STORE,
+            };
+
+            // ways to handle the debug information of deployed ELF files
+            enum DebugInfoMode {
+                // deploy files as they are
+                DEBUG_INFO_KEEP = 0,
+                // remove the debug sections and the symbol table, like strip does
+                DEBUG_INFO_STRIP,
+                // move the debug sections and the symbol table into separate debug files, see setDebugInfoMode()
+                DEBUG_INFO_SPLIT,
+            };
+
             /*
              * Base class for AppDirs.
              */
@@ -39,21 +61,73 @@ namespace linuxdeploy {
                     // deploy shared library
                     bool deployLibrary(const boost::filesystem::path& path);
 
+                    // deploy shared library into a directory other than usr/lib, given relative to the AppDir root
+                    // unless rpath is specified, the library is given an rpath pointing to usr/lib
+                    bool deployLibrary(const boost::filesystem::path& path, const boost::filesystem::path& destination, const std::string& rpath = "");
+
+                    // dependency graph of all ELF files deployed so far
+                    // every file is traced only once during the lifetime of the AppDir object
+                    dependencygraph::DependencyGraph& dependencyGraph();
+
+                    // libraries matching the excludelist are not deployed
+                    // initially contains the built-in excludelist only
+                    excludelist::Excludelist& excludelist();
+
                     // deploy executable
                     bool deployExecutable(const boost::filesystem::path& path);
 
+                    // deploy executable into a directory other than usr/bin, given relative to the AppDir root
+                    // unless rpath is specified, the executable is given an rpath pointing to usr/lib
+                    bool deployExecutable(const boost::filesystem::path& path, const boost::filesystem::path& destination, const std::string& rpath = "");
+
                     // deploy desktop file
                     bool deployDesktopFile(const desktopfile::DesktopFile& desktopFile);
 
                     // deploy icon
                     bool deployIcon(const boost::filesystem::path& path);
 
+                    // generate icons in all standard sizes from a high resolution PNG or SVG image, and deploy them
+                    // rendered icons are cached in the user's cache directory, keyed by source content and size
+                    bool deployIconFromSource(const boost::filesystem::path& path);
+
+                    // set how executeDeferredOperations() puts files into the AppDir
+                    // defaults to DEPLOY_COPY
+                    void setDeployMode(DeployMode deployMode);
+
+                    // set library store used in DEPLOY_STORE mode
+                    // the store should be on the same file system as the AppDir, otherwise the objects are reflinked if
+                    // possible, or copied
+                    void setLibraryStore(const boost::filesystem::path& path);
+
+                    // set how executeDeferredOperations() handles the debug information of ELF files
+                    // defaults to DEBUG_INFO_KEEP
+                    // files are stripped while they're copied, the debug files split off are named after the files'
+                    // build IDs (<debugDirectory>/.build-id/<xx>/<rest of the build ID>.debug), which is where debuggers
+                    // look for them; the debug directory should be outside the AppDir
+                    void setDebugInfoMode(DebugInfoMode mode, const boost::filesystem::path& debugDirectory = "");
+
+                    // set number of files copied and patched in parallel by executeDeferredOperations()
+                    // defaults to the number of CPUs
+                    void setNumberOfJobs(size_t numberOfJobs);
+
+                    // stream the files deployed by executeDeferredOperations() into a gzip compressed tar archive
+                    // the archive is compressed using as many threads as files are copied in parallel
+                    // unless writeTree is set, the files are added to the archive only, except for desktop files, which
+                    // are needed by later steps
+                    bool setArchiveOutput(const boost::filesystem::path& archivePath, bool writeTree = true);
+
+                    // add the rest of the AppDir's contents (e.g., symlinks) to the archive, and finish it
+                    bool finishArchive();
+
                     // execute deferred copy operations
                     bool executeDeferredOperations();
 
                     // return path to AppDir
                     boost::filesystem::path path();
 
+                    // the following lists are served from an index of the AppDir's contents, which is updated by every
+                    // deployment, and seeded from the file system once when it's first accessed
+
                     // create a list of all icon paths in the AppDir
                     std::vector<boost::filesystem::path> deployedIconPaths();
 
@@ -61,8 +135,17 @@ namespace linuxdeploy {
                     std::vector<boost::filesystem::path> deployedExecutablePaths();
 
                     // create a list of all desktop file paths in the AppDir
+                    std::vector<boost::filesystem::path> deployedDesktopFilePaths();
+
+                    // create a list of all desktop files in the AppDir
+                    // parses every desktop file, use deployedDesktopFilePaths() if only some of them are needed
                     std::vector<desktopfile::DesktopFile> deployedDesktopFiles();
 
+                    // create symlink to target, replacing existing files atomically
+                    // if symlink is a directory, the link is created in it with the target's filename, like ln does
+                    // relative links are computed lexically, i.e., without resolving symlinks in the paths
+                    bool createSymlink(const boost::filesystem::path& target, const boost::filesystem::path& symlink, bool useRelativePath = true);
+
                     // create symlinks for AppRun, desktop file and icon in the AppDir root directory
                     bool createLinksInAppDirRoot(const desktopfile::DesktopFile& desktopFile);
             };
@@ -0,0 +1,73 @@
+// system includes
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+// library includes
+#include <boost/filesystem.hpp>
+
+// local includes
+#include "linuxdeploy/core/elf.h"
+
+#pragma once
+
+namespace linuxdeploy {
+    namespace core {
+        namespace archive {
+            /*
+             * Gzip compressed tar archive, written while its contents are still being produced.
+             *
+             * The tar stream is cut into blocks, which are compressed on worker threads in parallel, each into a gzip
+             * member of its own (a sequence of gzip members is a valid gzip file). The compressed blocks are written in
+             * order as soon as they're ready. The number of blocks in flight is limited, so that producers are slowed
+             * down rather than the archive piling up in memory when compression can't keep up.
+             *
+             * Entries can be added from multiple threads at once, every entry is written as a whole. Parent directories
+             * are added automatically. The archive is written under a temporary name, and only moved into place by
+             * finish().
+             */
+            class ArchiveWriter {
+                private:
+                    // private data class pattern
+                    class PrivateData;
+                    PrivateData* d;
+
+                public:
+                    ArchiveWriter(const boost::filesystem::path& path, size_t numberOfThreads);
+
+                    // an archive which hasn't been finished is removed
+                    ~ArchiveWriter();
+
+                    ArchiveWriter(const ArchiveWriter&) = delete;
+                    ArchiveWriter& operator=(const ArchiveWriter&) = delete;
+
+                public:
+                    // create the temporary file the archive is written to
+                    bool open();
+
+                    const boost::filesystem::path& path() const;
+
+                    // check whether an entry has been added already
+                    bool contains(const std::string& name) const;
+
+                    bool addDirectory(const std::string& name, mode_t mode);
+
+                    bool addSymlink(const std::string& name, const std::string& target);
+
+                    // add regular file, including its permissions and modification time
+                    bool addFile(const std::string& name, const boost::filesystem::path& path);
+
+                    // add the first length bytes of a regular file with the given patches applied, see
+                    // elf::ElfFile::planRPathChange() and elf::ElfFile::planStrip()
+                    bool addFile(const std::string& name, const boost::filesystem::path& path, uint64_t length,
+                                 const std::vector<elf::FilePatch>& patches);
+
+                    // write the end of the archive, wait until all blocks have been written, and move the archive
+                    // into place
+                    bool finish();
+            };
+        }
+    }
+}
@@ -0,0 +1,55 @@
+// system includes
+#include <functional>
+#include <istream>
+#include <string>
+
+// library includes
+#include <boost/filesystem.hpp>
+
+#pragma once
+
+namespace linuxdeploy {
+    namespace core {
+        namespace batch {
+            /*
+             * Reader for lists of files to deploy in a single run, e.g., generated by a build system.
+             *
+             * Two formats are supported:
+             *
+             *  - line based: one entry per line, consisting of type, source, and optionally destination directory and
+             *    rpath, separated by tabs (or, if there are only type and source, a single space); empty lines and lines
+             *    starting with # are ignored
+             *  - JSON: either an array of objects, or one object per line (JSON Lines), using the keys "type",
+             *    "source", "destination" and "rpath"
+             *
+             * The format is detected from the first non-whitespace character. Line based lists and JSON Lines are
+             * processed while they're read, so that deploying can start before the producer has finished writing.
+             */
+
+            enum EntryType {
+                ENTRY_LIBRARY = 0,
+                ENTRY_EXECUTABLE,
+                ENTRY_ICON,
+                ENTRY_DESKTOP_FILE,
+            };
+
+            struct Entry {
+                EntryType type;
+                boost::filesystem::path source;
+
+                // directory relative to the AppDir root, empty means the type's default directory
+                boost::filesystem::path destination;
+
+                // empty means the default rpath for the destination
+                std::string rpath;
+            };
+
+            // parse type name (library, executable, icon or desktop-file)
+            bool parseEntryType(const std::string& name, EntryType& type);
+
+            // read entries from stream, passing every entry to the callback as soon as it has been parsed
+            // stops and returns false on the first invalid entry, or if the callback returns false
+            bool readEntries(std::istream& in, const std::function<bool(const Entry&)>& callback);
+        }
+    }
+}
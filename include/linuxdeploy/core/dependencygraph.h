@@ -0,0 +1,61 @@
+// system includes
+#include <vector>
+
+// library includes
+#include <boost/filesystem.hpp>
+
+#pragma once
+
+namespace linuxdeploy {
+    namespace core {
+        namespace dependencygraph {
+            /*
+             * Graph of the dynamic dependencies of ELF files.
+             *
+             * Files are identified by their device and inode, so every file is traced only once, no matter how many
+             * files depend on it or by which path it is referenced. The edges are the files' resolved DT_NEEDED entries.
+             * Files which inherit DT_RPATH entries from the files that caused them to be loaded are traced once for
+             * every set of inherited entries, as their dependencies might resolve differently.
+             *
+             * The closure of a file is calculated the way the dynamic loader loads its dependencies, i.e., DT_NEEDED
+             * entries matching a library loaded before by name or soname are not followed.
+             *
+             * When ldd is used, it is run once for every file added, and reports all dependencies as direct ones.
+             */
+            class DependencyGraph {
+                private:
+                    // private data class pattern
+                    class PrivateData;
+                    PrivateData* d;
+
+                public:
+                    DependencyGraph();
+                    ~DependencyGraph();
+
+                    DependencyGraph(const DependencyGraph&) = delete;
+                    DependencyGraph& operator=(const DependencyGraph&) = delete;
+
+                public:
+                    // add ELF file to the graph, tracing it and all its dependencies which haven't been traced yet
+                    // adding a file which is contained in the graph already is cheap
+                    // returns false if the file doesn't exist
+                    bool addFile(const boost::filesystem::path& path);
+
+                    // check whether a file has been added to the graph, or is a dependency without inherited DT_RPATH
+                    // entries of one that has
+                    bool contains(const boost::filesystem::path& path) const;
+
+                    // get the direct dependencies of a file in the graph
+                    // the paths are the ones the dependencies were resolved to from the given file
+                    std::vector<boost::filesystem::path> directDependencies(const boost::filesystem::path& path) const;
+
+                    // get all transitive dependencies of a file in the graph, in breadth-first order (i.e., in the order
+                    // the dynamic loader loads them)
+                    std::vector<boost::filesystem::path> closure(const boost::filesystem::path& path) const;
+
+                    // number of files in the graph
+                    size_t size() const;
+            };
+        }
+    }
+}
@@ -0,0 +1,78 @@
+// system includes
+#include <cstdint>
+#include <string>
+
+// library includes
+#include <boost/filesystem.hpp>
+
+#pragma once
+
+namespace linuxdeploy {
+    namespace core {
+        namespace deploymentmanifest {
+            // record of a file deployed into an AppDir
+            struct ManifestEntry {
+                boost::filesystem::path destination;
+
+                // state of the source file at the time it was deployed
+                boost::filesystem::path source;
+                uint64_t size;
+                int64_t mtime;
+                uint64_t device;
+                uint64_t inode;
+                // the contents are only hashed once they need to be compared, empty until then
+                std::string sha256;
+
+                // rpath set in the deployed file, empty if the rpath hasn't been changed
+                std::string rpath;
+
+                // deploy mode used, see appdir::DeployMode
+                int deployMode;
+
+                // state of the deployed file, used to detect modifications made after deploying it
+                uint64_t destinationSize;
+                int64_t destinationMtime;
+
+                // debug info mode used, see appdir::DebugInfoMode
+                int debugInfoMode;
+            };
+
+            /*
+             * Persistent list of the files deployed into an AppDir, used to skip redundant work when deploying into an
+             * existing AppDir again.
+             *
+             * The manifest is stored as a tab separated text file.
+             */
+            class DeploymentManifest {
+                private:
+                    // private data class pattern
+                    class PrivateData;
+                    PrivateData* d;
+
+                public:
+                    explicit DeploymentManifest(const boost::filesystem::path& path);
+                    ~DeploymentManifest();
+
+                    DeploymentManifest(const DeploymentManifest&) = delete;
+                    DeploymentManifest& operator=(const DeploymentManifest&) = delete;
+
+                public:
+                    // read the manifest file
+                    // a missing file results in an empty manifest, invalid files are reported and ignored
+                    void read();
+
+                    // write the manifest file atomically
+                    bool write();
+
+                    // look up entry for a deployed file
+                    bool find(const boost::filesystem::path& destination, ManifestEntry& entry) const;
+
+                    // add or replace entry
+                    void update(const ManifestEntry& entry);
+
+                    // remove entry, e.g., if deploying the file failed
+                    void remove(const boost::filesystem::path& destination);
+            };
+        }
+    }
+}
@@ -1,4 +1,5 @@
 // system includes
+#include <string>
 
 // library includes
 #include <boost/filesystem.hpp>
@@ -10,6 +11,10 @@ namespace linuxdeploy {
         namespace desktopfile {
             /*
              * Parse and read desktop files.
+             *
+             * The file is mapped into memory, and keys and values refer to the mapping instead of being copied. Entries
+             * are indexed per group, so lookups take constant time. Comments, blank lines and the order of all lines are
+             * retained, unmodified lines are written back as they were read.
              */
             class DesktopFile {
                 private:
@@ -25,6 +30,11 @@ namespace linuxdeploy {
                     // file must exist
                     explicit DesktopFile(const boost::filesystem::path& path);
 
+                    DesktopFile(const DesktopFile& other);
+                    DesktopFile& operator=(const DesktopFile& other);
+
+                    ~DesktopFile();
+
                     // read desktop file
                     // sets path associated with this file
                     bool read(const boost::filesystem::path& path);
@@ -44,6 +54,7 @@ namespace linuxdeploy {
 
                     // save desktop file to path
                     // does not change path associated with desktop file
+                    // the file is replaced atomically
                     bool save(const boost::filesystem::path& path) const;
 
                     // check if entry exists in given section and key
@@ -54,6 +65,11 @@ namespace linuxdeploy {
                     // returns true (and populates value) if the key exists, false otherwise
                     bool getEntry(const std::string& section, const std::string& key, std::string& value) const;
 
+                    // get localized key from desktop file, e.g., Name[de_DE] for locale de_DE.UTF-8
+                    // falls back to less specific locales, and eventually the unlocalized key, as defined in the desktop
+                    // entry specification
+                    bool getLocalizedEntry(const std::string& section, const std::string& key, const std::string& locale, std::string& value) const;
+
                     // add key to section in desktop file
                     // the section will be created if it doesn't exist already
                     // returns true if an existing key was overwritten, false otherwise
@@ -1,4 +1,5 @@
 // system includes
+#include <cstdint>
 #include <vector>
 #include <string>
 
@@ -10,6 +11,41 @@
 namespace linuxdeploy {
     namespace core {
         namespace elf {
+            // a modification of a file: data is written at the given offset
+            // patches past the end of the file extend it
+            struct FilePatch {
+                uint64_t offset;
+                std::string data;
+            };
+
+            // write patches to a file opened for writing, handling short writes
+            // the patches are written one after another, a failure might leave the file partially patched
+            bool applyPatches(int fd, const std::vector<FilePatch>& patches);
+
+            // removal of the debug information from an ELF file, see ElfFile::planStrip()
+            // the stripped file consists of the first length bytes of the original file, with the patches applied
+            struct StripPlan {
+                uint64_t length;
+                std::vector<FilePatch> patches;
+                uint64_t originalSize;
+                uint64_t strippedSize;
+            };
+
+            // DT_RPATH entry of an object which caused a file to be loaded
+            // unless the file has a DT_RUNPATH entry, the dynamic loader searches these for the file's dependencies, too
+            struct InheritedRPath {
+                std::string rpath;
+                // directory $ORIGIN refers to
+                boost::filesystem::path origin;
+            };
+
+            // DT_NEEDED entry, and the path it has been resolved to
+            // the path is empty if the library couldn't be found
+            struct Dependency {
+                std::string name;
+                boost::filesystem::path path;
+            };
+
             class ElfFile {
                 private:
                     class PrivateData;
@@ -19,6 +55,14 @@ namespace linuxdeploy {
                     explicit ElfFile(const boost::filesystem::path& path);
                     ~ElfFile();
 
+                public:
+                    // use ldd to trace dependencies instead of the built-in resolver
+                    // the built-in resolver emulates the dynamic loader's search without running the binary, and is
+                    // used unless ldd is requested explicitly
+                    static void setUseLdd(bool useLdd);
+
+                    static bool getUseLdd();
+
                 public:
                     // recursively trace dynamic library dependencies of a given ELF file
                     // this works for both libraries and executables
@@ -26,14 +70,51 @@ namespace linuxdeploy {
                     // linker would use
                     std::vector<boost::filesystem::path> traceDynamicDependencies();
 
+                    // resolve the direct dependencies (i.e., the DT_NEEDED entries) of a given ELF file, in the order the
+                    // dynamic loader processes them
+                    // in contrast to traceDynamicDependencies(), the file is resolved on its own, which allows for
+                    // resolving every file only once when building a dependency graph; the DT_RPATH entries of the files
+                    // which caused it to be loaded need to be passed, see getRPathsForDependencies()
+                    // this always uses the built-in resolver, and skips the dynamic loader
+                    std::vector<Dependency> resolveDirectDependencies(const std::vector<InheritedRPath>& inheritedRPaths);
+
+                    // get the DT_RPATH entries the dependencies of the file inherit, given the ones the file inherits
+                    std::vector<InheritedRPath> getRPathsForDependencies(const std::vector<InheritedRPath>& inheritedRPaths);
+
+                    // fetch DT_SONAME of the file
+                    // returns an empty string if the file doesn't have one
+                    std::string getSoname();
+
                     // fetch rpath stored in binary
                     // it appears that according to the ELF standard, the rpath is ignored in libraries, therefore if the path
                     // points to an executable, an empty string is returned
                     std::string getRPath();
 
                     // set rpath in ELF file
+                    // the file is modified in-process, patchelf is only used for files whose layout doesn't allow that
                     // returns true on success, false otherwise
                     bool setRPath(const std::string& value);
+
+                    // calculate the modifications setRPath() would make, without modifying the file
+                    // applying the patches to a copy of the file sets the rpath in the copy, which allows for patching
+                    // files while copying them
+                    // returns false if the file can't be modified in-process, in which case patchelf needs to be used, and
+                    // patches is left empty
+                    bool planRPathChange(const std::string& value, std::vector<FilePatch>& patches);
+
+                    // calculate how to remove the debug sections and the symbol table from the file, like strip does,
+                    // without modifying it
+                    // the data loaded at runtime stays in place, which allows for stripping files while copying them
+                    // returns false if there's nothing to remove, or the file's layout doesn't allow for stripping it
+                    bool planStrip(StripPlan& plan);
+
+                    // build ID of the file (the contents of its NT_GNU_BUILD_ID note) in hexadecimal notation
+                    // returns an empty string if the file doesn't have a build ID
+                    std::string getBuildId();
+
+                    // write the file's debug sections and symbol table to a separate debug file, which debuggers can
+                    // find by the file's build ID
+                    bool writeDebugFile(const boost::filesystem::path& path);
             };
         }
     }
@@ -0,0 +1,95 @@
+// system includes
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// library includes
+#include <boost/filesystem.hpp>
+
+#pragma once
+
+namespace linuxdeploy {
+    namespace core {
+        namespace elfcache {
+            // identifies a file's contents without reading them
+            // files are assumed to be unchanged as long as device, inode, size and modification time are the same
+            struct FileIdentity {
+                uint64_t device;
+                uint64_t inode;
+                uint64_t size;
+                // nanoseconds since the epoch
+                int64_t mtime;
+            };
+
+            // determine identity of the file at the given path
+            bool identify(const boost::filesystem::path& path, FileIdentity& identity);
+
+            // information read from an ELF file's headers and dynamic section
+            struct ElfInfo {
+                bool isElf;
+                bool isDynamic;
+                uint8_t elfClass;
+                uint8_t elfData;
+                uint16_t elfMachine;
+                std::string interpreter;
+                std::string soname;
+                std::vector<std::string> neededLibraries;
+                bool hasRPath;
+                bool hasRunPath;
+                std::string rpath;
+                std::string runpath;
+            };
+
+            /*
+             * Process-wide cache of the information linuxdeploy extracts from ELF files, persisted across runs.
+             *
+             * The cache file contains a sorted index of the files' identities, and is memory-mapped, so that loading it
+             * doesn't depend on its size. New records are kept in memory and merged into the file when the cache is
+             * saved. The file is only ever replaced atomically, and concurrent writers are serialized with a lock file,
+             * so that any number of processes can use the cache at the same time.
+             *
+             * Files modified in the last few seconds are not cached, as modifications within the file system's
+             * timestamp granularity cannot be detected.
+             *
+             * Only the contents of the files are cached. Dependencies are resolved again in every run, as the result
+             * depends on the contents of all the directories searched, which cannot be validated cheaply.
+             */
+            class ElfCache {
+                private:
+                    // private data class pattern
+                    class PrivateData;
+                    PrivateData* d;
+
+                private:
+                    // use getInstance() to access the cache
+                    ElfCache();
+
+                public:
+                    ~ElfCache();
+
+                    ElfCache(const ElfCache&) = delete;
+                    ElfCache& operator=(const ElfCache&) = delete;
+
+                public:
+                    // get process-wide instance
+                    static ElfCache& getInstance();
+
+                public:
+                    // load cache file from the given directory, and enable the cache
+                    // the cache is disabled until this has been called
+                    // a missing or invalid cache file results in an empty cache
+                    void enable(const boost::filesystem::path& directory);
+
+                    bool isEnabled() const;
+
+                    // look up information about the file with the given identity
+                    bool findInfo(const FileIdentity& identity, ElfInfo& info);
+
+                    void storeInfo(const FileIdentity& identity, const ElfInfo& info);
+
+                    // merge the records added in this process into the cache file
+                    bool save();
+            };
+        }
+    }
+}
@@ -0,0 +1,45 @@
+// system includes
+#include <string>
+
+// library includes
+#include <boost/filesystem.hpp>
+
+#pragma once
+
+namespace linuxdeploy {
+    namespace core {
+        namespace excludelist {
+            /*
+             * Matcher for the file names of libraries which must not be deployed.
+             *
+             * Entries are either file names or glob patterns (fnmatch(3) syntax). File names are looked up in a sorted
+             * table or a hash set, all glob patterns are compiled into a single automaton which matches a name against
+             * all of them in one pass.
+             */
+            class Excludelist {
+                private:
+                    // private data class pattern
+                    class PrivateData;
+                    PrivateData* d;
+
+                public:
+                    // creates matcher containing the built-in excludelist
+                    Excludelist();
+                    ~Excludelist();
+
+                    Excludelist(const Excludelist&) = delete;
+                    Excludelist& operator=(const Excludelist&) = delete;
+
+                public:
+                    // add a single entry
+                    void add(const std::string& entry);
+
+                    // add entries from a file using the excludelist format (one entry per line, comments start with #)
+                    bool addFromFile(const boost::filesystem::path& path);
+
+                    // check whether a file name matches any of the entries
+                    bool isExcluded(const std::string& fileName) const;
+            };
+        }
+    }
+}
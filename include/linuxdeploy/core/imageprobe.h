@@ -0,0 +1,38 @@
+// system includes
+#include <string>
+
+// library includes
+#include <boost/filesystem.hpp>
+
+#pragma once
+
+namespace linuxdeploy {
+    namespace core {
+        namespace imageprobe {
+            enum ImageFormat {
+                FORMAT_UNKNOWN = 0,
+                FORMAT_PNG,
+                FORMAT_XPM,
+                FORMAT_ICO,
+                FORMAT_SVG,
+            };
+
+            struct ImageInfo {
+                ImageFormat format;
+
+                // for SVG images, the size is taken from the root element's attributes, and might be 0 if the image
+                // doesn't specify an absolute size
+                unsigned int width;
+                unsigned int height;
+            };
+
+            // determine format and size of an image by reading its header only
+            // for ICO files, the size of the largest contained image is reported
+            // returns false if the format isn't supported or the file is invalid
+            bool probeImage(const boost::filesystem::path& path, ImageInfo& info);
+
+            // human readable name of a format
+            std::string formatName(ImageFormat format);
+        }
+    }
+}
@@ -0,0 +1,60 @@
+// system includes
+#include <cstdint>
+#include <string>
+
+// library includes
+#include <boost/filesystem.hpp>
+
+#pragma once
+
+namespace linuxdeploy {
+    namespace core {
+        namespace ldcache {
+            /*
+             * Process-wide index used to resolve library names to paths.
+             *
+             * Parses the dynamic loader's cache (/etc/ld.so.cache) once, and memoizes the results of all lookups,
+             * including negative ones, so that every library is looked up on the file system at most once per run.
+             */
+            class LibraryIndex {
+                private:
+                    // private data class pattern
+                    class PrivateData;
+                    PrivateData* d;
+
+                private:
+                    // use getInstance() to access the index
+                    LibraryIndex();
+
+                public:
+                    ~LibraryIndex();
+
+                    LibraryIndex(const LibraryIndex&) = delete;
+                    LibraryIndex& operator=(const LibraryIndex&) = delete;
+
+                public:
+                    // get process-wide instance
+                    static LibraryIndex& getInstance();
+
+                public:
+                    // check whether the file at the given path is an ELF file with the given class and machine
+                    bool isCompatible(const boost::filesystem::path& path, uint8_t elfClass, uint16_t elfMachine);
+
+                    // look up library in the dynamic loader's cache
+                    // returns true and populates result if a library with given name, ELF class and machine is found
+                    bool findInCache(const std::string& name, uint8_t elfClass, uint16_t elfMachine, boost::filesystem::path& result);
+
+                    // look up library in a directory
+                    // returns true and populates result if a library with given name, ELF class and machine is found
+                    bool findInDirectory(const boost::filesystem::path& directory, const std::string& name,
+                                         uint8_t elfClass, uint16_t elfMachine, boost::filesystem::path& result);
+
+                    // number of lookups answered from memoized results
+                    size_t cacheHits() const;
+
+                    // number of lookups which required file system access
+                    size_t cacheMisses() const;
+            };
+        }
+    }
+}
@@ -0,0 +1,71 @@
+// system includes
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// library includes
+#include <boost/filesystem.hpp>
+
+#pragma once
+
+namespace linuxdeploy {
+    namespace core {
+        namespace librarystore {
+            /*
+             * Content-addressed store of deployed files, shared by any number of AppDirs.
+             *
+             * Every object is the result of deploying a file with given contents and rpath (and, optionally, stripping
+             * it), and is identified by the hash of these. AppDirs get hardlinks (or, if that's not possible, reflinks)
+             * to the objects, so that files shared by many AppDirs are copied and patched only once, and take up disk
+             * space only once.
+             *
+             * Objects are stored in objects/<first two characters of key>/<key>, along with a <key>.sha256 file which
+             * contains the hash of the object's contents, and is used to check the store's integrity. Objects are
+             * published atomically, so that the store can be used by multiple processes at once.
+             */
+            class LibraryStore {
+                private:
+                    // private data class pattern
+                    class PrivateData;
+                    PrivateData* d;
+
+                public:
+                    explicit LibraryStore(const boost::filesystem::path& path);
+                    ~LibraryStore();
+
+                    LibraryStore(const LibraryStore&) = delete;
+                    LibraryStore& operator=(const LibraryStore&) = delete;
+
+                public:
+                    // key of the object for a file with the given content hash which is given the given rpath, and
+                    // whose debug information has been removed if stripped is set
+                    // an empty rpath means the rpath is not modified
+                    static std::string objectKey(const std::string& sourceHash, const std::string& rpath, bool stripped = false);
+
+                    const boost::filesystem::path& path() const;
+
+                    // link object to destination, replacing an existing file
+                    // returns false if the object isn't in the store, or can't be linked to the destination
+                    // safe to call from multiple threads at once
+                    bool checkout(const std::string& key, const boost::filesystem::path& destination);
+
+                    // create file for a new object, which can then be prepared and passed to add()
+                    // safe to call from multiple threads at once
+                    bool createTemporaryFile(boost::filesystem::path& path);
+
+                    // move prepared file into the store, and link the new object to destination
+                    // if another process has added the object in the meantime, the existing one is used
+                    // safe to call from multiple threads at once
+                    bool add(const std::string& key, const boost::filesystem::path& preparedFile, const boost::filesystem::path& destination);
+
+                    // remove objects which are no longer linked to from any AppDir, as well as leftover temporary files
+                    bool collectGarbage(size_t& removedObjects, uint64_t& freedBytes);
+
+                    // check the contents of all objects, and remove the corrupt ones from the store, so that they're
+                    // added again by the next deployment
+                    // AppDirs linking to corrupt objects need to be deployed again
+                    bool verify(std::vector<boost::filesystem::path>& corruptObjects);
+            };
+        }
+    }
+}
@@ -1,5 +1,9 @@
 // system includes
+#include <atomic>
+#include <cstring>
 #include <iostream>
+#include <stdexcept>
+#include <type_traits>
 
 // library includes
 #include <boost/filesystem.hpp>
@@ -21,6 +25,27 @@ namespace linuxdeploy {
                 LD_NO_SPACE,
             };
 
+            enum LD_LOG_TARGET {
+                LD_STDOUT = 0,
+                LD_STDERR,
+            };
+
+            // messages below this level are discarded at compile time, regardless of the verbosity set at runtime
+            // release builds define it to LD_INFO, see src/core/CMakeLists.txt
+            #ifndef LD_MIN_LOG_LEVEL
+            #define LD_MIN_LOG_LEVEL LD_DEBUG
+            #endif
+
+            /*
+             * Log stream.
+             *
+             * Messages are collected in a buffer per thread, and written as a whole once they're terminated with
+             * std::endl, so that messages of concurrent threads are never interleaved.
+             *
+             * Whether a message is logged is decided when its log level is set, before any of its contents are formatted.
+             * The checks are inlined, therefore messages below LD_MIN_LOG_LEVEL don't cost anything except for evaluating
+             * the operands. Use isEnabled() to skip computing expensive operands.
+             */
             class ldLog {
                 private:
                     // this is the type of std::cout
@@ -30,39 +55,137 @@ namespace linuxdeploy {
                     typedef CoutType& (* stdEndlType)(CoutType&);
 
                 private:
-                    static LD_LOGLEVEL verbosity;
+                    static std::atomic<int> verbosity;
 
                 private:
                     bool prependSpace;
                     bool logLevelSet;
-                    CoutType& stream = std::cout;
+                    bool enabled;
 
                     LD_LOGLEVEL currentLogLevel;
 
                 private:
-                    // advanced behavior
-                    ldLog(bool prependSpace, bool logLevelSet, LD_LOGLEVEL logLevel);
+                    // append to the current thread's line buffer
+                    void append(const char* data, size_t size);
+                    void appendPrefix();
+                    void appendNumber(long long val);
+                    void appendNumber(unsigned long long val);
+                    void appendNumber(double val);
+
+                    // write the current thread's line buffer to the log target
+                    void endLine();
 
-                    void checkPrependSpace();
+                    void checkPrependSpace() {
+                        if (prependSpace)
+                            append(" ", 1);
 
-                    bool checkVerbosity();
+                        prependSpace = true;
+                    }
 
                 public:
                     static void setVerbosity(LD_LOGLEVEL verbosity);
 
+                    // check whether messages of given log level are logged
+                    static bool isEnabled(LD_LOGLEVEL logLevel) {
+                        return logLevel >= LD_MIN_LOG_LEVEL && logLevel >= verbosity.load(std::memory_order_relaxed);
+                    }
+
+                    // write log to stdout (default) or stderr
+                    static void setTarget(LD_LOG_TARGET target);
+
+                    // write log to file, which is truncated
+                    // returns false if the file can't be opened, in which case the log target remains unchanged
+                    static bool setLogFile(const boost::filesystem::path& path);
+
                 public:
-                    // public constructor
-                    // does not implement the advanced behavior -- see private constructors for that
-                    ldLog();
+                    ldLog() : prependSpace(false), logLevelSet(false), enabled(isEnabled(LD_INFO)), currentLogLevel(LD_INFO) {};
 
                 public:
-                    ldLog operator<<(const std::string& message);
-                    ldLog operator<<(const char* message);
-                    ldLog operator<<(const boost::filesystem::path& path);
-                    ldLog operator<<(const double val);
-                    ldLog operator<<(stdEndlType strm);
-                    ldLog operator<<(const LD_LOGLEVEL logLevel);
-                    ldLog operator<<(const LD_STREAM_CONTROL streamControl);
+                    ldLog& operator<<(const std::string& message) {
+                        if (enabled) {
+                            checkPrependSpace();
+                            append(message.data(), message.size());
+                        }
+
+                        return *this;
+                    }
+
+                    ldLog& operator<<(const char* message) {
+                        if (enabled) {
+                            checkPrependSpace();
+                            append(message, strlen(message));
+                        }
+
+                        return *this;
+                    }
+
+                    ldLog& operator<<(const boost::filesystem::path& path) {
+                        if (enabled) {
+                            checkPrependSpace();
+                            append(path.string().data(), path.string().size());
+                        }
+
+                        return *this;
+                    }
+
+                    template<typename T>
+                    typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, ldLog&>::type operator<<(T val) {
+                        if (enabled) {
+                            checkPrependSpace();
+                            appendNumber(static_cast<long long>(val));
+                        }
+
+                        return *this;
+                    }
+
+                    template<typename T>
+                    typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value, ldLog&>::type operator<<(T val) {
+                        if (enabled) {
+                            checkPrependSpace();
+                            appendNumber(static_cast<unsigned long long>(val));
+                        }
+
+                        return *this;
+                    }
+
+                    ldLog& operator<<(const double val) {
+                        if (enabled) {
+                            checkPrependSpace();
+                            appendNumber(val);
+                        }
+
+                        return *this;
+                    }
+
+                    ldLog& operator<<(stdEndlType) {
+                        if (enabled)
+                            endLine();
+
+                        prependSpace = false;
+                        return *this;
+                    }
+
+                    ldLog& operator<<(const LD_LOGLEVEL logLevel) {
+                        if (logLevelSet) {
+                            throw std::runtime_error(
+                                "log level must be first element passed via the stream insertion operator");
+                        }
+
+                        logLevelSet = true;
+                        currentLogLevel = logLevel;
+                        enabled = isEnabled(logLevel);
+
+                        if (enabled)
+                            appendPrefix();
+
+                        prependSpace = false;
+                        return *this;
+                    }
+
+                    ldLog& operator<<(const LD_STREAM_CONTROL streamControl) {
+                        prependSpace = streamControl != LD_NO_SPACE;
+                        return *this;
+                    }
             };
         }
     }
@@ -0,0 +1,46 @@
+// system includes
+#include <cstddef>
+#include <string>
+
+// library includes
+#include <boost/filesystem.hpp>
+
+#pragma once
+
+namespace linuxdeploy {
+    namespace core {
+        namespace sha256 {
+            /*
+             * Incremental SHA-256 (FIPS 180-4) hash computation.
+             */
+            class Hash {
+                private:
+                    // private data class pattern
+                    class PrivateData;
+                    PrivateData* d;
+
+                public:
+                    Hash();
+                    ~Hash();
+
+                    Hash(const Hash&) = delete;
+                    Hash& operator=(const Hash&) = delete;
+
+                public:
+                    // feed data into the hash
+                    void update(const void* data, size_t size);
+
+                    // finish computation and return the digest as lowercase hex string
+                    // no more data may be passed to update() afterwards
+                    std::string hexDigest();
+            };
+
+            // compute hex digest of a string
+            std::string hashString(const std::string& data);
+
+            // compute hex digest of a file's contents
+            // returns false if the file can't be read
+            bool hashFile(const boost::filesystem::path& path, std::string& hexDigest);
+        }
+    }
+}
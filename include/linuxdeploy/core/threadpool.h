@@ -0,0 +1,47 @@
+// system includes
+#include <cstddef>
+#include <functional>
+
+#pragma once
+
+namespace linuxdeploy {
+    namespace core {
+        namespace threadpool {
+            /*
+             * Fixed-size pool of worker threads processing tasks in the order they are submitted.
+             *
+             * A pool with a single thread doesn't spawn any threads, but runs the tasks synchronously on submission.
+             */
+            class ThreadPool {
+                private:
+                    // private data class pattern
+                    class PrivateData;
+                    PrivateData* d;
+
+                public:
+                    explicit ThreadPool(size_t numberOfThreads);
+
+                    // waits for all submitted tasks before terminating the worker threads
+                    ~ThreadPool();
+
+                    ThreadPool(const ThreadPool&) = delete;
+                    ThreadPool& operator=(const ThreadPool&) = delete;
+
+                public:
+                    // number of threads to use if the user didn't specify any
+                    static size_t defaultNumberOfThreads();
+
+                public:
+                    // submit task to the pool
+                    // tasks may submit other tasks, but must not call wait()
+                    // tasks must not throw exceptions
+                    void submit(std::function<void()> task);
+
+                    // block until all submitted tasks (including the ones they submitted) have finished
+                    void wait();
+
+                    size_t numberOfThreads() const;
+            };
+        }
+    }
+}
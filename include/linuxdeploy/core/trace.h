@@ -0,0 +1,103 @@
+// system includes
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// library includes
+#include <boost/filesystem.hpp>
+
+#pragma once
+
+namespace linuxdeploy {
+    namespace core {
+        namespace trace {
+            /*
+             * Lightweight instrumentation of the deployment process.
+             *
+             * Tracing is disabled by default, in which case spans and counters cost a single relaxed atomic load. Once
+             * enabled, spans are recorded in per-thread buffers, and can be exported in the Chrome trace event format,
+             * which can be loaded in chrome://tracing or Perfetto.
+             */
+
+            enum Counter {
+                COUNTER_BYTES_COPIED = 0,
+                COUNTER_FILES_COPIED,
+                COUNTER_FILES_LINKED,
+                COUNTER_FILES_UNCHANGED,
+                COUNTER_SUBPROCESSES,
+                COUNTER_LIBRARY_CACHE_HITS,
+                COUNTER_LIBRARY_CACHE_MISSES,
+                COUNTER_ICON_CACHE_HITS,
+                COUNTER_ELF_CACHE_HITS,
+                COUNTER_ELF_CACHE_MISSES,
+                COUNTER_LIBRARY_STORE_HITS,
+                COUNTER_LIBRARY_STORE_MISSES,
+                COUNTER_BYTES_STRIPPED,
+                NUMBER_OF_COUNTERS,
+            };
+
+            // use isEnabled() instead
+            extern std::atomic<bool> enabled;
+
+            // start recording spans and counters
+            void enable();
+
+            inline bool isEnabled() {
+                return enabled.load(std::memory_order_relaxed);
+            }
+
+            // implementation of addToCounter()
+            void addToCounterImpl(Counter counter, uint64_t value);
+
+            inline void addToCounter(Counter counter, uint64_t value = 1) {
+                if (isEnabled())
+                    addToCounterImpl(counter, value);
+            }
+
+            /*
+             * Records the time between its construction and destruction, typically the duration of a scope.
+             *
+             * The name must be a string literal, as it's not copied. The optional detail, e.g., the path of the file which
+             * is processed, is only copied if tracing is enabled.
+             */
+            class Span {
+                private:
+                    const char* name;
+                    std::string detail;
+                    int64_t start;
+                    bool active;
+
+                private:
+                    void begin();
+                    void end();
+
+                public:
+                    explicit Span(const char* name) : name(name), start(0), active(isEnabled()) {
+                        if (active)
+                            begin();
+                    }
+
+                    Span(const char* name, const boost::filesystem::path& detail) : name(name), start(0), active(isEnabled()) {
+                        if (active) {
+                            this->detail = detail.string();
+                            begin();
+                        }
+                    }
+
+                    ~Span() {
+                        if (active)
+                            end();
+                    }
+
+                    Span(const Span&) = delete;
+                    Span& operator=(const Span&) = delete;
+            };
+
+            // write all spans and counters recorded so far to a file in the Chrome trace event format
+            bool writeChromeTrace(const boost::filesystem::path& path);
+
+            // log table of the total time spent in every kind of span, and the counters' values
+            void logSummary();
+        }
+    }
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdlib>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -52,6 +54,23 @@ namespace linuxdeploy {
                 std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return std::tolower(c); });
                 return s;
             }
+
+            // directory for linuxdeploy's persistent caches, according to the XDG base directory specification
+            // returns an empty string if neither XDG_CACHE_HOME nor HOME are set
+            static inline std::string getCacheDirectory() {
+                const char* xdgCacheHome = getenv("XDG_CACHE_HOME");
+
+                // relative paths are invalid according to the specification, and must be ignored
+                if (xdgCacheHome != nullptr && xdgCacheHome[0] == '/')
+                    return std::string(xdgCacheHome) + "/linuxdeploy";
+
+                const char* home = getenv("HOME");
+
+                if (home != nullptr && home[0] != '\0')
+                    return std::string(home) + "/.cache/linuxdeploy";
+
+                return "";
+            }
         }
     }
 }
@@ -0,0 +1,277 @@
+// system includes
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <set>
+#include <sstream>
+
+// library headers
+#include <subprocess.hpp>
+
+// local headers
+#include "linuxdeploy/core/log.h"
+#include "linuxdeploy/core/threadpool.h"
+#include "fixturegenerator.h"
+
+using namespace linuxdeploy::core;
+using namespace linuxdeploy::core::log;
+
+namespace bf = boost::filesystem;
+
+#ifndef LINUXDEPLOY_BENCH_C_COMPILER
+#define LINUXDEPLOY_BENCH_C_COMPILER "cc"
+#endif
+
+namespace linuxdeploy {
+    namespace bench {
+        static std::string libraryName(unsigned int level, unsigned int index) {
+            return "bench_" + std::to_string(level) + "_" + std::to_string(index);
+        }
+
+        // dependencies are picked deterministically, spreading the dependents evenly across the next level
+        static std::vector<unsigned int> dependencyIndices(const FixtureParameters& parameters, unsigned int index) {
+            std::vector<unsigned int> indices;
+
+            for (unsigned int i = 0; i < std::min(parameters.fanOut, parameters.width); i++)
+                indices.push_back((index * parameters.fanOut + i) % parameters.width);
+
+            return indices;
+        }
+
+        // number of libraries reachable from the given dependencies of the first level
+        static size_t countTransitiveDependencies(const FixtureParameters& parameters, std::vector<unsigned int> indices) {
+            size_t count = 0;
+
+            for (unsigned int level = 0; level < parameters.depth && !indices.empty(); level++) {
+                std::set<unsigned int> uniqueIndices(indices.begin(), indices.end());
+                count += uniqueIndices.size();
+
+                indices.clear();
+
+                for (const auto index : uniqueIndices) {
+                    const auto dependencies = dependencyIndices(parameters, index);
+                    indices.insert(indices.end(), dependencies.begin(), dependencies.end());
+                }
+            }
+
+            return count;
+        }
+
+        static bool compile(const std::vector<std::string>& args) {
+            subprocess::Popen compilerProc(
+                args,
+                subprocess::output{subprocess::PIPE},
+                subprocess::error{subprocess::PIPE}
+            );
+
+            auto compilerOutput = compilerProc.communicate();
+
+            if (compilerProc.retcode() != 0) {
+                ldLog() << LD_ERROR << "Call to compiler failed:" << std::endl << compilerOutput.second.buf.data() << std::endl;
+                return false;
+            }
+
+            return true;
+        }
+
+        static bool writeFile(const bf::path& path, const std::string& contents) {
+            std::ofstream ofs(path.string(), std::ios::binary);
+            ofs << contents;
+            return static_cast<bool>(ofs);
+        }
+
+        static uint32_t crc32(const std::string& data, uint32_t crc = 0) {
+            crc = ~crc;
+
+            for (const auto c : data) {
+                crc ^= static_cast<unsigned char>(c);
+
+                for (int i = 0; i < 8; i++)
+                    crc = (crc >> 1) ^ (0xedb88320u & (0u - (crc & 1u)));
+            }
+
+            return ~crc;
+        }
+
+        static void appendBigEndian(std::string& out, uint32_t value) {
+            for (int shift = 24; shift >= 0; shift -= 8)
+                out += static_cast<char>((value >> shift) & 0xff);
+        }
+
+        static void appendChunk(std::string& out, const std::string& type, const std::string& data) {
+            appendBigEndian(out, static_cast<uint32_t>(data.size()));
+            out += type;
+            out += data;
+            appendBigEndian(out, crc32(type + data));
+        }
+
+        // PNG image of given size, with the pixel data stored uncompressed, so that no compression library is needed
+        static std::string generatePng(unsigned int size, unsigned int seed) {
+            std::string pixels;
+
+            for (unsigned int y = 0; y < size; y++) {
+                // filter type
+                pixels += '\0';
+
+                for (unsigned int x = 0; x < size; x++) {
+                    pixels += static_cast<char>((x + seed) & 0xff);
+                    pixels += static_cast<char>((y + seed) & 0xff);
+                    pixels += static_cast<char>(seed & 0xff);
+                    pixels += static_cast<char>(0xff);
+                }
+            }
+
+            // zlib stream consisting of stored deflate blocks
+            std::string zlib = "\x78\x01";
+
+            for (size_t offset = 0; offset < pixels.size(); offset += 65535) {
+                const auto length = std::min<size_t>(65535, pixels.size() - offset);
+                const bool last = offset + length == pixels.size();
+
+                zlib += static_cast<char>(last ? 1 : 0);
+                zlib += static_cast<char>(length & 0xff);
+                zlib += static_cast<char>(length >> 8);
+                zlib += static_cast<char>(~length & 0xff);
+                zlib += static_cast<char>((~length >> 8) & 0xff);
+                zlib.append(pixels, offset, length);
+            }
+
+            uint32_t a = 1, b = 0;
+
+            for (const auto c : pixels) {
+                a = (a + static_cast<unsigned char>(c)) % 65521;
+                b = (b + a) % 65521;
+            }
+
+            appendBigEndian(zlib, (b << 16) | a);
+
+            std::string header;
+            appendBigEndian(header, size);
+            appendBigEndian(header, size);
+            // 8 bits per channel, RGBA, default compression, filter and interlace methods
+            header += std::string("\x08\x06\x00\x00\x00", 5);
+
+            std::string png = "\x89PNG\r\n\x1a\n";
+            appendChunk(png, "IHDR", header);
+            appendChunk(png, "IDAT", zlib);
+            appendChunk(png, "IEND", "");
+
+            return png;
+        }
+
+        bool generateFixture(const FixtureParameters& parameters, const bf::path& directory, Fixture& fixture) {
+            if (parameters.depth < 1 || parameters.width < 1) {
+                ldLog() << LD_ERROR << "Fixture needs at least one level with one library" << std::endl;
+                return false;
+            }
+
+            const auto sourceDirectory = directory / "src";
+            const auto libraryDirectory = directory / "lib";
+            const auto executableDirectory = directory / "bin";
+            const auto iconDirectory = directory / "icons";
+
+            for (const auto& path : {sourceDirectory, libraryDirectory, executableDirectory, iconDirectory})
+                bf::create_directories(path);
+
+            fixture = Fixture();
+            fixture.directory = directory;
+
+            threadpool::ThreadPool pool(threadpool::ThreadPool::defaultNumberOfThreads());
+            std::atomic<bool> success(true);
+
+            // the libraries need to be built bottom-up, as they're linked against their dependencies
+            for (unsigned int level = parameters.depth; level-- > 0;) {
+                for (unsigned int index = 0; index < parameters.width; index++) {
+                    const auto name = libraryName(level, index);
+                    const auto sourcePath = sourceDirectory / (name + ".c");
+                    const auto libraryPath = libraryDirectory / ("lib" + name + ".so");
+
+                    std::ostringstream source;
+                    source << "const unsigned char " << name << "_payload[" << std::max<size_t>(parameters.librarySize, 1) << "] = {1};" << std::endl;
+
+                    // like in typical build trees, the rpath contains the absolute path of the library directory, which
+                    // leaves room for setting other rpaths in-process
+                    std::vector<std::string> args = {LINUXDEPLOY_BENCH_C_COMPILER, "-shared", "-fPIC", "-o", libraryPath.string(),
+                                                     sourcePath.string(), "-Wl,-soname,lib" + name + ".so", "-L" + libraryDirectory.string(),
+                                                     "-Wl,-rpath,$ORIGIN:" + libraryDirectory.string()};
+
+                    std::string calls = name + "_payload[0]";
+
+                    if (level + 1 < parameters.depth) {
+                        for (const auto dependency : dependencyIndices(parameters, index)) {
+                            const auto dependencyName = libraryName(level + 1, dependency);
+                            source << "int " << dependencyName << "(void);" << std::endl;
+                            calls += " + " + dependencyName + "()";
+                            args.push_back("-l" + dependencyName);
+                        }
+                    }
+
+                    source << "int " << name << "(void) { return " << calls << "; }" << std::endl;
+
+                    if (!writeFile(sourcePath, source.str()))
+                        return false;
+
+                    fixture.libraries.push_back(libraryPath);
+
+                    pool.submit([args, &success]() {
+                        if (!compile(args))
+                            success = false;
+                    });
+                }
+
+                pool.wait();
+
+                if (!success)
+                    return false;
+            }
+
+            for (unsigned int i = 0; i < parameters.numberOfExecutables; i++) {
+                const auto name = "bench_executable_" + std::to_string(i);
+                const auto sourcePath = sourceDirectory / (name + ".c");
+                const auto executablePath = executableDirectory / name;
+
+                std::ostringstream source;
+                std::string calls = "0";
+
+                std::vector<std::string> args = {LINUXDEPLOY_BENCH_C_COMPILER, "-o", executablePath.string(), sourcePath.string(),
+                                                 "-L" + libraryDirectory.string(), "-Wl,-rpath,$ORIGIN/../lib"};
+
+                for (const auto dependency : dependencyIndices(parameters, i)) {
+                    const auto dependencyName = libraryName(0, dependency);
+                    source << "int " << dependencyName << "(void);" << std::endl;
+                    calls += " + " + dependencyName + "()";
+                    args.push_back("-l" + dependencyName);
+                }
+
+                source << "int main(void) { return (" << calls << ") == 0; }" << std::endl;
+
+                if (!writeFile(sourcePath, source.str()))
+                    return false;
+
+                fixture.executables.push_back(executablePath);
+                fixture.executableDependencyCounts.push_back(countTransitiveDependencies(parameters, dependencyIndices(parameters, i)));
+
+                pool.submit([args, &success]() {
+                    if (!compile(args))
+                        success = false;
+                });
+            }
+
+            pool.wait();
+
+            if (!success)
+                return false;
+
+            for (unsigned int i = 0; i < parameters.numberOfIcons; i++) {
+                const auto iconPath = iconDirectory / ("bench_icon_" + std::to_string(i) + ".png");
+
+                if (!writeFile(iconPath, generatePng(parameters.iconSize, i)))
+                    return false;
+
+                fixture.icons.push_back(iconPath);
+            }
+
+            return true;
+        }
+    }
+}
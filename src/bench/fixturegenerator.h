@@ -0,0 +1,45 @@
+// system includes
+#include <string>
+#include <vector>
+
+// library includes
+#include <boost/filesystem.hpp>
+
+#pragma once
+
+namespace linuxdeploy {
+    namespace bench {
+        // shape of the generated library graph
+        // the libraries are arranged in levels, every library depends on fanOut libraries of the next level, so that
+        // libraries are shared by several dependents like in real-world applications
+        struct FixtureParameters {
+            // number of levels
+            unsigned int depth;
+            // number of libraries per level
+            unsigned int width;
+            // number of dependencies of every library, and of every executable on the first level
+            unsigned int fanOut;
+            // size of the payload every library carries, in bytes
+            size_t librarySize;
+            unsigned int numberOfExecutables;
+            unsigned int numberOfIcons;
+            // width and height of the icons
+            unsigned int iconSize;
+        };
+
+        struct Fixture {
+            boost::filesystem::path directory;
+            std::vector<boost::filesystem::path> libraries;
+            std::vector<boost::filesystem::path> executables;
+            // number of fixture libraries every executable depends on, directly or indirectly
+            std::vector<size_t> executableDependencyCounts;
+            std::vector<boost::filesystem::path> icons;
+        };
+
+        // generate C sources for the library graph, and build them with the system's C compiler
+        // executables are put in bin/, libraries in lib/, and icons in icons/
+        // the files are linked with $ORIGIN based rpaths, so that they can be resolved without any further configuration
+        // the libraries additionally contain the library directory's absolute path, like in typical build trees
+        bool generateFixture(const FixtureParameters& parameters, const boost::filesystem::path& directory, Fixture& fixture);
+    }
+}
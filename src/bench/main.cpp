@@ -0,0 +1,320 @@
+// system headers
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+
+// library headers
+#include <args.hxx>
+
+// local headers
+#include "linuxdeploy/core/appdir.h"
+#include "linuxdeploy/core/elf.h"
+#include "linuxdeploy/core/log.h"
+#include "fixturegenerator.h"
+
+using namespace linuxdeploy::core;
+using namespace linuxdeploy::core::log;
+using namespace linuxdeploy::bench;
+
+namespace bf = boost::filesystem;
+
+struct BenchmarkResult {
+    std::string name;
+    // milliseconds per iteration
+    std::vector<double> samples;
+};
+
+// run benchmark the given number of times
+// only run is timed, setup prepares every iteration
+// returns false as soon as setup or run fail, as timing a failed run would be meaningless
+static bool runBenchmark(const std::string& name, unsigned int iterations, const std::function<bool(unsigned int)>& setup,
+                         const std::function<bool(unsigned int)>& run, std::vector<BenchmarkResult>& results) {
+    std::cerr << "Running benchmark " << name << std::endl;
+
+    BenchmarkResult result;
+    result.name = name;
+
+    for (unsigned int i = 0; i < iterations; i++) {
+        if (!setup(i)) {
+            std::cerr << "Setup of benchmark " << name << " failed" << std::endl;
+            return false;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        const bool success = run(i);
+        const auto end = std::chrono::steady_clock::now();
+
+        if (!success) {
+            std::cerr << "Benchmark " << name << " failed" << std::endl;
+            return false;
+        }
+
+        result.samples.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+    }
+
+    results.push_back(result);
+    return true;
+}
+
+static std::string toJson(const FixtureParameters& parameters, const Fixture& fixture, unsigned int iterations,
+                          const std::vector<BenchmarkResult>& results) {
+    std::ostringstream json;
+
+    json << "{" << std::endl;
+    json << "  \"fixture\": {\"depth\": " << parameters.depth << ", \"width\": " << parameters.width
+         << ", \"fan_out\": " << parameters.fanOut << ", \"library_size\": " << parameters.librarySize
+         << ", \"libraries\": " << fixture.libraries.size() << ", \"executables\": " << fixture.executables.size()
+         << ", \"icons\": " << fixture.icons.size() << ", \"icon_size\": " << parameters.iconSize << "}," << std::endl;
+    json << "  \"iterations\": " << iterations << "," << std::endl;
+    json << "  \"benchmarks\": [" << std::endl;
+
+    for (size_t i = 0; i < results.size(); i++) {
+        auto samples = results[i].samples;
+        std::sort(samples.begin(), samples.end());
+
+        double sum = 0;
+        for (const auto sample : samples)
+            sum += sample;
+
+        const auto median = samples.size() % 2 == 1
+            ? samples[samples.size() / 2]
+            : (samples[samples.size() / 2 - 1] + samples[samples.size() / 2]) / 2;
+
+        json << "    {\"name\": \"" << results[i].name << "\", \"min_ms\": " << samples.front()
+             << ", \"median_ms\": " << median << ", \"mean_ms\": " << sum / samples.size()
+             << ", \"max_ms\": " << samples.back() << "}" << (i + 1 < results.size() ? "," : "") << std::endl;
+    }
+
+    json << "  ]" << std::endl;
+    json << "}" << std::endl;
+
+    return json.str();
+}
+
+int main(int argc, char** argv) {
+    args::ArgumentParser parser(
+        "linuxdeploy-bench -- benchmark linuxdeploy on a synthetic library graph"
+    );
+
+    args::HelpFlag help(parser, "help", "Display this help text.", {'h', "help"});
+
+    args::ValueFlag<unsigned int> depth(parser, "levels", "Number of levels of the library graph (default: 4)", {"depth"});
+    args::ValueFlag<unsigned int> width(parser, "libraries", "Number of libraries per level (default: 16)", {"width"});
+    args::ValueFlag<unsigned int> fanOut(parser, "dependencies", "Number of dependencies of every library and executable (default: 4)", {"fan-out"});
+    args::ValueFlag<size_t> librarySize(parser, "bytes", "Size of every library's payload (default: 65536)", {"library-size"});
+    args::ValueFlag<unsigned int> numberOfExecutables(parser, "executables", "Number of executables (default: 8)", {"executables"});
+    args::ValueFlag<unsigned int> numberOfIcons(parser, "icons", "Number of icons (default: 8)", {"icons"});
+    args::ValueFlag<unsigned int> iconSize(parser, "pixels", "Width and height of the icons (default: 256)", {"icon-size"});
+
+    args::ValueFlag<unsigned int> iterations(parser, "iterations", "Number of times every benchmark is run (default: 5)", {'n', "iterations"});
+    args::ValueFlag<std::string> workDirectory(parser, "directory", "Directory the fixture and the AppDirs are created in (default: temporary directory, removed afterwards)", {"work-dir"});
+    args::ValueFlag<std::string> outputPath(parser, "file", "Write results to file instead of stdout", {'o', "output"});
+
+    try {
+        parser.ParseCLI(argc, argv);
+    } catch (args::Help&) {
+        std::cerr << parser;
+        return 0;
+    } catch (args::ParseError& e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << parser;
+        return 1;
+    }
+
+    // the deployment's own output would drown the benchmark's
+    ldLog::setVerbosity(LD_WARNING);
+    ldLog::setTarget(LD_STDERR);
+
+    FixtureParameters parameters;
+    parameters.depth = depth ? depth.Get() : 4;
+    parameters.width = width ? width.Get() : 16;
+    parameters.fanOut = fanOut ? fanOut.Get() : 4;
+    parameters.librarySize = librarySize ? librarySize.Get() : 65536;
+    parameters.numberOfExecutables = numberOfExecutables ? numberOfExecutables.Get() : 8;
+    parameters.numberOfIcons = numberOfIcons ? numberOfIcons.Get() : 8;
+    parameters.iconSize = iconSize ? iconSize.Get() : 256;
+
+    const auto numberOfIterations = iterations ? std::max(iterations.Get(), 1u) : 5u;
+
+    const bool removeWorkDirectory = !workDirectory;
+    const auto workDirectoryPath = workDirectory
+        ? bf::absolute(workDirectory.Get())
+        : bf::temp_directory_path() / bf::unique_path("linuxdeploy-bench-%%%%-%%%%-%%%%");
+
+    std::cerr << "Generating fixture in " << workDirectoryPath << std::endl;
+
+    Fixture fixture;
+
+    if (!generateFixture(parameters, workDirectoryPath / "fixture", fixture)) {
+        std::cerr << "Failed to generate fixture" << std::endl;
+        return 1;
+    }
+
+    const auto scratchPath = workDirectoryPath / "scratch";
+    const auto appDirPath = scratchPath / "AppDir";
+
+    std::unique_ptr<appdir::AppDir> appDir;
+
+    // fresh AppDir for every iteration, so that the results don't depend on previous runs' files
+    auto newAppDir = [&appDir, &appDirPath]() {
+        appDir.reset();
+        bf::remove_all(appDirPath);
+        appDir.reset(new appdir::AppDir(appDirPath));
+    };
+
+    auto noSetup = [](unsigned int) { return true; };
+
+    std::vector<BenchmarkResult> results;
+
+    // the benchmarks are run until the first one fails, the work directory is cleaned up either way
+    auto runBenchmarks = [&]() -> bool {
+        if (!runBenchmark("trace_dependencies", numberOfIterations, noSetup, [&fixture](unsigned int) -> bool {
+            for (size_t i = 0; i < fixture.executables.size(); i++) {
+                const auto dependencies = elf::ElfFile(fixture.executables[i]).traceDynamicDependencies();
+
+                // system libraries are reported, too, and are not part of the fixture
+                const auto numberOfFixtureLibraries = std::count_if(dependencies.begin(), dependencies.end(), [](const bf::path& path) {
+                    return path.filename().string().compare(0, 9, "libbench_") == 0;
+                });
+
+                if (static_cast<size_t>(numberOfFixtureLibraries) != fixture.executableDependencyCounts[i]) {
+                    std::cerr << "Expected " << fixture.executableDependencyCounts[i] << " dependencies of " << fixture.executables[i]
+                              << ", found " << numberOfFixtureLibraries << std::endl;
+                    return false;
+                }
+            }
+
+            return true;
+        }, results)) {
+            return false;
+        }
+
+        // the libraries are patched in a copy of the fixture, alternating between two values so that every iteration
+        // actually changes the files
+        const auto rpathPath = scratchPath / "rpath";
+        std::vector<bf::path> rpathLibraries;
+
+        bf::create_directories(rpathPath);
+
+        for (const auto& library : fixture.libraries) {
+            rpathLibraries.push_back(rpathPath / library.filename());
+            bf::copy_file(library, rpathLibraries.back(), bf::copy_option::overwrite_if_exists);
+        }
+
+        if (!runBenchmark("set_rpath", numberOfIterations, noSetup, [&rpathLibraries](unsigned int iteration) -> bool {
+            const std::string rpath = iteration % 2 == 0 ? "$ORIGIN/../lib" : "$ORIGIN";
+
+            for (const auto& library : rpathLibraries) {
+                if (!elf::ElfFile(library).setRPath(rpath))
+                    return false;
+            }
+
+            return true;
+        }, results)) {
+            return false;
+        }
+
+        // deploying files which have been deployed already only involves the duplicate check
+        if (!runBenchmark("check_duplicate", numberOfIterations, [&](unsigned int) -> bool {
+            newAppDir();
+
+            for (const auto& library : fixture.libraries) {
+                if (!appDir->deployLibrary(library))
+                    return false;
+            }
+
+            return true;
+        }, [&](unsigned int) -> bool {
+            for (const auto& library : fixture.libraries) {
+                if (!appDir->deployLibrary(library))
+                    return false;
+            }
+
+            return true;
+        }, results)) {
+            return false;
+        }
+
+        if (!runBenchmark("execute_deferred_operations", numberOfIterations, [&](unsigned int) -> bool {
+            newAppDir();
+
+            for (const auto& executable : fixture.executables) {
+                if (!appDir->deployExecutable(executable))
+                    return false;
+            }
+
+            return true;
+        }, [&](unsigned int) -> bool {
+            return appDir->executeDeferredOperations();
+        }, results)) {
+            return false;
+        }
+
+        if (!runBenchmark("deploy_icon", numberOfIterations, [&](unsigned int) -> bool {
+            newAppDir();
+            return true;
+        }, [&](unsigned int) -> bool {
+            for (const auto& icon : fixture.icons) {
+                if (!appDir->deployIcon(icon))
+                    return false;
+            }
+
+            return true;
+        }, results)) {
+            return false;
+        }
+
+        return runBenchmark("end_to_end", numberOfIterations, [&](unsigned int) -> bool {
+            appDir.reset();
+            bf::remove_all(appDirPath);
+            return true;
+        }, [&](unsigned int) -> bool {
+            appDir.reset(new appdir::AppDir(appDirPath));
+
+            if (!appDir->createBasicStructure())
+                return false;
+
+            for (const auto& executable : fixture.executables) {
+                if (!appDir->deployExecutable(executable))
+                    return false;
+            }
+
+            for (const auto& icon : fixture.icons) {
+                if (!appDir->deployIcon(icon))
+                    return false;
+            }
+
+            return appDir->executeDeferredOperations();
+        }, results);
+    };
+
+    const bool success = runBenchmarks();
+
+    appDir.reset();
+
+    if (removeWorkDirectory)
+        bf::remove_all(workDirectoryPath);
+
+    // results of partial runs would be mistaken for complete ones
+    if (!success)
+        return 1;
+
+    const auto json = toJson(parameters, fixture, numberOfIterations, results);
+
+    if (outputPath) {
+        std::ofstream ofs(outputPath.Get());
+
+        if (!(ofs << json)) {
+            std::cerr << "Failed to write results to " << outputPath.Get() << std::endl;
+            return 1;
+        }
+    } else {
+        std::cout << json;
+    }
+
+    return 0;
+}
@@ -1,159 +1,1441 @@
 // library headers
 #include <boost/filesystem.hpp>
 #include <Magick++.h>
-#include <fnmatch.h>
 #include <dirent.h>
-#include <fts.h>
-#include <subprocess.hpp>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 // local headers
 #include "linuxdeploy/core/appdir.h"
+#include "linuxdeploy/core/archive.h"
+#include "linuxdeploy/core/dependencygraph.h"
+#include "linuxdeploy/core/deploymentmanifest.h"
 #include "linuxdeploy/core/elf.h"
+#include "linuxdeploy/core/excludelist.h"
+#include "linuxdeploy/core/imageprobe.h"
+#include "linuxdeploy/core/librarystore.h"
 #include "linuxdeploy/core/log.h"
+#include "linuxdeploy/core/sha256.h"
+#include "linuxdeploy/core/threadpool.h"
+#include "linuxdeploy/core/trace.h"
 #include "linuxdeploy/core/util.h"
-#include "excludelist.h"
 
 using namespace linuxdeploy::core;
 using namespace linuxdeploy::core::log;
 
 namespace bf = boost::filesystem;
 
+// older kernel headers don't define the reflink ioctl yet
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+
 namespace linuxdeploy {
     namespace core {
         namespace appdir {
+            // normalize path lexically, i.e., remove . and resolve .. components without accessing the file system
+            static bf::path lexicallyNormal(const bf::path& path) {
+                std::vector<std::string> components;
+
+                for (const auto& component : path) {
+                    const auto& value = component.string();
+
+                    // the root directory is restored below, trailing slashes are represented by .
+                    if (value == "/" || value == "." || value.empty())
+                        continue;
+
+                    if (value == "..") {
+                        if (!components.empty() && components.back() != "..") {
+                            components.pop_back();
+                            continue;
+                        }
+
+                        // the parent of the root directory is the root directory itself
+                        if (path.is_absolute())
+                            continue;
+                    }
+
+                    components.push_back(value);
+                }
+
+                bf::path result = path.is_absolute() ? "/" : "";
+
+                for (const auto& component : components)
+                    result /= component;
+
+                return result;
+            }
+
+            // compute path relative to base directory lexically, both paths need to be absolute and normalized
+            static bf::path lexicallyRelative(const bf::path& path, const bf::path& base) {
+                auto pathIt = path.begin();
+                auto baseIt = base.begin();
+
+                while (pathIt != path.end() && baseIt != base.end() && *pathIt == *baseIt) {
+                    ++pathIt;
+                    ++baseIt;
+                }
+
+                bf::path result;
+
+                for (; baseIt != base.end(); ++baseIt)
+                    result /= "..";
+
+                for (; pathIt != path.end(); ++pathIt)
+                    result /= *pathIt;
+
+                if (result.empty())
+                    result = ".";
+
+                return result;
+            }
+
+            // destinations must be relative to, and stay within, the AppDir
+            static bool isValidDestination(const bf::path& destination) {
+                if (destination.empty() || destination.is_absolute())
+                    return false;
+
+                const auto normalizedDestination = lexicallyNormal(destination);
+
+                return normalizedDestination.empty() || *normalizedDestination.begin() != "..";
+            }
+
+            // rpath which lets the dynamic loader find the libraries in usr/lib from ELF files in the given directory
+            // the directory is relative to the AppDir root
+            static std::string defaultRPath(const bf::path& directory) {
+                const auto relativePath = lexicallyRelative(bf::path("usr/lib"), lexicallyNormal(directory));
+
+                // files in usr/lib keep the rpath they've always been given, which is equivalent to $ORIGIN
+                if (relativePath == ".")
+                    return "$ORIGIN/../lib";
+
+                return "$ORIGIN/" + relativePath.string();
+            }
+
+            // sizes of the icons generated from icon sources, createBasicStructure() creates directories for these
+            static const std::vector<unsigned int> standardIconSizes = {16, 32, 64, 128, 256};
+
+            // render icon source at the given size into a PNG file
+            // the file is written under a temporary name and then renamed, so that concurrent runs sharing a cache never
+            // see partially written files
+            static bool renderIcon(const bf::path& source, const imageprobe::ImageInfo& info, unsigned int size,
+                                   const bf::path& target, std::string& error) {
+                trace::Span span("render icon", target);
+
+                static std::atomic<unsigned int> counter(0);
+                const auto tempPath = target.string() + "." + std::to_string(getpid()) + "-" + std::to_string(counter++) + ".tmp";
+
+                try {
+                    Magick::Image image;
+
+                    if (info.format == imageprobe::FORMAT_SVG) {
+                        // rasterize vector images at the target size right away instead of scaling a bitmap rendered at
+                        // the default size, which is what the density is for (the default is 96 dpi)
+                        const auto baseSize = std::max(info.width, info.height) > 0 ? std::max(info.width, info.height) : size;
+                        const auto density = static_cast<size_t>(96.0 * size / baseSize + 0.5);
+
+                        image.density(Magick::Geometry(density, density));
+                        image.backgroundColor("none");
+                    }
+
+                    image.read(source.string());
+                    image.resize(Magick::Geometry(size, size));
+                    image.magick("PNG");
+                    image.write("PNG:" + tempPath);
+                } catch (const Magick::Exception& e) {
+                    error = e.what();
+                    unlink(tempPath.c_str());
+                    return false;
+                }
+
+                if (rename(tempPath.c_str(), target.c_str()) != 0) {
+                    error = strerror(errno);
+                    unlink(tempPath.c_str());
+                    return false;
+                }
+
+                return true;
+            }
+
+            // methods used to copy file contents, from the most to the least efficient one
+            enum CopyMethod {
+                COPY_REFLINK = 0,
+                COPY_FILE_RANGE,
+                COPY_SENDFILE,
+                COPY_READ_WRITE,
+            };
+
+            static const char* copyMethodName(CopyMethod method) {
+                switch (method) {
+                    case COPY_REFLINK:
+                        return "reflink";
+                    case COPY_FILE_RANGE:
+                        return "copy_file_range";
+                    case COPY_SENDFILE:
+                        return "sendfile";
+                    default:
+                        return "read/write";
+                }
+            }
+
+            // errors which indicate that a method is not supported for the given files, rather than an I/O error
+            static bool isUnsupportedError(int error) {
+                return error == ENOSYS || error == EXDEV || error == EINVAL || error == EOPNOTSUPP || error == ENOTTY
+                    || error == EBADF || error == ETXTBSY;
+            }
+
+            // copy a range of data from one file to another, at the same offset
+            // falls back to less efficient methods if the current one isn't supported, and updates method accordingly
+            static bool copyRange(int in, int out, off_t offset, off_t length, CopyMethod& method) {
+                while (length > 0) {
+                    ssize_t copied = -1;
+
+                    if (method == COPY_FILE_RANGE) {
+#ifdef __NR_copy_file_range
+                        loff_t inOffset = offset, outOffset = offset;
+                        copied = syscall(__NR_copy_file_range, in, &inOffset, out, &outOffset, static_cast<size_t>(length), 0u);
+#else
+                        errno = ENOSYS;
+#endif
+                    } else if (method == COPY_SENDFILE) {
+                        // sendfile writes at the output file's position
+                        if (lseek(out, offset, SEEK_SET) == offset) {
+                            off_t inOffset = offset;
+                            copied = sendfile(out, in, &inOffset, static_cast<size_t>(length));
+                        }
+                    } else {
+                        static const size_t bufferSize = 1024 * 1024;
+                        std::vector<char> buffer(std::min<size_t>(bufferSize, static_cast<size_t>(length)));
+
+                        copied = pread(in, buffer.data(), buffer.size(), offset);
+
+                        if (copied > 0) {
+                            for (ssize_t written = 0; written < copied; ) {
+                                const auto result = pwrite(out, buffer.data() + written, copied - written, offset + written);
+
+                                if (result < 0) {
+                                    if (errno == EINTR)
+                                        continue;
+                                    return false;
+                                }
+
+                                written += result;
+                            }
+                        }
+                    }
+
+                    if (copied < 0) {
+                        if (errno == EINTR)
+                            continue;
+
+                        if (method != COPY_READ_WRITE && isUnsupportedError(errno)) {
+                            method = static_cast<CopyMethod>(method + 1);
+                            continue;
+                        }
+
+                        return false;
+                    }
+
+                    // the file has been truncated while copying
+                    if (copied == 0) {
+                        errno = EIO;
+                        return false;
+                    }
+
+                    offset += copied;
+                    length -= copied;
+                }
+
+                return true;
+            }
+
+            // copy the data in the given range of a file, holes are skipped
+            static bool copyDataRange(int in, int out, off_t start, off_t end, CopyMethod& method) {
+                off_t offset = start;
+
+                while (offset < end) {
+                    off_t dataStart = lseek(in, offset, SEEK_DATA);
+
+                    if (dataStart < 0) {
+                        // no more data, the rest of the file is a hole
+                        if (errno == ENXIO)
+                            break;
+
+                        // the file system doesn't support searching for holes, therefore the range is copied as a whole
+                        dataStart = offset;
+                    }
+
+                    if (dataStart >= end)
+                        break;
+
+                    off_t dataEnd = lseek(in, dataStart, SEEK_HOLE);
+
+                    if (dataEnd < 0 || dataEnd > end)
+                        dataEnd = end;
+
+                    if (!copyRange(in, out, dataStart, dataEnd - dataStart, method))
+                        return false;
+
+                    offset = dataEnd;
+                }
+
+                return true;
+            }
+
+            // copy the first size bytes of a regular file using the most efficient method available, and apply the
+            // given patches
+            // holes in sparse files are preserved
+            // the patched regions aren't copied, so that every byte of the copy is written only once
+            static bool copyFileContents(int in, int out, off_t size, const std::vector<elf::FilePatch>& patches, CopyMethod& method) {
+                method = COPY_REFLINK;
+
+                // a reflink shares the data blocks on copy-on-write file systems like btrfs or XFS, and is practically free
+                // only the blocks touched by the patches are written then
+                bool copied = ioctl(out, FICLONE, in) == 0;
+
+                // the clone covers the whole file, parts which are cut off (e.g., stripped debug information) are dropped
+                if (copied && ftruncate(out, size) != 0)
+                    return false;
+
+                if (!copied) {
+                    method = COPY_FILE_RANGE;
+
+                    std::vector<std::pair<off_t, off_t>> patchedRanges;
+
+                    for (const auto& patch : patches)
+                        patchedRanges.emplace_back(static_cast<off_t>(patch.offset), static_cast<off_t>(patch.offset + patch.data.size()));
+
+                    std::sort(patchedRanges.begin(), patchedRanges.end());
+
+                    off_t offset = 0;
+
+                    for (const auto& range : patchedRanges) {
+                        if (range.first > offset && !copyDataRange(in, out, offset, std::min(range.first, size), method))
+                            return false;
+
+                        offset = std::max(offset, range.second);
+                    }
+
+                    if (!copyDataRange(in, out, offset, size, method))
+                        return false;
+
+                    // trailing holes don't have any data to copy, therefore the size must be set explicitly
+                    if (ftruncate(out, size) != 0)
+                        return false;
+                }
+
+                // patches past the end extend the file, like when patching the file in place
+                return elf::applyPatches(out, patches);
+            }
+
+            // strip file in place, see elf::ElfFile::planStrip()
+            static bool stripFile(const bf::path& path, const elf::StripPlan& plan) {
+                int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+
+                if (fd < 0)
+                    return false;
+
+                bool success = ftruncate(fd, static_cast<off_t>(plan.length)) == 0 && elf::applyPatches(fd, plan.patches);
+
+                if (close(fd) != 0)
+                    success = false;
+
+                return success;
+            }
+
+            // add the patches which strip a copy of a file to the ones which set its rpath
+            // rpath patches which would be cut off (i.e., data appended to the file) are dropped, the rpath needs to be
+            // set in the stripped copy afterwards then
+            static void mergeStripPlan(const elf::StripPlan& plan, std::vector<elf::FilePatch>& patches, bool& rpathSetWhileCopying) {
+                for (const auto& patch : patches) {
+                    if (patch.offset + patch.data.size() > plan.length) {
+                        patches.clear();
+                        rpathSetWhileCopying = false;
+                        break;
+                    }
+                }
+
+                patches.insert(patches.end(), plan.patches.begin(), plan.patches.end());
+            }
+
+            // types of directory entries, as reported by the directory scanner
+            // symlinks aren't followed, i.e., the type describes the entry itself, not its target
+            enum FileType {
+                FILE_TYPE_REGULAR,
+                FILE_TYPE_DIRECTORY,
+                FILE_TYPE_SYMLINK,
+                FILE_TYPE_OTHER,
+            };
+
+            struct DirectoryEntry {
+                bf::path path;
+                FileType type;
+            };
+
+            // record layout returned by getdents64(), glibc doesn't provide a definition
+            struct LinuxDirent64 {
+                uint64_t d_ino;
+                int64_t d_off;
+                unsigned short d_reclen;
+                unsigned char d_type;
+                char d_name[];
+            };
+
+            static FileType fileTypeFromMode(mode_t mode) {
+                if (S_ISREG(mode))
+                    return FILE_TYPE_REGULAR;
+                if (S_ISDIR(mode))
+                    return FILE_TYPE_DIRECTORY;
+                if (S_ISLNK(mode))
+                    return FILE_TYPE_SYMLINK;
+                return FILE_TYPE_OTHER;
+            }
+
+            // list entries of directory referred to by dirFd, which is closed afterwards
+            // the entries' types are taken from the directory itself, file systems which don't provide them (DT_UNKNOWN)
+            // are the only ones which require a stat() call per entry
+            static bool scanDirectory(int dirFd, const bf::path& path, const bool recursive, std::vector<DirectoryEntry>& entries) {
+                // large buffers reduce the number of round trips on network file systems
+                std::vector<char> buffer(64 * 1024);
+
+                bool success = true;
+
+                while (true) {
+                    const auto bytesRead = syscall(SYS_getdents64, dirFd, buffer.data(), buffer.size());
+
+                    if (bytesRead < 0) {
+                        ldLog() << LD_ERROR << "Failed to read directory" << path << LD_NO_SPACE << ":" << strerror(errno) << std::endl;
+                        success = false;
+                        break;
+                    }
+
+                    if (bytesRead == 0)
+                        break;
+
+                    for (long offset = 0; offset < bytesRead;) {
+                        const auto* ent = reinterpret_cast<const LinuxDirent64*>(buffer.data() + offset);
+                        offset += ent->d_reclen;
+
+                        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+                            continue;
+
+                        FileType type;
+
+                        switch (ent->d_type) {
+                            case DT_REG:
+                                type = FILE_TYPE_REGULAR;
+                                break;
+                            case DT_DIR:
+                                type = FILE_TYPE_DIRECTORY;
+                                break;
+                            case DT_LNK:
+                                type = FILE_TYPE_SYMLINK;
+                                break;
+                            case DT_UNKNOWN: {
+                                struct stat st;
+
+                                if (fstatat(dirFd, ent->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                                    // the entry might have been removed in the meantime
+                                    continue;
+                                }
+
+                                type = fileTypeFromMode(st.st_mode);
+                                break;
+                            }
+                            default:
+                                type = FILE_TYPE_OTHER;
+                                break;
+                        }
+
+                        const auto entryPath = path / ent->d_name;
+                        entries.push_back({entryPath, type});
+
+                        if (recursive && type == FILE_TYPE_DIRECTORY) {
+                            // open subdirectories relative to their parent to save path lookups
+                            const auto subDirFd = openat(dirFd, ent->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+
+                            if (subDirFd < 0) {
+                                ldLog() << LD_ERROR << "Failed to open directory" << entryPath << LD_NO_SPACE << ":" << strerror(errno) << std::endl;
+                                success = false;
+                                continue;
+                            }
+
+                            if (!scanDirectory(subDirFd, entryPath, recursive, entries))
+                                success = false;
+                        }
+                    }
+                }
+
+                close(dirFd);
+                return success;
+            }
+
+            // list entries of directory, optionally including all subdirectories' entries
+            // a missing directory is treated like an empty one
+            static std::vector<DirectoryEntry> scanDirectory(const bf::path& path, const bool recursive = true) {
+                std::vector<DirectoryEntry> entries;
+
+                const auto dirFd = open(path.string().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+                if (dirFd < 0) {
+                    if (errno != ENOENT)
+                        ldLog() << LD_ERROR << "Failed to open directory" << path << LD_NO_SPACE << ":" << strerror(errno) << std::endl;
+
+                    return entries;
+                }
+
+                scanDirectory(dirFd, path, recursive, entries);
+
+                return entries;
+            }
+
+            // list regular files in directory, including symlinks pointing to regular files
+            static std::vector<bf::path> listFilesInDirectory(const bf::path& path, const bool recursive = true) {
+                std::vector<bf::path> foundPaths;
+
+                for (const auto& entry : scanDirectory(path, recursive)) {
+                    if (entry.type == FILE_TYPE_REGULAR) {
+                        foundPaths.push_back(entry.path);
+                    } else if (entry.type == FILE_TYPE_SYMLINK) {
+                        // only symlinks need to be resolved to find out their target's type
+                        struct stat st;
+
+                        if (stat(entry.path.string().c_str(), &st) == 0 && S_ISREG(st.st_mode))
+                            foundPaths.push_back(entry.path);
+                    }
+                }
+
+                return foundPaths;
+            }
+
+            // categories of AppDir contents kept in the content index
+            enum ContentCategory {
+                CONTENT_EXECUTABLE = 0,
+                CONTENT_ICON,
+                CONTENT_DESKTOP_FILE,
+                CONTENT_OTHER,
+            };
+
+            // categorize file by its path relative to the AppDir root
+            static ContentCategory contentCategory(const std::string& relativePath) {
+                static const std::string executablesPrefix = "usr/bin/";
+                static const std::string iconsPrefix = "usr/share/icons/";
+                static const std::string desktopFilesPrefix = "usr/share/applications/";
+
+                auto isDirectChildOf = [&relativePath](const std::string& prefix) {
+                    return relativePath.size() > prefix.size() && relativePath.compare(0, prefix.size(), prefix) == 0
+                        && relativePath.find('/', prefix.size()) == std::string::npos;
+                };
+
+                if (isDirectChildOf(executablesPrefix))
+                    return CONTENT_EXECUTABLE;
+
+                if (relativePath.size() > iconsPrefix.size() && relativePath.compare(0, iconsPrefix.size(), iconsPrefix) == 0)
+                    return CONTENT_ICON;
+
+                if (isDirectChildOf(desktopFilesPrefix) && bf::path(relativePath).extension() == ".desktop")
+                    return CONTENT_DESKTOP_FILE;
+
+                return CONTENT_OTHER;
+            }
+
             class AppDir::PrivateData {
+                public:
+                    // file operation executed by executeDeferredOperations()
+                    struct DeferredOperation {
+                        // empty if the file has been copied by a previous call already
+                        bf::path from;
+                        bf::path to;
+                        std::string rpath;
+
+                        // results
+                        bool upToDate;
+                        bool linked;
+                        bool checkedOut;
+                        CopyMethod copyMethod;
+                        bool copyFailed;
+                        bool rpathSetAlready;
+                        bool rpathSetWhileCopying;
+                        bool setRPathFailed;
+                        bool stripped;
+                        uint64_t bytesStripped;
+                        bf::path debugFile;
+                        bool missingBuildId;
+                        bool splitDebugFailed;
+                        bool stripFailed;
+                        bool archivedOnly;
+                        bool archiveFailed;
+
+                        // describes the deployed file after a successful operation
+                        deploymentmanifest::ManifestEntry manifestEntry;
+                    };
+
                 public:
                     bf::path appDirPath;
                     std::map<bf::path, bf::path> copyOperations;
-                    std::vector<bf::path> setElfRPathOperations;
+                    // ELF files and the rpaths to set in them
+                    std::vector<std::pair<bf::path, std::string>> setElfRPathOperations;
+                    dependencygraph::DependencyGraph dependencyGraph;
+                    excludelist::Excludelist excludelist;
+
+                    // index of all deployed files, used to detect duplicate and conflicting deployments
+                    // sources are keyed by their canonical paths, see canonicalSourcePath()
+                    std::unordered_map<std::string, bf::path> deployedSources;
+                    std::unordered_map<std::string, std::string> claimedDestinations;
+                    std::unordered_map<std::string, bf::path> canonicalDirectories;
+
+                    // number of files copied and patched in parallel
+                    size_t numberOfJobs;
+
+                    DeployMode deployMode;
+
+                    // used in DEPLOY_STORE mode
+                    std::unique_ptr<librarystore::LibraryStore> libraryStore;
+
+                    DebugInfoMode debugInfoMode;
+                    bf::path debugDirectory;
+
+                    // deployed files are streamed into the archive if set, see setArchiveOutput()
+                    std::unique_ptr<archive::ArchiveWriter> archive;
+                    bool writeTree;
+
+                    // record of the files deployed by previous runs, loaded on demand
+                    std::unique_ptr<deploymentmanifest::DeploymentManifest> manifest;
+
+                    // index of the AppDir's executables, icons and desktop files, see indexContent()
+                    struct ContentIndex {
+                        // in the order the files were indexed
+                        std::vector<bf::path> paths;
+                        std::unordered_map<std::string, std::vector<size_t>> pathsByStem;
+                        std::unordered_set<std::string> relativePaths;
+                    };
+
+                    ContentIndex contentIndex[CONTENT_OTHER];
+                    bool contentIndexSeeded;
 
                 public:
                     PrivateData() {
                         this->copyOperations = {};
+                        this->numberOfJobs = threadpool::ThreadPool::defaultNumberOfThreads();
+                        this->deployMode = DEPLOY_COPY;
+                        this->debugInfoMode = DEBUG_INFO_KEEP;
+                        this->writeTree = true;
+                        this->contentIndexSeeded = false;
                     };
 
-                public:
-                    // actually copy file
-                    // mimics cp command behavior
-                    bool copyFile(const bf::path& from, bf::path to) {
-                        ldLog() << "Copying file" << from << "to" << to << std::endl;
+                public:
+                    // create the destination's parent directory, and append the source's filename if the destination is a
+                    // directory, mimicking cp's behavior
+                    bool prepareDestination(const bf::path& from, bf::path& to) {
+                        try {
+                            // another thread might create the directory concurrently, therefore the return value of
+                            // create_directories() can't be relied on
+                            if (!to.parent_path().empty() && !bf::is_directory(to.parent_path())) {
+                                bf::create_directories(to.parent_path());
+
+                                if (!bf::is_directory(to.parent_path())) {
+                                    ldLog() << LD_ERROR << "Failed to create parent directory" << to.parent_path() << "for path" << to << std::endl;
+                                    return false;
+                                }
+                            }
+
+                            if (*(to.string().end() - 1) == '/' || bf::is_directory(to))
+                                to /= from.filename();
+                        } catch (const bf::filesystem_error& e) {
+                            return false;
+                        }
+
+                        return true;
+                    }
+
+                    // create hardlink to file, replacing an existing destination file
+                    // fails if the files are on different file systems, in which case the caller needs to copy the file
+                    bool linkFile(const bf::path& from, bf::path to) {
+                        if (!prepareDestination(from, to))
+                            return false;
+
+                        if (unlink(to.c_str()) != 0 && errno != ENOENT)
+                            return false;
+
+                        // link() doesn't dereference symlinks on Linux, but libraries are usually referenced by symlinks
+                        return linkat(AT_FDCWD, from.c_str(), AT_FDCWD, to.c_str(), AT_SYMLINK_FOLLOW) == 0;
+                    }
+
+                    // replace a file which has multiple hardlinks by a copy, so that it can be modified without
+                    // modifying the other links (e.g., the original file in hardlink deploy mode)
+                    bool unshareFile(const bf::path& path) {
+                        struct stat st;
+
+                        if (stat(path.c_str(), &st) != 0)
+                            return false;
+
+                        if (st.st_nlink <= 1)
+                            return true;
+
+                        const auto tempPath = path.string() + ".linuxdeploy-unshare";
+
+                        CopyMethod method;
+                        if (!copyFile(path, tempPath, method))
+                            return false;
+
+                        if (rename(tempPath.c_str(), path.c_str()) != 0) {
+                            unlink(tempPath.c_str());
+                            return false;
+                        }
+
+                        return true;
+                    }
+
+                    // files are recorded relative to the AppDir, so that the AppDir can be moved
+                    std::string manifestKey(const bf::path& path) {
+                        const auto& prefix = appDirPath.string();
+                        const auto& value = path.string();
+
+                        if (value.size() > prefix.size() && value.compare(0, prefix.size(), prefix) == 0) {
+                            const auto offset = prefix.back() == '/' ? prefix.size() : prefix.size() + 1;
+                            return value.substr(offset);
+                        }
+
+                        return value;
+                    }
+
+                    static int64_t mtimeNanoseconds(const struct stat& st) {
+                        return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+                    }
+
+                    // check whether a file deployed by a previous run is still up to date
+                    // the source is compared by identity and timestamp first, and by content if those changed (e.g., a
+                    // rebuild which produced an identical file)
+                    // the content is only hashed once the identity check fails, the hash is passed on for the new entry
+                    // then, so that later runs can compare by content
+                    bool isUpToDate(DeferredOperation& operation, const struct stat& sourceStat, std::string& sourceHash) {
+                        deploymentmanifest::ManifestEntry previous;
+
+                        if (!manifest->find(manifestKey(operation.to), previous))
+                            return false;
+
+                        if (previous.source != operation.from || previous.rpath != operation.rpath || previous.deployMode != deployMode
+                            || previous.debugInfoMode != debugInfoMode)
+                            return false;
+
+                        // the deployed file might have been modified or removed in the meantime
+                        struct stat destinationStat;
+
+                        if (stat(operation.to.c_str(), &destinationStat) != 0 || static_cast<uint64_t>(destinationStat.st_size) != previous.destinationSize
+                            || mtimeNanoseconds(destinationStat) != previous.destinationMtime)
+                            return false;
+
+                        if (static_cast<uint64_t>(sourceStat.st_size) != previous.size)
+                            return false;
+
+                        if (mtimeNanoseconds(sourceStat) == previous.mtime && static_cast<uint64_t>(sourceStat.st_dev) == previous.device
+                            && static_cast<uint64_t>(sourceStat.st_ino) == previous.inode) {
+                            sourceHash = previous.sha256;
+                            return true;
+                        }
+
+                        return sha256::hashFile(operation.from, sourceHash) && !previous.sha256.empty() && sourceHash == previous.sha256;
+                    }
+
+                    // calculate the patches which set the rpath in a copy of an ELF file
+                    // setAlready is set if the source file has the rpath already, in which case there's nothing to patch
+                    // returns false if the rpath can't be set while copying, and needs to be set in the copy afterwards
+                    static bool planRPathChange(const bf::path& from, const std::string& rpath, std::vector<elf::FilePatch>& patches, bool& setAlready) {
+                        elf::ElfFile elfFile(from);
+
+                        setAlready = elfFile.getRPath() == rpath;
+
+                        return setAlready || elfFile.planRPathChange(rpath, patches);
+                    }
+
+                    // write the debug information of an ELF file to the debug directory, named after the file's build ID
+                    // returns false if the file doesn't have a build ID, or the debug file can't be written
+                    bool splitDebugInfo(elf::ElfFile& elfFile, DeferredOperation& operation) {
+                        const auto buildId = elfFile.getBuildId();
+
+                        if (buildId.size() < 4) {
+                            operation.missingBuildId = true;
+                            return false;
+                        }
+
+                        operation.debugFile = debugDirectory / ".build-id" / buildId.substr(0, 2) / (buildId.substr(2) + ".debug");
+
+                        // files with the same build ID have the same debug information, e.g., if they've been split by a
+                        // previous run
+                        if (bf::exists(operation.debugFile))
+                            return true;
+
+                        boost::system::error_code ec;
+                        bf::create_directories(operation.debugFile.parent_path(), ec);
+
+                        // written under a temporary name and then renamed, so that debuggers never see partial files
+                        static std::atomic<unsigned int> counter(0);
+                        const auto tempPath = operation.debugFile.string() + "." + std::to_string(getpid()) + "-" + std::to_string(counter++) + ".tmp";
+
+                        if (!elfFile.writeDebugFile(tempPath) || rename(tempPath.c_str(), operation.debugFile.c_str()) != 0) {
+                            unlink(tempPath.c_str());
+                            operation.splitDebugFailed = true;
+                            return false;
+                        }
+
+                        return true;
+                    }
+
+                    // calculate how to strip a file according to the debug info mode
+                    // in DEBUG_INFO_SPLIT mode, the debug file is written right away, files whose debug information
+                    // can't be split off keep it
+                    bool planStrip(DeferredOperation& operation, const bf::path& path, elf::StripPlan& plan) {
+                        if (debugInfoMode == DEBUG_INFO_KEEP)
+                            return false;
+
+                        elf::ElfFile elfFile(path);
+
+                        if (!elfFile.planStrip(plan))
+                            return false;
+
+                        if (debugInfoMode == DEBUG_INFO_SPLIT && !splitDebugInfo(elfFile, operation))
+                            return false;
+
+                        operation.stripped = true;
+                        operation.bytesStripped = plan.originalSize - plan.strippedSize;
+
+                        trace::addToCounter(trace::COUNTER_BYTES_STRIPPED, operation.bytesStripped);
+
+                        return true;
+                    }
+
+                    // link file to its object in the library store, adding the object first if necessary
+                    // the objects' rpaths have been set, and their debug information has been removed, when they were
+                    // added
+                    bool checkoutFromStore(DeferredOperation& operation, const struct stat& sourceStat, std::string& sourceHash,
+                                           const elf::StripPlan* stripPlan) {
+                        if (sourceHash.empty() && !sha256::hashFile(operation.from, sourceHash))
+                            return false;
+
+                        auto to = operation.to;
+
+                        if (!prepareDestination(operation.from, to))
+                            return false;
+
+                        const auto key = librarystore::LibraryStore::objectKey(sourceHash, operation.rpath, stripPlan != nullptr);
+
+                        if (libraryStore->checkout(key, to)) {
+                            trace::addToCounter(trace::COUNTER_LIBRARY_STORE_HITS);
+                            return true;
+                        }
+
+                        trace::addToCounter(trace::COUNTER_LIBRARY_STORE_MISSES);
+
+                        bf::path objectPath;
+
+                        if (!libraryStore->createTemporaryFile(objectPath))
+                            return false;
+
+                        std::vector<elf::FilePatch> patches;
+                        bool rpathSetAlready = true;
+                        bool rpathSetWhileCopying = operation.rpath.empty() || planRPathChange(operation.from, operation.rpath, patches, rpathSetAlready);
+
+                        if (stripPlan != nullptr)
+                            mergeStripPlan(*stripPlan, patches, rpathSetWhileCopying);
+
+                        CopyMethod method;
+
+                        if (!copyFile(operation.from, objectPath, method, patches, stripPlan != nullptr ? static_cast<off_t>(stripPlan->length) : -1)) {
+                            unlink(objectPath.c_str());
+                            return false;
+                        }
+
+                        trace::addToCounter(trace::COUNTER_BYTES_COPIED, stripPlan != nullptr ? stripPlan->strippedSize : static_cast<uint64_t>(sourceStat.st_size));
+
+                        if (!rpathSetWhileCopying && !elf::ElfFile(objectPath).setRPath(operation.rpath)) {
+                            unlink(objectPath.c_str());
+                            return false;
+                        }
+
+                        return libraryStore->add(key, objectPath, to);
+                    }
+
+                    // name of file in the AppDir within the archive
+                    std::string archiveName(const bf::path& path) {
+                        return lexicallyNormal(manifestKey(path)).string();
+                    }
+
+                    // name for temporary file used to prepare a file which is added to the archive only
+                    bool createStagingFile(bf::path& path) {
+                        auto stagingPath = (archive->path().parent_path() / ("." + archive->path().filename().string() + ".XXXXXX")).string();
+
+                        const auto fd = mkstemp(&stagingPath[0]);
+
+                        if (fd < 0)
+                            return false;
+
+                        close(fd);
+
+                        path = stagingPath;
+                        return true;
+                    }
+
+                    // add file to the archive without writing it into the AppDir
+                    // the rpath and strip patches are applied while the file is read, files which can't be patched that
+                    // way are prepared in a temporary file
+                    void archiveOperation(DeferredOperation& operation) {
+                        trace::Span span("stream file", operation.to);
+
+                        operation.archivedOnly = true;
+
+                        elf::StripPlan stripPlan;
+                        const bool strip = planStrip(operation, operation.from, stripPlan);
+
+                        std::vector<elf::FilePatch> patches;
+                        bool rpathSetWhileCopying = true;
+
+                        if (!operation.rpath.empty())
+                            rpathSetWhileCopying = planRPathChange(operation.from, operation.rpath, patches, operation.rpathSetAlready);
+
+                        if (strip)
+                            mergeStripPlan(stripPlan, patches, rpathSetWhileCopying);
+
+                        const auto name = archiveName(operation.to);
+
+                        if (rpathSetWhileCopying) {
+                            struct stat st;
+
+                            if (stat(operation.from.c_str(), &st) != 0) {
+                                operation.copyFailed = true;
+                                return;
+                            }
+
+                            operation.rpathSetWhileCopying = !operation.rpath.empty() && !operation.rpathSetAlready;
+                            operation.archiveFailed = !archive->addFile(name, operation.from, strip ? stripPlan.length : static_cast<uint64_t>(st.st_size), patches);
+                            return;
+                        }
+
+                        bf::path stagingPath;
+
+                        if (!createStagingFile(stagingPath) || !copyFile(operation.from, stagingPath, operation.copyMethod, patches, strip ? static_cast<off_t>(stripPlan.length) : -1)) {
+                            operation.copyFailed = true;
+                            return;
+                        }
+
+                        if (!elf::ElfFile(stagingPath).setRPath(operation.rpath)) {
+                            operation.setRPathFailed = true;
+                        } else {
+                            operation.archiveFailed = !archive->addFile(name, stagingPath);
+                        }
+
+                        unlink(stagingPath.c_str());
+                    }
+
+                    // deploy file, and add it to the archive if requested
+                    // safe to call from multiple threads at once
+                    void executeOperation(DeferredOperation& operation) {
+                        if (archive == nullptr) {
+                            deployOperation(operation);
+                            return;
+                        }
+
+                        // files in the AppDir which are only patched need to be patched in place, and desktop files are
+                        // read again by later steps
+                        if (!writeTree && !operation.from.empty() && contentCategory(archiveName(operation.to)) != CONTENT_DESKTOP_FILE) {
+                            archiveOperation(operation);
+                            return;
+                        }
+
+                        deployOperation(operation);
+
+                        if (!operation.copyFailed && !operation.setRPathFailed && !operation.stripFailed)
+                            operation.archiveFailed = !archive->addFile(archiveName(operation.to), operation.to);
+                    }
+
+                    // copy or link file and set its rpath, according to the deploy mode
+                    // files which are up to date according to the manifest are skipped
+                    // safe to call from multiple threads at once
+                    void deployOperation(DeferredOperation& operation) {
+                        trace::Span span("deploy file", operation.to);
+
+                        const bool setRPath = !operation.rpath.empty();
+
+                        struct stat sourceStat;
+                        std::string sourceHash;
+
+                        if (!operation.from.empty()) {
+                            if (stat(operation.from.c_str(), &sourceStat) != 0) {
+                                operation.copyFailed = true;
+                                return;
+                            }
+
+                            if (isUpToDate(operation, sourceStat, sourceHash)) {
+                                operation.upToDate = true;
+                                trace::addToCounter(trace::COUNTER_FILES_UNCHANGED);
+                            } else {
+                                // debug information is removed while copying the file
+                                elf::StripPlan stripPlan;
+                                const bool strip = planStrip(operation, operation.from, stripPlan);
+
+                                if (deployMode == DEPLOY_STORE && libraryStore != nullptr) {
+                                    // falls back to copying the file if the store can't be used
+                                    operation.checkedOut = checkoutFromStore(operation, sourceStat, sourceHash, strip ? &stripPlan : nullptr);
+                                    operation.linked = operation.checkedOut;
+                                    operation.rpathSetAlready = operation.checkedOut && setRPath;
+                                } else if (deployMode == DEPLOY_HARDLINK) {
+                                    // files which need to be patched or stripped are copied (copy-on-patch), as modifying a
+                                    // link would modify the original file
+                                    operation.rpathSetAlready = setRPath && elf::ElfFile(operation.from).getRPath() == operation.rpath;
+
+                                    if ((!setRPath || operation.rpathSetAlready) && !strip)
+                                        operation.linked = linkFile(operation.from, operation.to);
+                                }
+
+                                if (operation.linked) {
+                                    trace::addToCounter(trace::COUNTER_FILES_LINKED);
+                                } else {
+                                    // ELF files are patched while they're copied, so that they're written only once
+                                    std::vector<elf::FilePatch> patches;
+
+                                    if (setRPath && !operation.rpathSetAlready)
+                                        operation.rpathSetWhileCopying = planRPathChange(operation.from, operation.rpath, patches, operation.rpathSetAlready);
+
+                                    if (strip)
+                                        mergeStripPlan(stripPlan, patches, operation.rpathSetWhileCopying);
+
+                                    if (!copyFile(operation.from, operation.to, operation.copyMethod, patches, strip ? static_cast<off_t>(stripPlan.length) : -1)) {
+                                        operation.copyFailed = true;
+                                        return;
+                                    }
+
+                                    trace::addToCounter(trace::COUNTER_FILES_COPIED);
+                                    trace::addToCounter(trace::COUNTER_BYTES_COPIED, strip ? stripPlan.strippedSize : static_cast<uint64_t>(sourceStat.st_size));
+                                }
+                            }
+                        } else {
+                            // files which are only patched are stripped in place, before setting the rpath possibly appends
+                            // data to them
+                            elf::StripPlan stripPlan;
+
+                            if (planStrip(operation, operation.to, stripPlan) && (!unshareFile(operation.to) || !stripFile(operation.to, stripPlan))) {
+                                operation.stripFailed = true;
+                                return;
+                            }
+                        }
+
+                        if (setRPath && !operation.upToDate && !operation.rpathSetAlready && !operation.rpathSetWhileCopying) {
+                            // the file might be a link created by a previous run in hardlink mode
+                            if (!unshareFile(operation.to) || !elf::ElfFile(operation.to).setRPath(operation.rpath)) {
+                                operation.setRPathFailed = true;
+                                return;
+                            }
+                        }
+
+                        // files which have been patched only can't be recorded, as their source is unknown
+                        if (operation.from.empty())
+                            return;
+
+                        struct stat destinationStat;
+                        if (stat(operation.to.c_str(), &destinationStat) != 0)
+                            return;
+
+                        auto& entry = operation.manifestEntry;
+                        entry.destination = manifestKey(operation.to);
+                        entry.source = operation.from;
+                        entry.size = static_cast<uint64_t>(sourceStat.st_size);
+                        entry.mtime = mtimeNanoseconds(sourceStat);
+                        entry.device = static_cast<uint64_t>(sourceStat.st_dev);
+                        entry.inode = static_cast<uint64_t>(sourceStat.st_ino);
+                        entry.sha256 = sourceHash;
+                        entry.rpath = operation.rpath;
+                        entry.deployMode = deployMode;
+                        entry.debugInfoMode = debugInfoMode;
+                        entry.destinationSize = static_cast<uint64_t>(destinationStat.st_size);
+                        entry.destinationMtime = mtimeNanoseconds(destinationStat);
+                    }
+
+                    // actually copy file
+                    // mimics cp command behavior
+                    // safe to call from multiple threads at once
+                    // the destination file is replaced rather than overwritten, so that other links to it (e.g., hardlinks)
+                    // aren't modified
+                    // the patches are applied to the copy, see elf::ElfFile::planRPathChange()
+                    // if length is given, only the first length bytes are copied, see elf::ElfFile::planStrip()
+                    bool copyFile(const bf::path& from, bf::path to, CopyMethod& method, const std::vector<elf::FilePatch>& patches = {},
+                                  off_t length = -1) {
+                        trace::Span span("copy", from);
+
+                        if (!prepareDestination(from, to))
+                            return false;
+
+                        int in = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+
+                        if (in < 0) {
+                            ldLog() << LD_ERROR << "Failed to open file" << from << LD_NO_SPACE << ":" << strerror(errno) << std::endl;
+                            return false;
+                        }
+
+                        struct stat st;
+
+                        if (fstat(in, &st) != 0 || !S_ISREG(st.st_mode)) {
+                            ldLog() << LD_ERROR << "Not a regular file:" << from << std::endl;
+                            close(in);
+                            return false;
+                        }
+
+                        if (unlink(to.c_str()) != 0 && errno != ENOENT) {
+                            ldLog() << LD_ERROR << "Failed to remove existing file" << to << LD_NO_SPACE << ":" << strerror(errno) << std::endl;
+                            close(in);
+                            return false;
+                        }
+
+                        int out = open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR);
+
+                        if (out < 0) {
+                            ldLog() << LD_ERROR << "Failed to create file" << to << LD_NO_SPACE << ":" << strerror(errno) << std::endl;
+                            close(in);
+                            return false;
+                        }
+
+                        bool success = copyFileContents(in, out, length >= 0 ? std::min(length, st.st_size) : st.st_size, patches, method);
+
+                        if (!success)
+                            ldLog() << LD_ERROR << "Failed to copy contents of file" << from << LD_NO_SPACE << ":" << strerror(errno) << std::endl;
+
+                        // the permissions are set explicitly, as the umask applies to the mode passed to open()
+                        if (success && fchmod(out, st.st_mode & 07777) != 0) {
+                            ldLog() << LD_ERROR << "Failed to set permissions of file" << to << LD_NO_SPACE << ":" << strerror(errno) << std::endl;
+                            success = false;
+                        }
+
+                        if (close(out) != 0)
+                            success = false;
+
+                        close(in);
+
+                        // don't leave incomplete files behind
+                        if (!success)
+                            unlink(to.c_str());
+
+                        return success;
+                    }
+
+                    // create symlink, replacing existing files atomically
+                    // mimics the behavior of ln -f -s [--relative]
+                    bool symlinkFile(const bf::path& target, bf::path symlink, const bool useRelativePath = true) {
+                        trace::Span span("symlink", target);
+
+                        ldLog() << "Creating symlink for file" << target << "in/as" << symlink << std::endl;
+
+                        if (*(symlink.string().end() - 1) == '/' || bf::is_directory(symlink))
+                            symlink /= target.filename();
+
+                        const auto absoluteSymlink = lexicallyNormal(bf::absolute(symlink));
+                        const auto absoluteTarget = lexicallyNormal(bf::absolute(target));
+
+                        const auto linkTarget = useRelativePath
+                            ? lexicallyRelative(absoluteTarget, absoluteSymlink.parent_path())
+                            : absoluteTarget;
+
+                        int dirFd = open(absoluteSymlink.parent_path().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+                        if (dirFd < 0) {
+                            ldLog() << LD_ERROR << "Failed to open directory" << absoluteSymlink.parent_path()
+                                    << LD_NO_SPACE << ":" << strerror(errno) << std::endl;
+                            return false;
+                        }
+
+                        // the link is created under a temporary name and then renamed, which replaces an existing file
+                        // atomically
+                        static std::atomic<unsigned int> counter(0);
+
+                        const auto name = absoluteSymlink.filename().string();
+                        const auto tempName = "." + name + ".linuxdeploy-" + std::to_string(getpid()) + "-" + std::to_string(counter++);
+
+                        bool success = symlinkat(linkTarget.c_str(), dirFd, tempName.c_str()) == 0;
+
+                        if (!success) {
+                            ldLog() << LD_ERROR << "Failed to create symlink" << symlink << LD_NO_SPACE << ":" << strerror(errno) << std::endl;
+                        } else if (renameat(dirFd, tempName.c_str(), dirFd, name.c_str()) != 0) {
+                            ldLog() << LD_ERROR << "Failed to replace" << symlink << "with symlink:" << strerror(errno) << std::endl;
+                            unlinkat(dirFd, tempName.c_str(), 0);
+                            success = false;
+                        }
+
+                        close(dirFd);
+                        return success;
+                    }
+
+                    // only the directory part is canonicalized, as symlinks to libraries are deployed under their own names
+                    // the results are memoized, as most files are deployed from a handful of directories
+                    bf::path canonicalSourcePath(const bf::path& path) {
+                        const auto directory = path.parent_path().empty() ? bf::path(".") : path.parent_path();
 
-                        try {
-                            if (!to.parent_path().empty() && !bf::is_directory(to.parent_path()) && !bf::create_directories(to.parent_path())) {
-                                ldLog() << LD_ERROR << "Failed to create parent directory" << to.parent_path() << "for path" << to << std::endl;
-                                return false;
+                        auto it = canonicalDirectories.find(directory.string());
+
+                        if (it == canonicalDirectories.end()) {
+                            bf::path canonicalDirectory;
+
+                            try {
+                                canonicalDirectory = bf::canonical(directory);
+                            } catch (const bf::filesystem_error&) {
+                                canonicalDirectory = bf::absolute(directory);
                             }
 
-                            if (*(to.string().end() - 1) == '/' || bf::is_directory(to))
-                                to /= from.filename();
+                            it = canonicalDirectories.emplace(directory.string(), canonicalDirectory).first;
+                        }
 
-                            bf::copy_file(from, to, bf::copy_option::overwrite_if_exists);
-                        } catch (const bf::filesystem_error& e) {
+                        return it->second / path.filename();
+                    }
+
+                    bool checkDuplicate(const bf::path& path) {
+                        const auto canonicalPath = canonicalSourcePath(path);
+
+                        auto it = deployedSources.find(canonicalPath.string());
+                        if (it == deployedSources.end())
                             return false;
-                        }
 
+                        ldLog() << LD_DEBUG << "Duplicate:" << canonicalPath << "already deployed to" << it->second << std::endl;
                         return true;
                     }
 
-                    // create symlink
-                    bool symlinkFile(bf::path target, bf::path symlink, const bool useRelativePath = true) {
-                        ldLog() << "Creating symlink for file" << target << "in/as" << symlink << std::endl;
+                    // execute deferred copy operations registered with the deploy* functions
+                    // the files are copied in parallel, and every ELF file's rpath is set right after the file has been
+                    // copied successfully
+                    bool executeDeferredOperations() {
+                        std::unordered_map<std::string, std::string> pendingRPathOperations;
+                        for (const auto& pair : setElfRPathOperations)
+                            pendingRPathOperations[pair.first.string()] = pair.second;
 
-                        /*try {
-                            if (!symlink.parent_path().empty() && !bf::is_directory(symlink.parent_path()) && !bf::create_directories(symlink.parent_path())) {
-                                ldLog() << LD_ERROR << "Failed to create parent directory" << symlink.parent_path() << "for path" << symlink << std::endl;
-                                return false;
+                        std::vector<DeferredOperation> operations;
+
+                        for (const auto& pair : copyOperations) {
+                            DeferredOperation operation = {};
+                            operation.from = pair.first;
+                            operation.to = pair.second;
+
+                            auto rpathOperation = pendingRPathOperations.find(pair.second.string());
+
+                            if (rpathOperation != pendingRPathOperations.end()) {
+                                operation.rpath = rpathOperation->second;
+                                pendingRPathOperations.erase(rpathOperation);
                             }
 
-                            if (*(symlink.string().end() - 1) == '/' || bf::is_directory(symlink))
-                                symlink /= target.filename();
+                            operations.push_back(operation);
+                        }
 
-                            if (bf::exists(symlink) || bf::symbolic_link_exists(symlink))
-                                bf::remove(symlink);
+                        for (const auto& pair : setElfRPathOperations) {
+                            if (pendingRPathOperations.erase(pair.first.string()) > 0) {
+                                DeferredOperation operation = {};
+                                operation.to = pair.first;
+                                operation.rpath = pair.second;
 
-                            if (relativeDirectory != "") {
-                                // TODO
+                                operations.push_back(operation);
                             }
+                        }
 
-                            bf::create_symlink(target, symlink);
-                        } catch (const bf::filesystem_error& e) {
-                            return false;
-                        }*/
+                        copyOperations.clear();
+                        setElfRPathOperations.clear();
 
-                        if (!useRelativePath) {
-                            ldLog() << LD_ERROR << "Not implemented" << std::endl;
-                            return false;
+                        if (manifest == nullptr) {
+                            manifest.reset(new deploymentmanifest::DeploymentManifest(appDirPath / ".linuxdeploy-manifest"));
+                            manifest->read();
                         }
 
-                        subprocess::Popen proc({"ln", "-f", "-s", "--relative", target.c_str(), symlink.c_str()},
-                            subprocess::output(subprocess::PIPE),
-                            subprocess::error(subprocess::PIPE)
-                        );
+                        {
+                            threadpool::ThreadPool pool(numberOfJobs);
 
-                        auto outputs = proc.communicate();
+                            for (auto& operation : operations) {
+                                auto* currentOperation = &operation;
+                                pool.submit([this, currentOperation]() { executeOperation(*currentOperation); });
+                            }
 
-                        if (proc.retcode() != 0) {
-                            ldLog() << LD_ERROR << "ln subprocess failed:" << std::endl
-                                    << outputs.first.buf << std::endl << outputs.second.buf << std::endl;
-                            return false;
+                            pool.wait();
                         }
 
-                        return true;
-                    }
+                        // log from the main thread to keep the output readable
+                        for (const auto& operation : operations) {
+                            if (operation.from.empty())
+                                continue;
 
-                    bool checkDuplicate(const bf::path& path) {
-                        // FIXME: use more efficient search (e.g., binary search)
-                        // a linear search is not _really_ efficient
-                        //return std::binary_search(copyOperations.begin(), copyOperations.end(), path);
-                        for (const auto& pair : copyOperations) {
-                            if (pair.first == path) {
-                                ldLog() << LD_DEBUG << "Duplicate:" << pair.first << std::endl;
-                                return true;
+                            if (operation.upToDate) {
+                                ldLog() << "Skipping unchanged file" << operation.from << std::endl;
+                                continue;
+                            }
+
+                            if (operation.archivedOnly) {
+                                ldLog() << "Adding file" << operation.from << "to archive as" << archiveName(operation.to) << std::endl;
+                                continue;
+                            }
+
+                            ldLog() << "Copying file" << operation.from << "to" << operation.to << std::endl;
+
+                            if (operation.checkedOut) {
+                                ldLog() << LD_DEBUG << "Checked out file" << operation.from << "from library store" << libraryStore->path() << std::endl;
+                            } else if (operation.linked) {
+                                ldLog() << LD_DEBUG << "Linked file" << operation.from << "to" << operation.to << std::endl;
+                            } else if (!operation.copyFailed) {
+                                ldLog() << LD_DEBUG << "Copied file" << operation.from << "using"
+                                        << copyMethodName(operation.copyMethod) << std::endl;
                             }
                         }
 
-                        return false;
-                    }
+                        size_t filesStripped = 0;
+                        uint64_t totalBytesStripped = 0;
 
-                    // execute deferred copy operations registered with the deploy* functions
-                    bool executeDeferredOperations() {
-                        bool success = true;
+                        for (const auto& operation : operations) {
+                            if (operation.missingBuildId) {
+                                ldLog() << LD_WARNING << "ELF file" << operation.to << "doesn't have a build ID, keeping its debug information" << std::endl;
+                            } else if (operation.splitDebugFailed) {
+                                ldLog() << LD_WARNING << "Failed to write debug file" << operation.debugFile << LD_NO_SPACE
+                                        << ", keeping debug information in ELF file" << operation.to << std::endl;
+                            }
 
-                        while (!copyOperations.empty()) {
-                            const auto& pair = *(copyOperations.begin());
-                            const auto& from = pair.first;
-                            const auto& to = pair.second;
+                            if (!operation.stripped || operation.copyFailed || operation.stripFailed)
+                                continue;
 
-                            if (!copyFile(from, to)) {
-                                ldLog() << LD_ERROR << "Failed to copy file" << from << "to" << to << std::endl;
-                                success = false;
+                            if (operation.debugFile.empty()) {
+                                ldLog() << "Stripped debug information from ELF file" << operation.to << LD_NO_SPACE
+                                        << ", saved" << operation.bytesStripped << "bytes" << std::endl;
+                            } else {
+                                ldLog() << "Moved debug information from ELF file" << operation.to << "to" << operation.debugFile
+                                        << LD_NO_SPACE << ", saved" << operation.bytesStripped << "bytes" << std::endl;
                             }
 
-                            copyOperations.erase(copyOperations.begin());
+                            filesStripped++;
+                            totalBytesStripped += operation.bytesStripped;
                         }
 
-                        if (success) {
-                            while (!setElfRPathOperations.empty()) {
-                                static const auto rpath = "$ORIGIN/../lib";
-                                const auto& elfFilePath = *(setElfRPathOperations.begin());
+                        if (filesStripped > 0) {
+                            ldLog() << "Removed debug information from" << filesStripped << "ELF files, saved" << totalBytesStripped
+                                    << "bytes in total" << std::endl;
+                        }
 
-                                ldLog() << "Setting rpath in ELF file" << elfFilePath << "to" << rpath << std::endl;
-                                if (!elf::ElfFile(elfFilePath).setRPath(rpath)) {
-                                    ldLog() << LD_ERROR << "Failed to set rpath in ELF file:" << elfFilePath << std::endl;
-                                    success = false;
-                                }
+                        for (const auto& operation : operations) {
+                            if (operation.rpath.empty() || operation.upToDate || operation.copyFailed)
+                                continue;
+
+                            if (operation.checkedOut)
+                                continue;
+
+                            if (operation.rpathSetAlready) {
+                                ldLog() << LD_DEBUG << "Rpath is set already in ELF file" << operation.to << std::endl;
+                                continue;
+                            }
+
+                            ldLog() << "Setting rpath in ELF file" << operation.to << "to" << operation.rpath << std::endl;
+                        }
+
+                        for (const auto& operation : operations) {
+                            if (!operation.manifestEntry.destination.empty())
+                                manifest->update(operation.manifestEntry);
+                            else
+                                manifest->remove(manifestKey(operation.to));
+                        }
+
+                        manifest->write();
+
+                        bool success = true;
+
+                        for (const auto& operation : operations) {
+                            if (operation.copyFailed) {
+                                ldLog() << LD_ERROR << "Failed to copy file" << operation.from << "to" << operation.to << std::endl;
+                                success = false;
+                            }
+                        }
 
-                                setElfRPathOperations.erase(setElfRPathOperations.begin());
+                        for (const auto& operation : operations) {
+                            if (operation.archiveFailed) {
+                                ldLog() << LD_ERROR << "Failed to add file to archive:" << operation.to << std::endl;
+                                success = false;
+                            }
+                        }
+
+                        for (const auto& operation : operations) {
+                            if (operation.stripFailed) {
+                                ldLog() << LD_ERROR << "Failed to strip ELF file:" << operation.to << std::endl;
+                                success = false;
+                            }
+                        }
+
+                        for (const auto& operation : operations) {
+                            if (operation.setRPathFailed) {
+                                ldLog() << LD_ERROR << "Failed to set rpath in ELF file:" << operation.to << std::endl;
+                                success = false;
                             }
                         }
 
                         return success;
                     }
 
+                    // add file in the AppDir to the content index, files of other categories are ignored
+                    void indexContent(const bf::path& path) {
+                        const auto relativePath = lexicallyNormal(manifestKey(path)).string();
+                        const auto category = contentCategory(relativePath);
+
+                        if (category == CONTENT_OTHER)
+                            return;
+
+                        auto& index = contentIndex[category];
+
+                        if (!index.relativePaths.insert(relativePath).second)
+                            return;
+
+                        index.pathsByStem[path.stem().string()].push_back(index.paths.size());
+                        index.paths.push_back(path);
+                    }
+
+                    // files which have been put into the AppDir by other tools, e.g., a build system, or by previous runs
+                    // are only known from the file system, therefore the index is seeded by scanning the AppDir once
+                    void seedContentIndex() {
+                        if (contentIndexSeeded)
+                            return;
+
+                        contentIndexSeeded = true;
+
+                        for (const auto& path : listFilesInDirectory(appDirPath / "usr/bin", false))
+                            indexContent(path);
+
+                        for (const auto& path : listFilesInDirectory(appDirPath / "usr/share/icons"))
+                            indexContent(path);
+
+                        for (const auto& path : listFilesInDirectory(appDirPath / "usr/share/applications", false))
+                            indexContent(path);
+                    }
+
+                    const std::vector<bf::path>& indexedContent(ContentCategory category) {
+                        seedContentIndex();
+                        return contentIndex[category].paths;
+                    }
+
+                    std::vector<bf::path> findIndexedContent(ContentCategory category, const std::string& stem) {
+                        seedContentIndex();
+
+                        const auto& index = contentIndex[category];
+
+                        std::vector<bf::path> paths;
+
+                        auto it = index.pathsByStem.find(stem);
+
+                        if (it != index.pathsByStem.end()) {
+                            for (const auto i : it->second)
+                                paths.push_back(index.paths[i]);
+                        }
+
+                        return paths;
+                    }
+
                     // register copy operation that will be executed later
                     // by compiling a list of files to copy instead of just copying everything, one can ensure that
                     // the files are touched once only
-                    void deployFile(const bf::path& from, bf::path to) {
+                    // returns false if the destination has been claimed by another file already, in which case the first
+                    // deployment wins
+                    bool deployFile(const bf::path& from, bf::path to) {
                         ldLog() << LD_DEBUG << "Deploying file" << from << "to" << to << std::endl;
 
                         // not sure whether this is 100% bullet proof, but it simulates the cp command behavior
@@ -161,65 +1443,83 @@ namespace linuxdeploy {
                             to /= from.filename();
                         }
 
+                        const auto canonicalFrom = canonicalSourcePath(from).string();
+
+                        auto claim = claimedDestinations.find(to.string());
+
+                        if (claim != claimedDestinations.end() && claim->second != canonicalFrom) {
+                            ldLog() << LD_WARNING << "Conflicting deployment of" << from << "to" << to
+                                    << "which has been deployed from" << claim->second << "already, skipping" << std::endl;
+                            return false;
+                        }
+
+                        claimedDestinations[to.string()] = canonicalFrom;
+                        deployedSources[canonicalFrom] = to;
+
                         copyOperations[from] = to;
+
+                        indexContent(to);
+
+                        return true;
                     }
 
                     bool deployElfDependencies(const bf::path& path) {
                         ldLog() << "Deploying dependencies for ELF file" << path << std::endl;
-                        
-                        for (const auto& dependencyPath : elf::ElfFile(path).traceDynamicDependencies()) {
-                            if (!deployLibrary(dependencyPath))
+
+                        // files shared by several ELF files are traced only once, adding them again is cheap
+                        if (!dependencyGraph.addFile(path))
+                            return false;
+
+                        // the closure contains all transitive dependencies, so there's no need to recurse
+                        for (const auto& dependencyPath : dependencyGraph.closure(path)) {
+                            if (!deployLibrary(dependencyPath, false))
                                 return false;
                         }
-                        
+
                         return true;
                     }
 
-                    bool deployLibrary(const bf::path& path) {
+                    // deploy library into destination directory, relative to the AppDir root
+                    // an empty rpath means the default rpath for the destination, see defaultRPath()
+                    bool deployLibrary(const bf::path& path, bool deployDependencies = true,
+                                       const bf::path& destination = "usr/lib", const std::string& rpath = "") {
+                        if (!isValidDestination(destination)) {
+                            ldLog() << LD_ERROR << "Invalid destination directory for" << path << LD_NO_SPACE << ":" << destination << std::endl;
+                            return false;
+                        }
+
                         if (checkDuplicate(path)) {
                             ldLog() << LD_DEBUG << "Skipping duplicate deployment of shared library" << path << std::endl;
                             return true;
                         }
 
-                        static auto isInExcludelist = [](const bf::path& fileName) {
-                            for (const auto& excludePattern : generatedExcludelist) {
-                                // simple string match is faster than using fnmatch
-                                if (excludePattern == fileName)
-                                    return true;
-
-                                auto fnmatchResult = fnmatch(excludePattern.c_str(), fileName.string().c_str(), FNM_PATHNAME);
-                                switch (fnmatchResult) {
-                                    case 0:
-                                        return true;
-                                    case FNM_NOMATCH:
-                                        break;
-                                    default:
-                                        ldLog() << LD_ERROR << "fnmatch() reported error:" << fnmatchResult << std::endl;
-                                        return false;
-                                }
-                            }
-
-                            return false;
-                        };
-
-                        if (isInExcludelist(path.filename())) {
+                        if (excludelist.isExcluded(path.filename().string())) {
                             ldLog() << "Skipping deployment of blacklisted library" << path << std::endl;
                             return true;
                         } else {
                             ldLog() << "Deploying shared library" << path << std::endl;
                         }
 
-                        deployFile(path, appDirPath / "usr/lib/");
+                        // conflicts have been reported already
+                        if (!deployFile(path, appDirPath / destination / path.filename()))
+                            return true;
 
-                        setElfRPathOperations.push_back(appDirPath / "usr/lib" / path.filename());
+                        setElfRPathOperations.push_back({appDirPath / destination / path.filename(), rpath.empty() ? defaultRPath(destination) : rpath});
 
-                        if (!deployElfDependencies(path))
+                        if (deployDependencies && !deployElfDependencies(path))
                             return false;
 
                         return true;
                     }
 
-                    bool deployExecutable(const bf::path& path) {
+                    // deploy executable into destination directory, relative to the AppDir root
+                    // an empty rpath means the default rpath for the destination, see defaultRPath()
+                    bool deployExecutable(const bf::path& path, const bf::path& destination = "usr/bin", const std::string& rpath = "") {
+                        if (!isValidDestination(destination)) {
+                            ldLog() << LD_ERROR << "Invalid destination directory for" << path << LD_NO_SPACE << ":" << destination << std::endl;
+                            return false;
+                        }
+
                         if (checkDuplicate(path)) {
                             ldLog() << LD_DEBUG << "Skipping duplicate deployment of executable" << path << std::endl;
                             return true;
@@ -229,9 +1529,10 @@ namespace linuxdeploy {
 
                         // FIXME: make executables executable
 
-                        deployFile(path, appDirPath / "usr/bin/");
+                        if (!deployFile(path, appDirPath / destination / path.filename()))
+                            return true;
 
-                        setElfRPathOperations.push_back(appDirPath / "usr/bin" / path.filename());
+                        setElfRPathOperations.push_back({appDirPath / destination / path.filename(), rpath.empty() ? defaultRPath(destination) : rpath});
 
                         if (!deployElfDependencies(path))
                             return false;
@@ -264,31 +1565,55 @@ namespace linuxdeploy {
 
                         ldLog() << "Deploying icon" << path << std::endl;
 
-                        Magick::Image image;
+                        trace::Span span("probe icon", path);
 
-                        try {
-                            image.read(path.string());
-                        } catch (const Magick::Exception& error) {
-                            return false;
-                        }
+                        const auto extension = util::strLower(bf::extension(path));
+
+                        imageprobe::ImageInfo info;
+
+                        // decoding the entire image just to get its size is slow, therefore only the header is read
+                        if (!imageprobe::probeImage(path, info)) {
+                            // compressed SVG files can't be probed, but don't need to be rasterized either
+                            if (extension == ".svgz") {
+                                info.format = imageprobe::FORMAT_SVG;
+                            } else {
+                                // let ImageMagick handle other formats, ping() doesn't decode the pixel data either
+                                Magick::Image image;
 
-                        auto xRes = image.columns();
-                        auto yRes = image.rows();
+                                try {
+                                    image.ping(path.string());
+                                } catch (const Magick::Exception& error) {
+                                    ldLog() << LD_ERROR << "Failed to read icon" << path << LD_NO_SPACE << ":" << error.what() << std::endl;
+                                    return false;
+                                }
+
+                                info.width = static_cast<unsigned int>(image.columns());
+                                info.height = static_cast<unsigned int>(image.rows());
+                            }
+                        }
 
-                        if (xRes != yRes) {
-                            ldLog() << LD_WARNING << "x and y resolution of icon are not equal:" << path;
+                        if (ldLog::isEnabled(LD_DEBUG)) {
+                            ldLog() << LD_DEBUG << "Icon format:" << imageprobe::formatName(info.format) << LD_NO_SPACE
+                                    << ", size:" << info.width << LD_NO_SPACE << "x" << LD_NO_SPACE << info.height << std::endl;
                         }
 
-                        auto resolution = std::to_string(xRes) + "x" + std::to_string(yRes);
+                        const auto xRes = info.width;
+                        const auto yRes = info.height;
 
-                        auto format = image.format();
+                        std::string resolution;
 
                         // if file is a vector image, use "scalable" directory
-                        if (util::strLower(bf::extension(path)) == "svg") {
+                        if (info.format == imageprobe::FORMAT_SVG || extension == ".svg") {
                             resolution = "scalable";
                         } else {
+                            if (xRes != yRes) {
+                                ldLog() << LD_WARNING << "x and y resolution of icon are not equal:" << path << std::endl;
+                            }
+
+                            resolution = std::to_string(xRes) + "x" + std::to_string(yRes);
+
                             // otherwise, test resolution against "known good" values, and reject invalid ones
-                            const auto knownResolutions = {8, 16, 20, 22, 24, 32, 48, 64, 72, 96, 128, 192, 256, 512};
+                            const auto knownResolutions = {8u, 16u, 20u, 22u, 24u, 32u, 48u, 64u, 72u, 96u, 128u, 192u, 256u, 512u};
 
                             // assume invalid
                             bool invalidXRes = true, invalidYRes = true;
@@ -301,12 +1626,12 @@ namespace linuxdeploy {
                             }
 
                             if (invalidXRes) {
-                                ldLog() << LD_ERROR << "Icon" << path << "has invalid x resolution:" << xRes;
+                                ldLog() << LD_ERROR << "Icon" << path << "has invalid x resolution:" << xRes << std::endl;
                                 return false;
                             }
 
                             if (invalidYRes) {
-                                ldLog() << LD_ERROR << "Icon" << path << "has invalid x resolution:" << xRes;
+                                ldLog() << LD_ERROR << "Icon" << path << "has invalid y resolution:" << yRes << std::endl;
                                 return false;
                             }
                         }
@@ -315,6 +1640,104 @@ namespace linuxdeploy {
 
                         return true;
                     }
+
+                    bool deployIconFromSource(const bf::path& path) {
+                        ldLog() << "Generating icons from" << path << std::endl;
+
+                        imageprobe::ImageInfo info;
+
+                        if (!imageprobe::probeImage(path, info) || (info.format != imageprobe::FORMAT_PNG && info.format != imageprobe::FORMAT_SVG)) {
+                            ldLog() << LD_ERROR << "Icon source must be a PNG or SVG image:" << path << std::endl;
+                            return false;
+                        }
+
+                        // rendered icons are cached by source content and size, as rendering is expensive
+                        std::string sourceHash;
+
+                        if (!sha256::hashFile(path, sourceHash)) {
+                            ldLog() << LD_ERROR << "Failed to read icon source:" << path << std::endl;
+                            return false;
+                        }
+
+                        const auto cacheDirectory = util::getCacheDirectory();
+
+                        // without a cache directory, the icons are rendered into a temporary directory on every run
+                        const auto iconCacheDirectory = cacheDirectory.empty()
+                            ? bf::temp_directory_path() / ("linuxdeploy-icons-" + std::to_string(getuid()))
+                            : bf::path(cacheDirectory) / "icons";
+
+                        try {
+                            bf::create_directories(iconCacheDirectory);
+                        } catch (const bf::filesystem_error& e) {
+                            ldLog() << LD_ERROR << "Failed to create icon cache directory" << iconCacheDirectory << LD_NO_SPACE << ":" << e.what() << std::endl;
+                            return false;
+                        }
+
+                        struct RenderOperation {
+                            unsigned int size;
+                            bf::path cachePath;
+                            bool cached;
+                            bool failed;
+                            std::string error;
+                        };
+
+                        std::vector<RenderOperation> operations;
+
+                        for (const auto size : standardIconSizes) {
+                            // scaling up raster images doesn't add any detail
+                            if (info.format != imageprobe::FORMAT_SVG && (size > info.width || size > info.height)) {
+                                ldLog() << LD_WARNING << "Icon source is too small to generate icon of size"
+                                        << std::to_string(size) + "x" + std::to_string(size) << std::endl;
+                                continue;
+                            }
+
+                            const auto cachePath = iconCacheDirectory / (sourceHash + "-" + std::to_string(size) + ".png");
+                            operations.push_back({size, cachePath, false, false, ""});
+                        }
+
+                        {
+                            threadpool::ThreadPool pool(numberOfJobs);
+
+                            for (auto& operation : operations) {
+                                auto* currentOperation = &operation;
+
+                                pool.submit([&path, &info, currentOperation]() {
+                                    if (bf::exists(currentOperation->cachePath)) {
+                                        currentOperation->cached = true;
+                                        trace::addToCounter(trace::COUNTER_ICON_CACHE_HITS);
+                                        return;
+                                    }
+
+                                    if (!renderIcon(path, info, currentOperation->size, currentOperation->cachePath, currentOperation->error))
+                                        currentOperation->failed = true;
+                                });
+                            }
+
+                            pool.wait();
+                        }
+
+                        bool success = true;
+
+                        for (const auto& operation : operations) {
+                            const auto resolution = std::to_string(operation.size) + "x" + std::to_string(operation.size);
+
+                            if (operation.failed) {
+                                ldLog() << LD_ERROR << "Failed to render icon of size" << resolution << LD_NO_SPACE << ":" << operation.error << std::endl;
+                                success = false;
+                                continue;
+                            }
+
+                            ldLog() << (operation.cached ? "Using cached icon of size" : "Rendered icon of size") << resolution << std::endl;
+
+                            deployFile(operation.cachePath, appDirPath / "usr/share/icons/hicolor" / resolution / "apps" / (path.stem().string() + ".png"));
+                        }
+
+                        // vector images are deployed as they are as well
+                        if (info.format == imageprobe::FORMAT_SVG && !deployIcon(path))
+                            success = false;
+
+                        return success;
+                    }
             };
 
             AppDir::AppDir(const bf::path& path) {
@@ -337,11 +1760,13 @@ namespace linuxdeploy {
                     "usr/share/icons/hicolor/",
                 };
 
-                for (const std::string& resolution : {"16x16", "32x32", "64x64", "128x128", "256x256", "scalable"}) {
-                    auto iconPath = "usr/share/icons/hicolor/" + resolution + "/apps/";
+                for (const auto size : standardIconSizes) {
+                    auto iconPath = "usr/share/icons/hicolor/" + std::to_string(size) + "x" + std::to_string(size) + "/apps/";
                     dirPaths.push_back(iconPath);
                 }
 
+                dirPaths.push_back("usr/share/icons/hicolor/scalable/apps/");
+
                 for (const auto& dirPath : dirPaths) {
                     auto fullDirPath = d->appDirPath / dirPath;
 
@@ -366,106 +1791,159 @@ namespace linuxdeploy {
                 return d->deployLibrary(path);
             }
 
-            bool AppDir::deployExecutable(const bf::path& path) {
-                return d->deployExecutable(path);
+            bool AppDir::deployLibrary(const bf::path& path, const bf::path& destination, const std::string& rpath) {
+                return d->deployLibrary(path, true, destination, rpath);
             }
 
-            bool AppDir::deployDesktopFile(const desktopfile::DesktopFile& desktopFile) {
-                return d->deployDesktopFile(desktopFile);
+            void AppDir::setDeployMode(DeployMode deployMode) {
+                d->deployMode = deployMode;
             }
- 
-            bool AppDir::deployIcon(const bf::path& path) {
-                return d->deployIcon(path);
+
+            void AppDir::setLibraryStore(const bf::path& path) {
+                d->libraryStore.reset(new librarystore::LibraryStore(path));
             }
 
-            bool AppDir::executeDeferredOperations() {
-                return d->executeDeferredOperations();
+            void AppDir::setDebugInfoMode(DebugInfoMode mode, const bf::path& debugDirectory) {
+                d->debugInfoMode = mode;
+                d->debugDirectory = debugDirectory;
             }
 
-            boost::filesystem::path AppDir::path() {
-                return d->appDirPath;
+            void AppDir::setNumberOfJobs(size_t numberOfJobs) {
+                d->numberOfJobs = numberOfJobs < 1 ? 1 : numberOfJobs;
             }
 
-            static std::vector<bf::path> listFilesInDirectory(const bf::path& path, const bool recursive = true) {
-                std::vector<bf::path> foundPaths;
+            bool AppDir::setArchiveOutput(const bf::path& archivePath, bool writeTree) {
+                d->archive.reset(new archive::ArchiveWriter(archivePath, d->numberOfJobs));
+                d->writeTree = writeTree;
 
-                std::vector<char> pathBuf(path.string().size() + 1, '\0');
-                strcpy(pathBuf.data(), path.string().c_str());
+                // the AppDir is needed even if the deployed files aren't written into it, e.g., for the manifest
+                boost::system::error_code ec;
+                bf::create_directories(d->appDirPath, ec);
 
-                std::vector<char*> searchPaths = {pathBuf.data(), nullptr};
+                if (!d->archive->open()) {
+                    d->archive.reset();
+                    return false;
+                }
 
-                if (recursive) {
-                    // reset errno
-                    errno = 0;
+                return true;
+            }
 
-                    auto* fts = fts_open(searchPaths.data(), FTS_NOCHDIR | FTS_NOSTAT, nullptr);
+            bool AppDir::finishArchive() {
+                if (d->archive == nullptr)
+                    return false;
 
-                    int error = errno;
-                    if (fts == nullptr || error != 0) {
-                        ldLog() << LD_ERROR << "fts() failed:" << strerror(error) << std::endl;
-                        return {};
-                    }
+                trace::Span span("archive AppDir contents");
 
-                    FTSENT* ent;
-                    while ((ent = fts_read(fts)) != nullptr) {
-                        // FIXME: use ent's fts_info member instead of boost::filesystem
-                        if (bf::is_regular_file(ent->fts_path)) {
-                            foundPaths.push_back(ent->fts_path);
-                        }
-                    };
-                    error = errno;
-                    if (error != 0) {
-                        ldLog() << LD_ERROR << "fts_read() failed:" << strerror(error) << std::endl;
-                        return {};
-                    }
-                } else {
-                    DIR* dir;
-                    if ((dir = opendir(path.string().c_str())) == NULL) {
-                        auto error = errno;
-                        ldLog() << LD_ERROR << "opendir() failed:" << strerror(error);
-                    }
+                auto entries = scanDirectory(d->appDirPath);
+
+                // sorted to get reproducible archives, parent directories come before their contents
+                std::sort(entries.begin(), entries.end(), [](const DirectoryEntry& a, const DirectoryEntry& b) {
+                    return a.path.string() < b.path.string();
+                });
+
+                bool success = true;
+
+                for (const auto& entry : entries) {
+                    const auto name = d->archiveName(entry.path);
+
+                    // the manifest describes the tree on disk, and the files streamed into the archive are there already
+                    if (name == ".linuxdeploy-manifest" || d->archive->contains(name) || d->archive->contains(name + "/"))
+                        continue;
 
-                    struct dirent* ent;
-                    while ((ent = readdir(dir)) != NULL)  {
-                        auto fullPath = path / bf::path(ent->d_name);
-                        if (bf::is_regular_file(fullPath)) {
-                            foundPaths.push_back(fullPath);
+                    switch (entry.type) {
+                        case FILE_TYPE_REGULAR:
+                            success = d->archive->addFile(name, entry.path) && success;
+                            break;
+                        case FILE_TYPE_DIRECTORY: {
+                            struct stat st;
+                            success = stat(entry.path.c_str(), &st) == 0 && d->archive->addDirectory(name, st.st_mode) && success;
+                            break;
                         }
+                        case FILE_TYPE_SYMLINK: {
+                            std::vector<char> target(PATH_MAX + 1, '\0');
+                            const auto length = readlink(entry.path.c_str(), target.data(), target.size() - 1);
+                            success = length >= 0 && d->archive->addSymlink(name, std::string(target.data(), length)) && success;
+                            break;
+                        }
+                        default:
+                            ldLog() << LD_WARNING << "Skipping special file in AppDir:" << entry.path << std::endl;
+                            break;
                     }
                 }
 
-                return foundPaths;
+                if (!d->archive->finish())
+                    success = false;
+
+                if (success)
+                    ldLog() << "Wrote archive" << d->archive->path() << std::endl;
+
+                d->archive.reset();
+
+                return success;
+            }
+
+            dependencygraph::DependencyGraph& AppDir::dependencyGraph() {
+                return d->dependencyGraph;
+            }
+
+            excludelist::Excludelist& AppDir::excludelist() {
+                return d->excludelist;
+            }
+
+            bool AppDir::deployExecutable(const bf::path& path) {
+                return d->deployExecutable(path);
+            }
+
+            bool AppDir::deployExecutable(const bf::path& path, const bf::path& destination, const std::string& rpath) {
+                return d->deployExecutable(path, destination, rpath);
+            }
+
+            bool AppDir::deployDesktopFile(const desktopfile::DesktopFile& desktopFile) {
+                return d->deployDesktopFile(desktopFile);
+            }
+ 
+            bool AppDir::deployIcon(const bf::path& path) {
+                return d->deployIcon(path);
+            }
+
+            bool AppDir::deployIconFromSource(const bf::path& path) {
+                return d->deployIconFromSource(path);
+            }
+
+            bool AppDir::executeDeferredOperations() {
+                return d->executeDeferredOperations();
+            }
+
+            boost::filesystem::path AppDir::path() {
+                return d->appDirPath;
             }
 
             std::vector<bf::path> AppDir::deployedIconPaths() {
-                return listFilesInDirectory(path() / "/usr/share/icons/");
+                return d->indexedContent(CONTENT_ICON);
             }
 
             std::vector<bf::path> AppDir::deployedExecutablePaths() {
-                auto paths = listFilesInDirectory(path() / "usr/bin/", false);
-
-                paths.erase(std::remove_if(paths.begin(), paths.end(), [](const bf::path& path) {
-                    return !bf::is_regular_file(path);
-                }), paths.end());
+                return d->indexedContent(CONTENT_EXECUTABLE);
+            }
 
-                return paths;
+            std::vector<bf::path> AppDir::deployedDesktopFilePaths() {
+                return d->indexedContent(CONTENT_DESKTOP_FILE);
             }
 
             std::vector<desktopfile::DesktopFile> AppDir::deployedDesktopFiles() {
                 std::vector<desktopfile::DesktopFile> desktopFiles;
 
-                auto paths = listFilesInDirectory(path() / "usr/share/applications/", false);
-                paths.erase(std::remove_if(paths.begin(), paths.end(), [](const bf::path& path) {
-                    return path.extension() != ".desktop";
-                }), paths.end());
-
-                for (const auto& path : paths) {
+                for (const auto& path : deployedDesktopFilePaths()) {
                     desktopFiles.push_back(desktopfile::DesktopFile(path));
                 }
 
                 return desktopFiles;
             }
 
+            bool AppDir::createSymlink(const bf::path& target, const bf::path& symlink, bool useRelativePath) {
+                return d->symlinkFile(target, symlink, useRelativePath);
+            }
+
             bool AppDir::createLinksInAppDirRoot(const desktopfile::DesktopFile& desktopFile) {
                 ldLog() << "Deploying desktop file to AppDir root:" << desktopFile.path() << std::endl;
 
@@ -483,23 +1961,18 @@ namespace linuxdeploy {
                     return false;
                 }
 
-                const auto foundIconPaths = deployedIconPaths();
-
-                if (foundIconPaths.empty()) {
-                    ldLog() << LD_ERROR << "Could not find suitable executable for Exec entry:" << iconName << std::endl;
+                if (d->indexedContent(CONTENT_ICON).empty()) {
+                    ldLog() << LD_ERROR << "Could not find suitable icon for Icon entry:" << iconName << std::endl;
                     return false;
                 }
 
-                for (const auto& iconPath : foundIconPaths) {
-                    ldLog() << LD_DEBUG << "Icon found:" << iconPath << std::endl;
-
-                    if (iconPath.stem() == iconName) {
-                        ldLog() << "Deploying icon to AppDir root:" << iconPath << std::endl;
+                // icons are matched by their stem, which the index is keyed by
+                for (const auto& iconPath : d->findIndexedContent(CONTENT_ICON, iconName)) {
+                    ldLog() << "Deploying icon to AppDir root:" << iconPath << std::endl;
 
-                        if (!d->symlinkFile(iconPath, path())) {
-                            ldLog() << LD_ERROR << "Failed to create symlink for icon in AppDir root:" << iconPath << std::endl;
-                            return false;
-                        }
+                    if (!d->symlinkFile(iconPath, path())) {
+                        ldLog() << LD_ERROR << "Failed to create symlink for icon in AppDir root:" << iconPath << std::endl;
+                        return false;
                     }
                 }
 
@@ -511,23 +1984,17 @@ namespace linuxdeploy {
                     return false;
                 }
 
-                const auto foundExecutablePaths = deployedExecutablePaths();
-
-                if (foundExecutablePaths.empty()) {
-                    ldLog() << LD_ERROR << "Could not find suitable executable for Exec entry:" << iconName << std::endl;
+                if (d->indexedContent(CONTENT_EXECUTABLE).empty()) {
+                    ldLog() << LD_ERROR << "Could not find suitable executable for Exec entry:" << executableName << std::endl;
                     return false;
                 }
 
-                for (const auto& executablePath : foundExecutablePaths) {
-                    ldLog() << LD_DEBUG << "Executable found:" << executablePath << std::endl;
+                for (const auto& executablePath : d->findIndexedContent(CONTENT_EXECUTABLE, iconName)) {
+                    ldLog() << "Deploying AppRun symlink for executable in AppDir root:" << executablePath << std::endl;
 
-                    if (executablePath.stem() == iconName) {
-                        ldLog() << "Deploying AppRun symlink for executable in AppDir root:" << executablePath << std::endl;
-
-                        if (!d->symlinkFile(executablePath, path() / "AppRun")) {
-                            ldLog() << LD_ERROR << "Failed to create AppRun symlink for executable in AppDir root:" << executablePath << std::endl;
-                            return false;
-                        }
+                    if (!d->symlinkFile(executablePath, path() / "AppRun")) {
+                        ldLog() << LD_ERROR << "Failed to create AppRun symlink for executable in AppDir root:" << executablePath << std::endl;
+                        return false;
                     }
                 }
 
@@ -0,0 +1,492 @@
+// system includes
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_set>
+
+// library includes
+#include <zlib.h>
+
+// local headers
+#include "linuxdeploy/core/archive.h"
+#include "linuxdeploy/core/log.h"
+#include "linuxdeploy/core/threadpool.h"
+#include "linuxdeploy/core/trace.h"
+
+using namespace linuxdeploy::core::log;
+
+namespace bf = boost::filesystem;
+
+namespace linuxdeploy {
+    namespace core {
+        namespace archive {
+            // size of the blocks compressed independently
+            // larger blocks compress slightly better, smaller ones distribute the work more evenly across the threads
+            static const size_t blockSize = 1024 * 1024;
+
+            static const size_t tarRecordSize = 512;
+
+            // archives are padded to a multiple of this size, like tar does by default
+            static const size_t tarBlockingFactor = 20;
+
+            // largest value which fits into the 11 octal digits of the size field
+            static const uint64_t maxUstarSize = 077777777777ull;
+
+            static bool writeAll(int fd, const std::string& data) {
+                for (size_t written = 0; written < data.size();) {
+                    const auto rv = write(fd, data.data() + written, data.size() - written);
+
+                    if (rv < 0) {
+                        if (errno == EINTR)
+                            continue;
+
+                        return false;
+                    }
+
+                    written += static_cast<size_t>(rv);
+                }
+
+                return true;
+            }
+
+            // compress data into a complete gzip member
+            static bool gzipCompress(const std::string& data, std::string& compressed) {
+                z_stream stream;
+                memset(&stream, 0, sizeof(stream));
+
+                // window bits + 16 selects the gzip format
+                if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+                    return false;
+
+                // the bound doesn't include the gzip header and trailer
+                compressed.resize(deflateBound(&stream, data.size()) + 32);
+
+                stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+                stream.avail_in = static_cast<uInt>(data.size());
+                stream.next_out = reinterpret_cast<Bytef*>(&compressed[0]);
+                stream.avail_out = static_cast<uInt>(compressed.size());
+
+                const bool success = deflate(&stream, Z_FINISH) == Z_STREAM_END;
+
+                compressed.resize(stream.total_out);
+                deflateEnd(&stream);
+
+                return success;
+            }
+
+            // write number into a tar header field as zero-padded octal number, followed by a NUL byte
+            static void setOctalField(char* field, size_t size, uint64_t value) {
+                char buffer[32];
+                snprintf(buffer, sizeof(buffer), "%0*llo", static_cast<int>(size - 1), static_cast<unsigned long long>(value));
+                memcpy(field, buffer, size - 1);
+                field[size - 1] = '\0';
+            }
+
+            // pax extended header record, which is prefixed with its own length
+            static std::string paxRecord(const std::string& key, const std::string& value) {
+                const auto contents = " " + key + "=" + value + "\n";
+
+                auto length = contents.size() + 1;
+
+                while (std::to_string(length).size() + contents.size() != length)
+                    length++;
+
+                return std::to_string(length) + contents;
+            }
+
+            class ArchiveWriter::PrivateData {
+                public:
+                    const bf::path path;
+                    const bf::path tempPath;
+
+                    int fd;
+                    bool finished;
+
+                    // serializes the entries, and guards the current block and the list of entries
+                    mutable std::mutex entryMutex;
+                    std::unordered_set<std::string> names;
+                    std::string block;
+                    size_t nextBlockIndex;
+                    uint64_t uncompressedSize;
+
+                    // compressed blocks are passed on to the thread which writes them in order, see compressBlock()
+                    std::mutex outputMutex;
+                    std::condition_variable blockWritten;
+                    std::map<size_t, std::string> compressedBlocks;
+                    size_t nextBlockToWrite;
+                    size_t blocksInFlight;
+                    const size_t maxBlocksInFlight;
+                    bool failed;
+
+                    threadpool::ThreadPool pool;
+
+                public:
+                    PrivateData(const bf::path& path, size_t numberOfThreads) : path(path),
+                        tempPath(path.parent_path() / ("." + path.filename().string() + ".linuxdeploy-" + std::to_string(getpid()))),
+                        fd(-1), finished(false), nextBlockIndex(0), uncompressedSize(0), nextBlockToWrite(0), blocksInFlight(0),
+                        maxBlocksInFlight(2 * std::max<size_t>(numberOfThreads, 1)), failed(false), pool(numberOfThreads) {}
+
+                public:
+                    // compress block, and write all blocks which are ready in order
+                    // runs on the worker threads
+                    void compressBlock(size_t index, const std::string& data) {
+                        trace::Span span("compress block");
+
+                        std::string compressed;
+                        const bool success = gzipCompress(data, compressed);
+
+                        std::lock_guard<std::mutex> lock(outputMutex);
+
+                        if (!success) {
+                            ldLog() << LD_ERROR << "Failed to compress archive block" << std::endl;
+                            failed = true;
+                        }
+
+                        compressedBlocks[index] = std::move(compressed);
+
+                        for (auto it = compressedBlocks.find(nextBlockToWrite); it != compressedBlocks.end(); it = compressedBlocks.find(nextBlockToWrite)) {
+                            if (!failed && !writeAll(fd, it->second)) {
+                                ldLog() << LD_ERROR << "Failed to write archive" << tempPath << LD_NO_SPACE << ":" << strerror(errno) << std::endl;
+                                failed = true;
+                            }
+
+                            compressedBlocks.erase(it);
+                            nextBlockToWrite++;
+                            blocksInFlight--;
+                        }
+
+                        blockWritten.notify_all();
+                    }
+
+                    // hand the current block over to the worker threads
+                    // blocks while too many blocks are in flight already
+                    void submitBlock() {
+                        if (block.empty())
+                            return;
+
+                        {
+                            std::unique_lock<std::mutex> lock(outputMutex);
+                            blockWritten.wait(lock, [this]() { return blocksInFlight < maxBlocksInFlight; });
+                            blocksInFlight++;
+                        }
+
+                        // std::function needs to be copyable, therefore the block is shared with the task
+                        std::shared_ptr<std::string> data(new std::string);
+                        data->swap(block);
+                        block.reserve(blockSize);
+
+                        const auto index = nextBlockIndex++;
+                        pool.submit([this, index, data]() { compressBlock(index, *data); });
+                    }
+
+                    // append data to the tar stream, the caller must hold the entry lock
+                    void append(const char* data, size_t size) {
+                        uncompressedSize += size;
+
+                        while (size > 0) {
+                            const auto chunkSize = std::min(size, blockSize - block.size());
+
+                            block.append(data, chunkSize);
+                            data += chunkSize;
+                            size -= chunkSize;
+
+                            if (block.size() == blockSize)
+                                submitBlock();
+                        }
+                    }
+
+                    void appendPadding() {
+                        static const char zeros[tarRecordSize] = {};
+
+                        if (uncompressedSize % tarRecordSize != 0)
+                            append(zeros, tarRecordSize - uncompressedSize % tarRecordSize);
+                    }
+
+                    void appendHeader(const std::string& name, char type, mode_t mode, uint64_t size, int64_t mtime,
+                                      const std::string& linkTarget = "") {
+                        // names, link targets and sizes which don't fit into the ustar header are stored in a pax
+                        // extended header preceding it
+                        std::string paxRecords;
+
+                        if (name.size() > 100)
+                            paxRecords += paxRecord("path", name);
+
+                        if (linkTarget.size() > 100)
+                            paxRecords += paxRecord("linkpath", linkTarget);
+
+                        if (size > maxUstarSize)
+                            paxRecords += paxRecord("size", std::to_string(size));
+
+                        if (!paxRecords.empty()) {
+                            appendHeader("PaxHeaders/" + name.substr(0, 80), 'x', 0644, paxRecords.size(), mtime);
+                            append(paxRecords.data(), paxRecords.size());
+                            appendPadding();
+                        }
+
+                        char header[tarRecordSize] = {};
+
+                        memcpy(header, name.data(), std::min<size_t>(name.size(), 100));
+                        setOctalField(header + 100, 8, mode & 07777);
+                        setOctalField(header + 108, 8, 0);
+                        setOctalField(header + 116, 8, 0);
+                        setOctalField(header + 124, 12, size > maxUstarSize ? 0 : size);
+                        setOctalField(header + 136, 12, static_cast<uint64_t>(std::max<int64_t>(mtime, 0)));
+                        header[156] = type;
+                        memcpy(header + 157, linkTarget.data(), std::min<size_t>(linkTarget.size(), 100));
+                        memcpy(header + 257, "ustar", 6);
+                        memcpy(header + 263, "00", 2);
+
+                        // the checksum is calculated with the checksum field filled with spaces
+                        memset(header + 148, ' ', 8);
+
+                        unsigned int checksum = 0;
+                        for (const auto c : header)
+                            checksum += static_cast<unsigned char>(c);
+
+                        setOctalField(header + 148, 7, checksum);
+
+                        append(header, sizeof(header));
+                    }
+
+                    // add entries for the parent directories of an entry which haven't been added yet
+                    // the caller must hold the entry lock
+                    void addParentDirectories(const std::string& name) {
+                        for (auto pos = name.find('/'); pos != std::string::npos && pos + 1 < name.size(); pos = name.find('/', pos + 1)) {
+                            const auto directoryName = name.substr(0, pos + 1);
+
+                            if (names.insert(directoryName).second)
+                                appendHeader(directoryName, '5', 0755, 0, time(nullptr));
+                        }
+                    }
+
+                    // claim name for a new entry, which must not have been added before
+                    // the caller must hold the entry lock
+                    bool claimName(const std::string& name) {
+                        if (fd < 0 || finished) {
+                            ldLog() << LD_ERROR << "Archive is not open:" << path << std::endl;
+                            return false;
+                        }
+
+                        if (!names.insert(name).second) {
+                            ldLog() << LD_WARNING << "Skipping duplicate archive entry:" << name << std::endl;
+                            return false;
+                        }
+
+                        addParentDirectories(name);
+                        return true;
+                    }
+            };
+
+            ArchiveWriter::ArchiveWriter(const bf::path& path, size_t numberOfThreads) {
+                d = new PrivateData(path, numberOfThreads);
+            }
+
+            ArchiveWriter::~ArchiveWriter() {
+                // the tasks write to the file, therefore they need to finish before it's closed
+                d->pool.wait();
+
+                if (d->fd >= 0) {
+                    close(d->fd);
+                    unlink(d->tempPath.c_str());
+                }
+
+                delete d;
+            }
+
+            bool ArchiveWriter::open() {
+                d->fd = ::open(d->tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+                if (d->fd < 0) {
+                    ldLog() << LD_ERROR << "Failed to create archive" << d->path << LD_NO_SPACE << ":" << strerror(errno) << std::endl;
+                    return false;
+                }
+
+                d->block.reserve(blockSize);
+
+                return true;
+            }
+
+            const bf::path& ArchiveWriter::path() const {
+                return d->path;
+            }
+
+            bool ArchiveWriter::contains(const std::string& name) const {
+                std::lock_guard<std::mutex> lock(d->entryMutex);
+                return d->names.find(name) != d->names.end();
+            }
+
+            bool ArchiveWriter::addDirectory(const std::string& name, mode_t mode) {
+                const auto directoryName = name.back() == '/' ? name : name + "/";
+
+                std::lock_guard<std::mutex> lock(d->entryMutex);
+
+                if (!d->claimName(directoryName))
+                    return false;
+
+                d->appendHeader(directoryName, '5', mode, 0, time(nullptr));
+                return true;
+            }
+
+            bool ArchiveWriter::addSymlink(const std::string& name, const std::string& target) {
+                std::lock_guard<std::mutex> lock(d->entryMutex);
+
+                if (!d->claimName(name))
+                    return false;
+
+                d->appendHeader(name, '2', 0777, 0, time(nullptr), target);
+                return true;
+            }
+
+            bool ArchiveWriter::addFile(const std::string& name, const bf::path& path) {
+                struct stat st;
+
+                if (stat(path.c_str(), &st) != 0) {
+                    ldLog() << LD_ERROR << "Failed to add file to archive:" << path << std::endl;
+                    return false;
+                }
+
+                return addFile(name, path, static_cast<uint64_t>(st.st_size), {});
+            }
+
+            bool ArchiveWriter::addFile(const std::string& name, const bf::path& path, uint64_t length, const std::vector<elf::FilePatch>& patches) {
+                trace::Span span("archive file", path);
+
+                int in = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+                struct stat st;
+
+                if (in < 0 || fstat(in, &st) != 0 || !S_ISREG(st.st_mode) || static_cast<uint64_t>(st.st_size) < length) {
+                    ldLog() << LD_ERROR << "Failed to add file to archive:" << path << std::endl;
+
+                    if (in >= 0)
+                        close(in);
+
+                    return false;
+                }
+
+                // patches past the end extend the file
+                uint64_t size = length;
+
+                for (const auto& patch : patches)
+                    size = std::max<uint64_t>(size, patch.offset + patch.data.size());
+
+                std::lock_guard<std::mutex> lock(d->entryMutex);
+
+                if (!d->claimName(name)) {
+                    close(in);
+                    return false;
+                }
+
+                d->appendHeader(name, '0', st.st_mode, size, st.st_mtime);
+
+                std::vector<char> buffer(std::min<uint64_t>(blockSize, size));
+                bool success = true;
+
+                for (uint64_t offset = 0; offset < size;) {
+                    const auto chunkSize = std::min<uint64_t>(buffer.size(), size - offset);
+                    const auto readSize = offset < length ? std::min(chunkSize, length - offset) : 0;
+
+                    for (uint64_t bytesRead = 0; bytesRead < readSize;) {
+                        const auto rv = pread(in, buffer.data() + bytesRead, readSize - bytesRead, offset + bytesRead);
+
+                        if (rv < 0 && errno == EINTR)
+                            continue;
+
+                        // the entry's size has been written already, the archive is unusable if the data is missing
+                        if (rv <= 0) {
+                            ldLog() << LD_ERROR << "Failed to read file" << path << "while adding it to archive" << std::endl;
+                            success = false;
+                            break;
+                        }
+
+                        bytesRead += static_cast<uint64_t>(rv);
+                    }
+
+                    if (!success)
+                        break;
+
+                    std::fill(buffer.begin() + readSize, buffer.begin() + chunkSize, '\0');
+
+                    for (const auto& patch : patches) {
+                        const auto patchEnd = patch.offset + patch.data.size();
+
+                        if (patchEnd <= offset || patch.offset >= offset + chunkSize)
+                            continue;
+
+                        const auto start = std::max(patch.offset, offset);
+                        const auto end = std::min(patchEnd, offset + chunkSize);
+
+                        memcpy(buffer.data() + (start - offset), patch.data.data() + (start - patch.offset), end - start);
+                    }
+
+                    d->append(buffer.data(), chunkSize);
+                    offset += chunkSize;
+                }
+
+                close(in);
+
+                if (!success) {
+                    std::lock_guard<std::mutex> outputLock(d->outputMutex);
+                    d->failed = true;
+                    return false;
+                }
+
+                d->appendPadding();
+
+                return true;
+            }
+
+            bool ArchiveWriter::finish() {
+                trace::Span span("finish archive");
+
+                {
+                    std::lock_guard<std::mutex> lock(d->entryMutex);
+
+                    if (d->fd < 0 || d->finished)
+                        return false;
+
+                    // the end of the archive is marked by two empty records
+                    const std::string endOfArchive(2 * tarRecordSize, '\0');
+                    d->append(endOfArchive.data(), endOfArchive.size());
+
+                    const auto blockingSize = tarBlockingFactor * tarRecordSize;
+                    if (d->uncompressedSize % blockingSize != 0) {
+                        const std::string padding(blockingSize - d->uncompressedSize % blockingSize, '\0');
+                        d->append(padding.data(), padding.size());
+                    }
+
+                    d->submitBlock();
+                    d->finished = true;
+                }
+
+                d->pool.wait();
+
+                bool success = !d->failed;
+
+                if (close(d->fd) != 0)
+                    success = false;
+
+                d->fd = -1;
+
+                if (success && rename(d->tempPath.c_str(), d->path.c_str()) != 0) {
+                    ldLog() << LD_ERROR << "Failed to move archive into place:" << d->path << std::endl;
+                    success = false;
+                }
+
+                if (!success)
+                    unlink(d->tempPath.c_str());
+
+                return success;
+            }
+        }
+    }
+}
@@ -0,0 +1,179 @@
+// system includes
+#include <cctype>
+#include <sstream>
+#include <vector>
+
+// library includes
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+// local headers
+#include "linuxdeploy/core/batch.h"
+#include "linuxdeploy/core/log.h"
+
+using namespace linuxdeploy::core::log;
+
+namespace bf = boost::filesystem;
+namespace pt = boost::property_tree;
+
+namespace linuxdeploy {
+    namespace core {
+        namespace batch {
+            static const char* const whitespace = " \t\r\n";
+
+            static std::string trim(const std::string& value) {
+                const auto begin = value.find_first_not_of(whitespace);
+
+                if (begin == std::string::npos)
+                    return "";
+
+                const auto end = value.find_last_not_of(whitespace);
+                return value.substr(begin, end - begin + 1);
+            }
+
+            bool parseEntryType(const std::string& name, EntryType& type) {
+                if (name == "library") {
+                    type = ENTRY_LIBRARY;
+                } else if (name == "executable") {
+                    type = ENTRY_EXECUTABLE;
+                } else if (name == "icon") {
+                    type = ENTRY_ICON;
+                } else if (name == "desktop-file") {
+                    type = ENTRY_DESKTOP_FILE;
+                } else {
+                    return false;
+                }
+
+                return true;
+            }
+
+            static bool parseLine(const std::string& line, size_t lineNumber, Entry& entry) {
+                std::vector<std::string> fields;
+
+                if (line.find('\t') != std::string::npos) {
+                    std::istringstream iss(line);
+                    std::string field;
+
+                    while (std::getline(iss, field, '\t'))
+                        fields.push_back(trim(field));
+                } else {
+                    // paths may contain spaces, therefore only the type is split off
+                    const auto separator = line.find(' ');
+
+                    if (separator != std::string::npos) {
+                        fields.push_back(line.substr(0, separator));
+                        fields.push_back(trim(line.substr(separator + 1)));
+                    }
+                }
+
+                if (fields.size() < 2 || fields.size() > 4 || fields[1].empty()) {
+                    ldLog() << LD_ERROR << "Invalid entry in line" << lineNumber << LD_NO_SPACE << ":" << line << std::endl;
+                    return false;
+                }
+
+                if (!parseEntryType(fields[0], entry.type)) {
+                    ldLog() << LD_ERROR << "Unknown entry type in line" << lineNumber << LD_NO_SPACE << ":" << fields[0] << std::endl;
+                    return false;
+                }
+
+                entry.source = fields[1];
+                entry.destination = fields.size() > 2 ? fields[2] : "";
+                entry.rpath = fields.size() > 3 ? fields[3] : "";
+
+                return true;
+            }
+
+            static bool parseObject(const pt::ptree& object, Entry& entry) {
+                const auto typeName = object.get<std::string>("type", "");
+
+                if (!parseEntryType(typeName, entry.type)) {
+                    ldLog() << LD_ERROR << "Unknown entry type:" << typeName << std::endl;
+                    return false;
+                }
+
+                entry.source = object.get<std::string>("source", "");
+
+                if (entry.source.empty()) {
+                    ldLog() << LD_ERROR << "Entry of type" << typeName << "lacks a source" << std::endl;
+                    return false;
+                }
+
+                entry.destination = object.get<std::string>("destination", "");
+                entry.rpath = object.get<std::string>("rpath", "");
+
+                return true;
+            }
+
+            static bool readJsonArray(std::istream& in, const std::function<bool(const Entry&)>& callback) {
+                pt::ptree tree;
+
+                // property trees represent the document's root array as an object with empty keys
+                try {
+                    pt::read_json(in, tree);
+                } catch (const pt::json_parser_error& e) {
+                    ldLog() << LD_ERROR << "Failed to parse JSON:" << e.what() << std::endl;
+                    return false;
+                }
+
+                for (const auto& child : tree) {
+                    if (!child.first.empty()) {
+                        ldLog() << LD_ERROR << "Expected a JSON array of entries" << std::endl;
+                        return false;
+                    }
+
+                    Entry entry;
+
+                    if (!parseObject(child.second, entry) || !callback(entry))
+                        return false;
+                }
+
+                return true;
+            }
+
+            bool readEntries(std::istream& in, const std::function<bool(const Entry&)>& callback) {
+                // skip leading whitespace to detect the format without consuming any data
+                while (in && std::isspace(in.peek()))
+                    in.get();
+
+                if (in.peek() == '[')
+                    return readJsonArray(in, callback);
+
+                std::string line;
+                size_t lineNumber = 0;
+
+                while (std::getline(in, line)) {
+                    lineNumber++;
+
+                    const auto trimmedLine = trim(line);
+
+                    if (trimmedLine.empty() || trimmedLine[0] == '#')
+                        continue;
+
+                    Entry entry;
+
+                    if (trimmedLine[0] == '{') {
+                        pt::ptree object;
+                        std::istringstream iss(trimmedLine);
+
+                        try {
+                            pt::read_json(iss, object);
+                        } catch (const pt::json_parser_error& e) {
+                            ldLog() << LD_ERROR << "Failed to parse JSON in line" << lineNumber << LD_NO_SPACE << ":" << e.message() << std::endl;
+                            return false;
+                        }
+
+                        if (!parseObject(object, entry))
+                            return false;
+                    } else if (!parseLine(trimmedLine, lineNumber, entry)) {
+                        return false;
+                    }
+
+                    if (!callback(entry))
+                        return false;
+                }
+
+                return true;
+            }
+        }
+    }
+}
@@ -0,0 +1,281 @@
+// system includes
+#include <deque>
+#include <map>
+#include <set>
+#include <sys/stat.h>
+#include <unordered_map>
+
+// local headers
+#include "linuxdeploy/core/dependencygraph.h"
+#include "linuxdeploy/core/elf.h"
+#include "linuxdeploy/core/log.h"
+#include "linuxdeploy/core/trace.h"
+
+using namespace linuxdeploy::core::log;
+
+namespace bf = boost::filesystem;
+
+namespace linuxdeploy {
+    namespace core {
+        namespace dependencygraph {
+            class DependencyGraph::PrivateData {
+                public:
+                    typedef std::pair<dev_t, ino_t> Identity;
+
+                    struct Edge {
+                        // DT_NEEDED entry
+                        std::string name;
+                        // index of the node the entry has been resolved to, -1 if it couldn't be resolved
+                        ssize_t node;
+                        // path the dependency has been resolved to
+                        bf::path path;
+                    };
+
+                    // the dependencies of a file also depend on the DT_RPATH entries it inherits from the files which
+                    // caused it to be loaded, therefore a file might be represented by multiple nodes
+                    // as most files don't inherit any, they're usually traced only once nevertheless
+                    struct Node {
+                        // path the file has been added by first
+                        bf::path path;
+                        Identity identity;
+                        std::vector<elf::InheritedRPath> inheritedRPaths;
+                        std::string soname;
+                        bool traced;
+                        std::vector<Edge> dependencies;
+                    };
+
+                public:
+                    std::vector<Node> nodes;
+                    std::map<std::pair<Identity, std::string>, size_t> nodesByKey;
+
+                    // saves stat() calls for paths which have been seen before
+                    std::unordered_map<std::string, Identity> identitiesByPath;
+
+                    // complete lists of dependencies reported by ldd, by identity of the file ldd has been run on
+                    std::map<Identity, std::vector<bf::path>> lddDependencies;
+
+                public:
+                    // returns false if the file doesn't exist
+                    bool identify(const bf::path& path, Identity& identity) {
+                        auto byPath = identitiesByPath.find(path.string());
+                        if (byPath != identitiesByPath.end()) {
+                            identity = byPath->second;
+                            return true;
+                        }
+
+                        struct stat st;
+                        if (stat(path.c_str(), &st) != 0)
+                            return false;
+
+                        identity = std::make_pair(st.st_dev, st.st_ino);
+                        identitiesByPath[path.string()] = identity;
+                        return true;
+                    }
+
+                    static std::string serializeRPaths(const std::vector<elf::InheritedRPath>& rpaths) {
+                        std::string key;
+
+                        for (const auto& entry : rpaths) {
+                            key += entry.rpath;
+                            key += '\0';
+                            key += entry.origin.string();
+                            key += '\0';
+                        }
+
+                        return key;
+                    }
+
+                    // look up the node for the given file and inherited rpaths
+                    // returns false if the file is not part of the graph or doesn't exist
+                    bool findNode(const bf::path& path, const std::vector<elf::InheritedRPath>& inheritedRPaths, size_t& index) {
+                        Identity identity;
+                        if (!identify(path, identity))
+                            return false;
+
+                        auto node = nodesByKey.find(std::make_pair(identity, serializeRPaths(inheritedRPaths)));
+                        if (node == nodesByKey.end())
+                            return false;
+
+                        index = node->second;
+                        return true;
+                    }
+
+                    // look up the node for the given file and inherited rpaths, creating it if necessary
+                    // returns false if the file doesn't exist
+                    bool getOrCreateNode(const bf::path& path, const std::vector<elf::InheritedRPath>& inheritedRPaths, size_t& index) {
+                        Identity identity;
+                        if (!identify(path, identity))
+                            return false;
+
+                        const auto key = std::make_pair(identity, serializeRPaths(inheritedRPaths));
+
+                        auto node = nodesByKey.find(key);
+                        if (node != nodesByKey.end()) {
+                            index = node->second;
+                            return true;
+                        }
+
+                        index = nodes.size();
+                        nodes.push_back({path, identity, inheritedRPaths, "", false, {}});
+                        nodesByKey[key] = index;
+                        return true;
+                    }
+
+                    // resolve the dependencies of the node and all nodes reachable from it which haven't been traced yet
+                    void trace(size_t root) {
+                        std::deque<size_t> untraced = {root};
+
+                        while (!untraced.empty()) {
+                            const auto current = untraced.front();
+                            untraced.pop_front();
+
+                            if (nodes[current].traced)
+                                continue;
+
+                            nodes[current].traced = true;
+
+                            ldLog() << LD_DEBUG << "Tracing dependencies of ELF file" << nodes[current].path << std::endl;
+
+                            elf::ElfFile file(nodes[current].path);
+
+                            nodes[current].soname = file.getSoname();
+
+                            const auto dependencies = file.resolveDirectDependencies(nodes[current].inheritedRPaths);
+                            const auto dependencyRPaths = file.getRPathsForDependencies(nodes[current].inheritedRPaths);
+
+                            for (const auto& dependency : dependencies) {
+                                size_t node;
+
+                                // missing dependencies are reported by closure(), as the dynamic loader might not need to
+                                // resolve the entry at all
+                                if (dependency.path.empty() || !getOrCreateNode(dependency.path, dependencyRPaths, node)) {
+                                    nodes[current].dependencies.push_back({dependency.name, -1, dependency.path});
+                                    continue;
+                                }
+
+                                // the nodes might have been reallocated
+                                nodes[current].dependencies.push_back({dependency.name, static_cast<ssize_t>(node), dependency.path});
+
+                                if (!nodes[node].traced)
+                                    untraced.push_back(node);
+                            }
+                        }
+                    }
+            };
+
+            DependencyGraph::DependencyGraph() {
+                d = new PrivateData();
+            }
+
+            DependencyGraph::~DependencyGraph() {
+                delete d;
+            }
+
+            bool DependencyGraph::addFile(const bf::path& path) {
+                trace::Span span("trace dependencies", path);
+
+                size_t root;
+
+                if (!d->getOrCreateNode(path, {}, root)) {
+                    ldLog() << LD_ERROR << "No such file or directory:" << path << std::endl;
+                    return false;
+                }
+
+                // ldd reports all dependencies at once, therefore it's run once for every file added, but not for the
+                // dependencies
+                if (elf::ElfFile::getUseLdd()) {
+                    const auto& identity = d->nodes[root].identity;
+
+                    if (d->lddDependencies.find(identity) == d->lddDependencies.end())
+                        d->lddDependencies[identity] = elf::ElfFile(path).traceDynamicDependencies();
+
+                    return true;
+                }
+
+                d->trace(root);
+
+                return true;
+            }
+
+            bool DependencyGraph::contains(const bf::path& path) const {
+                size_t index;
+                return d->findNode(path, {}, index);
+            }
+
+            std::vector<bf::path> DependencyGraph::directDependencies(const bf::path& path) const {
+                size_t index;
+                if (!d->findNode(path, {}, index))
+                    return {};
+
+                // ldd only reports the complete list of dependencies, which are all treated as direct ones then
+                auto lddDependencies = d->lddDependencies.find(d->nodes[index].identity);
+                if (lddDependencies != d->lddDependencies.end())
+                    return lddDependencies->second;
+
+                std::vector<bf::path> paths;
+
+                for (const auto& edge : d->nodes[index].dependencies) {
+                    if (edge.node >= 0)
+                        paths.push_back(edge.path);
+                }
+
+                return paths;
+            }
+
+            std::vector<bf::path> DependencyGraph::closure(const bf::path& path) const {
+                size_t root;
+                if (!d->findNode(path, {}, root))
+                    return {};
+
+                auto lddDependencies = d->lddDependencies.find(d->nodes[root].identity);
+                if (lddDependencies != d->lddDependencies.end())
+                    return lddDependencies->second;
+
+                std::vector<bf::path> paths;
+
+                // the dynamic loader doesn't load the same file twice, neither by name nor by identity
+                // a DT_NEEDED entry which matches the name or soname of a library loaded before is not resolved at all,
+                // even if it would resolve to a different file from the file it belongs to
+                std::set<std::string> loadedNames;
+                std::set<PrivateData::Identity> loadedFiles = {d->nodes[root].identity};
+
+                if (!d->nodes[root].soname.empty())
+                    loadedNames.insert(d->nodes[root].soname);
+
+                std::deque<size_t> queue = {root};
+
+                while (!queue.empty()) {
+                    const auto current = queue.front();
+                    queue.pop_front();
+
+                    for (const auto& edge : d->nodes[current].dependencies) {
+                        if (!loadedNames.insert(edge.name).second)
+                            continue;
+
+                        if (edge.node < 0) {
+                            ldLog() << LD_WARNING << "Could not find dependency" << edge.name << "of ELF file" << d->nodes[current].path << std::endl;
+                            continue;
+                        }
+
+                        const auto& dependency = d->nodes[edge.node];
+
+                        if (!loadedFiles.insert(dependency.identity).second)
+                            continue;
+
+                        if (!dependency.soname.empty())
+                            loadedNames.insert(dependency.soname);
+
+                        paths.push_back(edge.path);
+                        queue.push_back(edge.node);
+                    }
+                }
+
+                return paths;
+            }
+
+            size_t DependencyGraph::size() const {
+                return d->nodes.size();
+            }
+        }
+    }
+}
@@ -0,0 +1,167 @@
+// system includes
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <unistd.h>
+
+// local headers
+#include "linuxdeploy/core/deploymentmanifest.h"
+#include "linuxdeploy/core/log.h"
+#include "linuxdeploy/core/util.h"
+
+using namespace linuxdeploy::core::log;
+
+namespace bf = boost::filesystem;
+
+namespace linuxdeploy {
+    namespace core {
+        namespace deploymentmanifest {
+            // first line of the file, needs to be changed whenever the format changes
+            static const std::string manifestHeader = "linuxdeploy-manifest\t2";
+
+            static const size_t numberOfFields = 13;
+
+            class DeploymentManifest::PrivateData {
+                public:
+                    bf::path path;
+
+                    // sorted to get reproducible files
+                    std::map<std::string, ManifestEntry> entries;
+
+                public:
+                    static bool parseLine(const std::string& line, ManifestEntry& entry) {
+                        const auto fields = util::split(line, '\t');
+
+                        if (fields.size() != numberOfFields)
+                            return false;
+
+                        try {
+                            entry.destination = fields[0];
+                            entry.source = fields[1];
+                            entry.size = std::stoull(fields[2]);
+                            entry.mtime = std::stoll(fields[3]);
+                            entry.device = std::stoull(fields[4]);
+                            entry.inode = std::stoull(fields[5]);
+                            entry.sha256 = fields[6];
+                            entry.rpath = fields[7];
+                            entry.deployMode = std::stoi(fields[8]);
+                            entry.destinationSize = std::stoull(fields[9]);
+                            entry.destinationMtime = std::stoll(fields[10]);
+                            entry.debugInfoMode = std::stoi(fields[11]);
+                        } catch (const std::logic_error&) {
+                            return false;
+                        }
+
+                        // the last field guarantees that empty fields before it aren't dropped by split()
+                        return fields[12] == ".";
+                    }
+
+                    static std::string formatLine(const ManifestEntry& entry) {
+                        std::ostringstream oss;
+
+                        oss << entry.destination.string() << '\t' << entry.source.string() << '\t'
+                            << entry.size << '\t' << entry.mtime << '\t' << entry.device << '\t' << entry.inode << '\t'
+                            << entry.sha256 << '\t' << entry.rpath << '\t' << entry.deployMode << '\t'
+                            << entry.destinationSize << '\t' << entry.destinationMtime << '\t' << entry.debugInfoMode << '\t' << '.';
+
+                        return oss.str();
+                    }
+
+                    // the format can't represent these
+                    static bool isRepresentable(const std::string& value) {
+                        return value.find_first_of("\t\n") == std::string::npos;
+                    }
+            };
+
+            DeploymentManifest::DeploymentManifest(const bf::path& path) {
+                d = new PrivateData();
+                d->path = path;
+            }
+
+            DeploymentManifest::~DeploymentManifest() {
+                delete d;
+            }
+
+            void DeploymentManifest::read() {
+                d->entries.clear();
+
+                std::ifstream ifs(d->path.string());
+
+                if (!ifs)
+                    return;
+
+                std::string line;
+
+                if (!std::getline(ifs, line) || line != manifestHeader) {
+                    ldLog() << LD_WARNING << "Ignoring deployment manifest with unknown format:" << d->path << std::endl;
+                    return;
+                }
+
+                while (std::getline(ifs, line)) {
+                    ManifestEntry entry;
+
+                    if (!PrivateData::parseLine(line, entry)) {
+                        ldLog() << LD_WARNING << "Ignoring invalid deployment manifest:" << d->path << std::endl;
+                        d->entries.clear();
+                        return;
+                    }
+
+                    d->entries[entry.destination.string()] = entry;
+                }
+            }
+
+            bool DeploymentManifest::write() {
+                const auto tempPath = d->path.string() + ".tmp";
+
+                {
+                    std::ofstream ofs(tempPath);
+
+                    ofs << manifestHeader << '\n';
+
+                    for (const auto& pair : d->entries)
+                        ofs << PrivateData::formatLine(pair.second) << '\n';
+
+                    if (!ofs.flush()) {
+                        ldLog() << LD_ERROR << "Failed to write deployment manifest:" << tempPath << std::endl;
+                        unlink(tempPath.c_str());
+                        return false;
+                    }
+                }
+
+                // readers never see a partially written file
+                if (rename(tempPath.c_str(), d->path.c_str()) != 0) {
+                    ldLog() << LD_ERROR << "Failed to replace deployment manifest:" << d->path << std::endl;
+                    unlink(tempPath.c_str());
+                    return false;
+                }
+
+                return true;
+            }
+
+            bool DeploymentManifest::find(const bf::path& destination, ManifestEntry& entry) const {
+                auto it = d->entries.find(destination.string());
+
+                if (it == d->entries.end())
+                    return false;
+
+                entry = it->second;
+                return true;
+            }
+
+            void DeploymentManifest::update(const ManifestEntry& entry) {
+                if (!PrivateData::isRepresentable(entry.destination.string()) || !PrivateData::isRepresentable(entry.source.string())
+                    || !PrivateData::isRepresentable(entry.rpath)) {
+                    ldLog() << LD_DEBUG << "Can't record file in deployment manifest:" << entry.destination << std::endl;
+                    remove(entry.destination);
+                    return;
+                }
+
+                d->entries[entry.destination.string()] = entry;
+            }
+
+            void DeploymentManifest::remove(const bf::path& destination) {
+                d->entries.erase(destination.string());
+            }
+        }
+    }
+}
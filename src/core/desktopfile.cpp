@@ -1,9 +1,19 @@
-// library headers
-#include <INI.h>
+// system includes
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <memory>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
 
 // local headers
 #include "linuxdeploy/core/desktopfile.h"
 #include "linuxdeploy/core/log.h"
+#include "linuxdeploy/core/trace.h"
 
 using namespace linuxdeploy::core;
 using namespace linuxdeploy::core::log;
@@ -14,12 +24,390 @@ namespace linuxdeploy {
     namespace core {
         namespace desktopfile {
             class DesktopFile::PrivateData {
+                public:
+                    // reference to a string in the storage, saves copying the file's contents
+                    struct StringRef {
+                        const char* data;
+                        size_t size;
+
+                        StringRef() : data(nullptr), size(0) {}
+                        StringRef(const char* data, size_t size) : data(data), size(size) {}
+                        explicit StringRef(const std::string& s) : data(s.data()), size(s.size()) {}
+
+                        std::string str() const {
+                            return std::string(data, size);
+                        }
+
+                        bool operator==(const StringRef& other) const {
+                            return size == other.size && (size == 0 || memcmp(data, other.data, size) == 0);
+                        }
+                    };
+
+                    // FNV-1a
+                    struct StringRefHash {
+                        size_t operator()(const StringRef& s) const {
+                            uint64_t hash = 14695981039346656037ull;
+
+                            for (size_t i = 0; i < s.size; i++) {
+                                hash ^= static_cast<unsigned char>(s.data[i]);
+                                hash *= 1099511628211ull;
+                            }
+
+                            return static_cast<size_t>(hash);
+                        }
+                    };
+
+                    // memory all string references point to, i.e., the mapped file and the strings added by modifications
+                    // neither is modified once it's been added, therefore the storage can be shared between copies
+                    struct Storage {
+                        char* mapping;
+                        size_t mappingSize;
+
+                        // a deque never moves its elements, unlike a vector
+                        std::deque<std::string> strings;
+
+                        Storage() : mapping(nullptr), mappingSize(0) {}
+
+                        ~Storage() {
+                            if (mapping != nullptr)
+                                munmap(mapping, mappingSize);
+                        }
+
+                        Storage(const Storage&) = delete;
+                        Storage& operator=(const Storage&) = delete;
+
+                        StringRef add(const std::string& s) {
+                            strings.push_back(s);
+                            return StringRef(strings.back());
+                        }
+                    };
+
+                    enum LineType {
+                        // comments, blank lines, and anything else which isn't interpreted
+                        LINE_OTHER,
+                        LINE_GROUP,
+                        LINE_ENTRY,
+                    };
+
+                    struct Line {
+                        LineType type;
+
+                        // line as found in the file, without the line break
+                        // modified lines are generated from name/key and value when saving the file instead
+                        StringRef raw;
+                        bool modified;
+
+                        // group name for group headers, key for entries
+                        StringRef key;
+                        StringRef value;
+                    };
+
+                    struct Group {
+                        // lines in order, starting with the group header
+                        std::vector<Line> lines;
+                    };
+
+                    struct EntryLocation {
+                        size_t group;
+                        size_t line;
+                    };
+
+                    // entries of a group, keyed by key including the locale, e.g., Name[de]
+                    // a group's entries are added to the group which has been found first, duplicates are merged
+                    struct GroupIndex {
+                        size_t group;
+                        std::unordered_map<StringRef, EntryLocation, StringRefHash> entries;
+                    };
+
                 public:
                     bf::path path;
-                    INI<> ini;
+
+                    std::shared_ptr<Storage> storage;
+
+                    // lines before the first group header, usually comments
+                    std::vector<Line> leadingLines;
+                    std::vector<Group> groups;
+                    std::unordered_map<StringRef, GroupIndex, StringRefHash> groupIndex;
+
+                    bool finalNewline;
+
+                public:
+                    PrivateData() : path(), storage(std::make_shared<Storage>()), finalNewline(true) {};
 
                 public:
-                    PrivateData() : path(), ini("", false) {};
+                    void clear() {
+                        storage = std::make_shared<Storage>();
+                        leadingLines.clear();
+                        groups.clear();
+                        groupIndex.clear();
+                        finalNewline = true;
+                    }
+
+                    static bool isBlank(char c) {
+                        return c == ' ' || c == '\t';
+                    }
+
+                    void addGroup(const Line& header) {
+                        groups.push_back(Group());
+                        groups.back().lines.push_back(header);
+
+                        GroupIndex index;
+                        index.group = groups.size() - 1;
+                        groupIndex.emplace(header.key, index);
+                    }
+
+                    void parseLine(const StringRef& raw) {
+                        const char* begin = raw.data;
+                        const char* end = raw.data + raw.size;
+
+                        if (end > begin && end[-1] == '\r')
+                            end--;
+
+                        while (begin < end && isBlank(*begin))
+                            begin++;
+
+                        Line line = {LINE_OTHER, raw, false, StringRef(), StringRef()};
+
+                        if (begin < end && *begin == '[') {
+                            const auto* close = static_cast<const char*>(memchr(begin, ']', end - begin));
+
+                            if (close != nullptr) {
+                                line.type = LINE_GROUP;
+                                line.key = StringRef(begin + 1, close - begin - 1);
+                                addGroup(line);
+                                return;
+                            }
+                        } else if (begin < end && *begin != '#' && !groups.empty()) {
+                            const auto* separator = static_cast<const char*>(memchr(begin, '=', end - begin));
+
+                            if (separator != nullptr) {
+                                // whitespace around the separator is permitted and not part of key or value
+                                const char* keyEnd = separator;
+                                while (keyEnd > begin && isBlank(keyEnd[-1]))
+                                    keyEnd--;
+
+                                const char* valueBegin = separator + 1;
+                                while (valueBegin < end && isBlank(*valueBegin))
+                                    valueBegin++;
+
+                                line.type = LINE_ENTRY;
+                                line.key = StringRef(begin, keyEnd - begin);
+                                line.value = StringRef(valueBegin, end - valueBegin);
+
+                                auto& group = groups.back();
+                                group.lines.push_back(line);
+
+                                // later occurrences of a key take precedence over earlier ones
+                                const EntryLocation location = {groups.size() - 1, group.lines.size() - 1};
+                                groupIndex[group.lines.front().key].entries[line.key] = location;
+                                return;
+                            }
+                        }
+
+                        if (groups.empty())
+                            leadingLines.push_back(line);
+                        else
+                            groups.back().lines.push_back(line);
+                    }
+
+                    void parse(const char* data, size_t size) {
+                        const char* current = data;
+                        const char* end = data + size;
+
+                        while (current < end) {
+                            const auto* lineBreak = static_cast<const char*>(memchr(current, '\n', end - current));
+                            const char* lineEnd = lineBreak != nullptr ? lineBreak : end;
+
+                            parseLine(StringRef(current, lineEnd - current));
+
+                            current = lineBreak != nullptr ? lineBreak + 1 : end;
+                        }
+
+                        finalNewline = size == 0 || data[size - 1] == '\n';
+                    }
+
+                    bool read(const bf::path& path) {
+                        trace::Span span("parse desktop file", path);
+
+                        clear();
+
+                        const auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+                        if (fd < 0) {
+                            // nothing to do
+                            return errno == ENOENT;
+                        }
+
+                        struct stat st;
+
+                        if (fstat(fd, &st) != 0) {
+                            close(fd);
+                            return false;
+                        }
+
+                        // empty files can't be mapped
+                        if (st.st_size > 0) {
+                            void* mapping = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+
+                            if (mapping == MAP_FAILED) {
+                                close(fd);
+                                return false;
+                            }
+
+                            storage->mapping = static_cast<char*>(mapping);
+                            storage->mappingSize = static_cast<size_t>(st.st_size);
+                        }
+
+                        close(fd);
+
+                        parse(storage->mapping, storage->mappingSize);
+                        return true;
+                    }
+
+                    const Line* findEntry(const std::string& section, const std::string& key) const {
+                        auto group = groupIndex.find(StringRef(section));
+
+                        if (group == groupIndex.end())
+                            return nullptr;
+
+                        auto entry = group->second.entries.find(StringRef(key));
+
+                        if (entry == group->second.entries.end())
+                            return nullptr;
+
+                        return &groups[entry->second.group].lines[entry->second.line];
+                    }
+
+                    bool setEntry(const std::string& section, const std::string& key, const std::string& value) {
+                        auto group = groupIndex.find(StringRef(section));
+
+                        if (group == groupIndex.end()) {
+                            // separate new groups from existing contents by a blank line
+                            if (!groups.empty())
+                                groups.back().lines.push_back({LINE_OTHER, StringRef(), false, StringRef(), StringRef()});
+                            else if (!leadingLines.empty())
+                                leadingLines.push_back({LINE_OTHER, StringRef(), false, StringRef(), StringRef()});
+
+                            addGroup({LINE_GROUP, StringRef(), true, storage->add(section), StringRef()});
+                            group = groupIndex.find(StringRef(section));
+                        }
+
+                        auto entry = group->second.entries.find(StringRef(key));
+
+                        if (entry != group->second.entries.end()) {
+                            auto& line = groups[entry->second.group].lines[entry->second.line];
+                            line.value = storage->add(value);
+                            line.modified = true;
+                            return true;
+                        }
+
+                        // new entries are added after the group's last entry, not after blank lines separating it from
+                        // the next group
+                        auto& lines = groups[group->second.group].lines;
+                        auto position = lines.size();
+
+                        while (position > 1 && lines[position - 1].type == LINE_OTHER && isBlankLine(lines[position - 1].raw))
+                            position--;
+
+                        const auto keyRef = storage->add(key);
+                        lines.insert(lines.begin() + position, {LINE_ENTRY, StringRef(), true, keyRef, storage->add(value)});
+
+                        // only blank lines follow the inserted line, therefore no other locations need to be updated
+                        const EntryLocation location = {group->second.group, position};
+                        group->second.entries[keyRef] = location;
+
+                        return false;
+                    }
+
+                    static bool isBlankLine(const StringRef& raw) {
+                        for (size_t i = 0; i < raw.size; i++) {
+                            if (!isBlank(raw.data[i]) && raw.data[i] != '\r')
+                                return false;
+                        }
+
+                        return true;
+                    }
+
+                    static void appendLine(std::string& out, const Line& line) {
+                        if (!line.modified) {
+                            out.append(line.raw.data, line.raw.size);
+                        } else if (line.type == LINE_GROUP) {
+                            out += '[';
+                            out.append(line.key.data, line.key.size);
+                            out += ']';
+                        } else {
+                            out.append(line.key.data, line.key.size);
+                            out += '=';
+                            out.append(line.value.data, line.value.size);
+                        }
+
+                        out += '\n';
+                    }
+
+                    std::string serialize() const {
+                        std::string out;
+                        out.reserve(storage->mappingSize + 256);
+
+                        for (const auto& line : leadingLines)
+                            appendLine(out, line);
+
+                        for (const auto& group : groups) {
+                            for (const auto& line : group.lines)
+                                appendLine(out, line);
+                        }
+
+                        if (!finalNewline && !out.empty())
+                            out.pop_back();
+
+                        return out;
+                    }
+
+                    // write to temporary file which then replaces the target, so that readers never see partial files
+                    // this also keeps the current mapping valid if the file is saved to the path it was read from
+                    bool save(const bf::path& path) const {
+                        const auto contents = serialize();
+
+                        std::string tempPath = path.string() + ".XXXXXX";
+                        const auto fd = mkstemp(&tempPath[0]);
+
+                        if (fd < 0) {
+                            ldLog() << LD_ERROR << "Failed to create temporary file for desktop file" << path << LD_NO_SPACE << ":" << strerror(errno) << std::endl;
+                            return false;
+                        }
+
+                        // retain the permissions of the file that's replaced
+                        struct stat st;
+                        const mode_t mode = stat(path.c_str(), &st) == 0 ? (st.st_mode & 07777) : 0644;
+
+                        bool success = fchmod(fd, mode) == 0;
+
+                        for (size_t written = 0; success && written < contents.size();) {
+                            const auto rv = write(fd, contents.data() + written, contents.size() - written);
+
+                            if (rv < 0) {
+                                if (errno == EINTR)
+                                    continue;
+
+                                success = false;
+                                break;
+                            }
+
+                            written += static_cast<size_t>(rv);
+                        }
+
+                        if (close(fd) != 0)
+                            success = false;
+
+                        if (success && rename(tempPath.c_str(), path.c_str()) != 0)
+                            success = false;
+
+                        if (!success) {
+                            ldLog() << LD_ERROR << "Failed to write desktop file" << path << LD_NO_SPACE << ":" << strerror(errno) << std::endl;
+                            unlink(tempPath.c_str());
+                        }
+
+                        return success;
+                    }
             };
 
             DesktopFile::DesktopFile() {
@@ -31,21 +419,26 @@ namespace linuxdeploy {
                     throw std::runtime_error("Failed to read desktop file");
             };
 
-            bool DesktopFile::read(const boost::filesystem::path& path) {
-                setPath(path);
+            DesktopFile::DesktopFile(const DesktopFile& other) {
+                // the storage is shared, the lines are copied
+                d = new PrivateData(*other.d);
+            }
 
-                clear();
+            DesktopFile& DesktopFile::operator=(const DesktopFile& other) {
+                if (this != &other)
+                    *d = *other.d;
 
-                // nothing to do
-                if (!bf::exists(path))
-                    return true;
+                return *this;
+            }
 
-                std::ifstream ifs(path.string());
-                if (!ifs)
-                    return false;
+            DesktopFile::~DesktopFile() {
+                delete d;
+            }
 
-                d->ini.parse(ifs);
-                return true;
+            bool DesktopFile::read(const boost::filesystem::path& path) {
+                setPath(path);
+
+                return d->read(path);
             }
 
             boost::filesystem::path DesktopFile::path() const {
@@ -57,7 +450,7 @@ namespace linuxdeploy {
             }
 
             void DesktopFile::clear() {
-                d->ini.clear();
+                d->clear();
             }
 
             bool DesktopFile::save() const {
@@ -65,41 +458,61 @@ namespace linuxdeploy {
             }
 
             bool DesktopFile::save(const boost::filesystem::path& path) const {
-                return d->ini.save(path.string());
+                return d->save(path);
             }
 
             bool DesktopFile::entryExists(const std::string& section, const std::string& key) const {
-                if (!d->ini.select(section))
-                    return false;
-
-                std::string absolutelyUnlikeValue = "<>!§$%&/()=?+'#-.,_:;'*¹²³½¬{[]}^°|";
-
-                auto value =  d->ini.get<std::string, std::string, std::string>(section, key, absolutelyUnlikeValue);
-
-                return value != absolutelyUnlikeValue;
+                return d->findEntry(section, key) != nullptr;
             }
 
             bool DesktopFile::setEntry(const std::string& section, const std::string& key, const std::string& value) {
-                // check if value exists -- used for return value
-                auto rv = entryExists(section, key);
-
-                // set key
-                d->ini[section][key] = value;
-
-                return rv;
+                return d->setEntry(section, key, value);
             }
 
             bool DesktopFile::getEntry(const std::string& section, const std::string& key, std::string& value) const {
-                if (!entryExists(section, key))
-                    return false;
+                const auto* line = d->findEntry(section, key);
 
-                if (!d->ini.select(section))
+                if (line == nullptr)
                     return false;
 
-                value = d->ini.get(key);
+                value = line->value.str();
                 return true;
             }
 
+            bool DesktopFile::getLocalizedEntry(const std::string& section, const std::string& key, const std::string& locale, std::string& value) const {
+                // locales have the form lang_COUNTRY.ENCODING@MODIFIER, the encoding is ignored
+                auto modifierPos = locale.find('@');
+                const auto modifier = modifierPos != std::string::npos ? locale.substr(modifierPos) : "";
+
+                auto langCountry = locale.substr(0, std::min(locale.find('.'), modifierPos));
+
+                const auto countryPos = langCountry.find('_');
+                const auto lang = langCountry.substr(0, countryPos);
+
+                // order of preference as defined by the desktop entry specification
+                std::vector<std::string> candidates;
+
+                if (countryPos != std::string::npos) {
+                    if (!modifier.empty())
+                        candidates.push_back(langCountry + modifier);
+
+                    candidates.push_back(langCountry);
+                }
+
+                if (!modifier.empty())
+                    candidates.push_back(lang + modifier);
+
+                if (!lang.empty())
+                    candidates.push_back(lang);
+
+                for (const auto& candidate : candidates) {
+                    if (getEntry(section, key + "[" + candidate + "]", value))
+                        return true;
+                }
+
+                return getEntry(section, key, value);
+            }
+
             bool DesktopFile::addDefaultKeys(const std::string& executableFileName) {
                 auto rv = true;
 
@@ -125,6 +538,3 @@ namespace linuxdeploy {
         }
     }
 }
-
-
-
@@ -1,10 +1,24 @@
+// system includes
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <elf.h>
+#include <fcntl.h>
+#include <memory>
+#include <set>
+#include <sys/stat.h>
+#include <unistd.h>
+
 // library includes
 #include <boost/regex.hpp>
 #include <subprocess.hpp>
 
 // local headers
 #include "linuxdeploy/core/elf.h"
+#include "linuxdeploy/core/elfcache.h"
+#include "linuxdeploy/core/ldcache.h"
 #include "linuxdeploy/core/log.h"
+#include "linuxdeploy/core/trace.h"
 #include "linuxdeploy/core/util.h"
 
 using namespace linuxdeploy::core::log;
@@ -14,14 +28,1198 @@ namespace bf = boost::filesystem;
 namespace linuxdeploy {
     namespace core {
         namespace elf {
+            // read exactly size bytes from given offset, handling short reads
+            static bool readAt(int fd, void* buf, size_t size, off_t offset) {
+                auto* p = static_cast<char*>(buf);
+
+                while (size > 0) {
+                    auto rv = pread(fd, p, size, offset);
+
+                    if (rv < 0 && errno == EINTR)
+                        continue;
+
+                    if (rv <= 0)
+                        return false;
+
+                    p += rv;
+                    size -= rv;
+                    offset += rv;
+                }
+
+                return true;
+            }
+
+            // write all of data at the given offset, handling short writes
+            static bool writeAt(int fd, const void* data, size_t size, off_t offset) {
+                const auto* p = static_cast<const char*>(data);
+
+                while (size > 0) {
+                    auto rv = pwrite(fd, p, size, offset);
+
+                    if (rv < 0 && errno == EINTR)
+                        continue;
+
+                    if (rv <= 0)
+                        return false;
+
+                    p += rv;
+                    size -= rv;
+                    offset += rv;
+                }
+
+                return true;
+            }
+
+            // copy a range of data from one file to another
+            static bool copyAt(int in, off_t inOffset, int out, off_t outOffset, uint64_t size) {
+                std::vector<char> buffer(std::min<uint64_t>(size, 1024 * 1024));
+
+                while (size > 0) {
+                    const auto chunkSize = std::min<uint64_t>(size, buffer.size());
+
+                    if (!readAt(in, buffer.data(), chunkSize, inOffset) || !writeAt(out, buffer.data(), chunkSize, outOffset))
+                        return false;
+
+                    inOffset += chunkSize;
+                    outOffset += chunkSize;
+                    size -= chunkSize;
+                }
+
+                return true;
+            }
+
+            bool applyPatches(int fd, const std::vector<FilePatch>& patches) {
+                for (const auto& patch : patches) {
+                    if (!writeAt(fd, patch.data.data(), patch.data.size(), static_cast<off_t>(patch.offset)))
+                        return false;
+                }
+
+                return true;
+            }
+
+            // sections which only contain information for debuggers
+            static bool isDebugSection(const std::string& name) {
+                return name.compare(0, 6, ".debug") == 0 || name.compare(0, 7, ".zdebug") == 0 || name == ".gdb_index"
+                    || name == ".stab" || name == ".stabstr";
+            }
+
+            static uint64_t alignUp(uint64_t value, uint64_t alignment) {
+                return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value;
+            }
+
+            static std::vector<std::string> defaultLibraryDirectories(uint8_t elfClass) {
+                if (elfClass == ELFCLASS64) {
+                    return {"/lib64", "/usr/lib64", "/lib/x86_64-linux-gnu", "/usr/lib/x86_64-linux-gnu",
+                            "/lib/aarch64-linux-gnu", "/usr/lib/aarch64-linux-gnu", "/lib", "/usr/lib"};
+                }
+
+                return {"/lib", "/usr/lib", "/lib/i386-linux-gnu", "/usr/lib/i386-linux-gnu",
+                        "/lib/arm-linux-gnueabihf", "/usr/lib/arm-linux-gnueabihf", "/lib32", "/usr/lib32"};
+            }
+
+            // expand dynamic string tokens supported by the dynamic loader in a search path
+            static std::string expandDynamicStringTokens(const std::string& value, const bf::path& origin, uint8_t elfClass) {
+                std::string result = value;
+
+                auto replaceAll = [&result](const std::string& token, const std::string& replacement) {
+                    for (size_t pos; (pos = result.find(token)) != std::string::npos;)
+                        result.replace(pos, token.size(), replacement);
+                };
+
+                replaceAll("${ORIGIN}", origin.string());
+                replaceAll("$ORIGIN", origin.string());
+                replaceAll("${LIB}", elfClass == ELFCLASS64 ? "lib64" : "lib");
+                replaceAll("$LIB", elfClass == ELFCLASS64 ? "lib64" : "lib");
+
+                return result;
+            }
+
             class ElfFile::PrivateData {
                 public:
                     const bf::path path;
 
+                    // information read from the ELF and program headers and the dynamic section
+                    // populated lazily by readElfHeaders()
+                    bool headersRead = false;
+                    bool isElf = false;
+                    bool isDynamic = false;
+                    uint8_t elfClass = ELFCLASSNONE;
+                    uint8_t elfData = ELFDATANONE;
+                    uint16_t elfMachine = EM_NONE;
+                    std::string interpreter;
+                    std::string soname;
+                    std::vector<std::string> neededLibraries;
+                    bool hasRPath = false;
+                    bool hasRunPath = false;
+                    std::string rpath;
+                    std::string runpath;
+
+                    // identity of the file at the time the headers have been read, used for the persistent cache
+                    bool identityKnown = false;
+                    elfcache::FileIdentity identity = {};
+
+                public:
+                    static bool useLdd;
+
+                public:
+                    // libraries don't have an interpreter, but might depend on the dynamic loader, which is identified by its
+                    // name then
+                    static bool isDynamicLoader(const std::string& name) {
+                        return name.compare(0, 8, "ld-linux") == 0 || name.compare(0, 7, "ld64.so") == 0 || name == "ld.so.1";
+                    }
+
+                    // find library for DT_NEEDED entry of the given object, following the dynamic loader's search order
+                    // the inherited rpaths are the DT_RPATH entries of the objects which caused the object to be loaded,
+                    // up to the main object, see rpathsForDependencies()
+                    // see ld.so(8) for more information
+                    static bool findLibrary(PrivateData* object, const std::vector<InheritedRPath>& inheritedRPaths,
+                                            const std::string& name, bf::path& result) {
+                        // lookups are shared between all files traced in this process
+                        auto& libraryIndex = ldcache::LibraryIndex::getInstance();
+
+                        const auto origin = bf::absolute(object->path).parent_path();
+
+                        auto searchDirectories = [&libraryIndex, object, &name, &result](const std::string& searchPath, const bf::path& origin) {
+                            for (const auto& directory : util::split(searchPath, ':')) {
+                                // empty entries refer to the current working directory
+                                auto expanded = expandDynamicStringTokens(directory.empty() ? "." : directory, origin, object->elfClass);
+
+                                if (libraryIndex.findInDirectory(expanded, name, object->elfClass, object->elfMachine, result))
+                                    return true;
+                            }
+
+                            return false;
+                        };
+
+                        // names containing a slash are used as paths directly
+                        if (name.find('/') != std::string::npos) {
+                            result = expandDynamicStringTokens(name, origin, object->elfClass);
+                            return libraryIndex.isCompatible(result, object->elfClass, object->elfMachine);
+                        }
+
+                        // DT_RPATH is only used if the object doesn't have a DT_RUNPATH entry
+                        // in that case, the DT_RPATH entries of the object, the objects that caused it to be loaded and the
+                        // main executable are searched
+                        if (!object->hasRunPath) {
+                            for (const auto& entry : object->rpathsForDependencies(inheritedRPaths)) {
+                                if (searchDirectories(entry.rpath, entry.origin))
+                                    return true;
+                            }
+                        }
+
+                        static const auto ldLibraryPath = getenv("LD_LIBRARY_PATH") == nullptr ? "" : std::string(getenv("LD_LIBRARY_PATH"));
+
+                        if (!ldLibraryPath.empty() && searchDirectories(ldLibraryPath, origin))
+                            return true;
+
+                        if (object->hasRunPath && searchDirectories(object->runpath, origin))
+                            return true;
+
+                        if (libraryIndex.findInCache(name, object->elfClass, object->elfMachine, result))
+                            return true;
+
+                        for (const auto& directory : defaultLibraryDirectories(object->elfClass)) {
+                            if (libraryIndex.findInDirectory(directory, name, object->elfClass, object->elfMachine, result))
+                                return true;
+                        }
+
+                        return false;
+                    }
+
                 public:
                     explicit PrivateData(const bf::path& path) : path(path) {}
+
+                public:
+                    // DT_RPATH entries searched for the dependencies of this object: its own one, unless it has a
+                    // DT_RUNPATH entry, followed by the ones it inherits from the objects that caused it to be loaded
+                    std::vector<InheritedRPath> rpathsForDependencies(const std::vector<InheritedRPath>& inheritedRPaths) const {
+                        std::vector<InheritedRPath> rpaths;
+
+                        if (hasRPath && !hasRunPath)
+                            rpaths.push_back({rpath, bf::absolute(path).parent_path()});
+
+                        rpaths.insert(rpaths.end(), inheritedRPaths.begin(), inheritedRPaths.end());
+                        return rpaths;
+                    }
+
+                public:
+                    // convert value read from the file to host byte order
+                    // the conversion is symmetric, therefore it's also used to convert values before writing them
+                    template<typename T> T toHost(T value) const {
+                        static const uint16_t probe = 1;
+                        static const uint8_t hostData = *reinterpret_cast<const uint8_t*>(&probe) == 1 ? ELFDATA2LSB : ELFDATA2MSB;
+
+                        if (elfData == hostData)
+                            return value;
+
+                        auto* bytes = reinterpret_cast<uint8_t*>(&value);
+                        std::reverse(bytes, bytes + sizeof(T));
+                        return value;
+                    }
+
+                    template<typename Ehdr, typename Phdr, typename Dyn> bool readDynamicSection(int fd) {
+                        Ehdr ehdr;
+                        if (!readAt(fd, &ehdr, sizeof(ehdr), 0))
+                            return false;
+
+                        elfMachine = toHost(ehdr.e_machine);
+
+                        const auto phoff = toHost(ehdr.e_phoff);
+                        const auto phnum = toHost(ehdr.e_phnum);
+
+                        if (toHost(ehdr.e_phentsize) != sizeof(Phdr))
+                            return phnum == 0;
+
+                        std::vector<Phdr> phdrs(phnum);
+                        if (phnum > 0 && !readAt(fd, phdrs.data(), phnum * sizeof(Phdr), phoff))
+                            return false;
+
+                        const Phdr* dynamicPhdr = nullptr;
+
+                        for (const auto& phdr : phdrs) {
+                            switch (toHost(phdr.p_type)) {
+                                case PT_DYNAMIC:
+                                    dynamicPhdr = &phdr;
+                                    break;
+                                case PT_INTERP: {
+                                    std::vector<char> buf(toHost(phdr.p_filesz) + 1, '\0');
+                                    if (!readAt(fd, buf.data(), buf.size() - 1, toHost(phdr.p_offset)))
+                                        return false;
+                                    interpreter = buf.data();
+                                    break;
+                                }
+                                default:
+                                    break;
+                            }
+                        }
+
+                        // statically linked files don't have any dependencies
+                        if (dynamicPhdr == nullptr)
+                            return true;
+
+                        isDynamic = true;
+
+                        std::vector<Dyn> dyns(toHost(dynamicPhdr->p_filesz) / sizeof(Dyn));
+                        if (!readAt(fd, dyns.data(), dyns.size() * sizeof(Dyn), toHost(dynamicPhdr->p_offset)))
+                            return false;
+
+                        uint64_t strtabAddr = 0, strtabSize = 0;
+                        std::vector<uint64_t> neededOffsets;
+                        int64_t sonameOffset = -1, rpathOffset = -1, runpathOffset = -1;
+
+                        for (const auto& dyn : dyns) {
+                            const auto tag = toHost(dyn.d_tag);
+                            const auto val = toHost(dyn.d_un.d_val);
+
+                            if (tag == DT_NULL)
+                                break;
+
+                            switch (tag) {
+                                case DT_STRTAB:
+                                    strtabAddr = val;
+                                    break;
+                                case DT_STRSZ:
+                                    strtabSize = val;
+                                    break;
+                                case DT_NEEDED:
+                                    neededOffsets.push_back(val);
+                                    break;
+                                case DT_SONAME:
+                                    sonameOffset = val;
+                                    break;
+                                case DT_RPATH:
+                                    rpathOffset = val;
+                                    break;
+                                case DT_RUNPATH:
+                                    runpathOffset = val;
+                                    break;
+                                default:
+                                    break;
+                            }
+                        }
+
+                        // the string table is referenced by its virtual address, which needs to be mapped to a file offset
+                        // using the loadable segment it is contained in
+                        int64_t strtabOffset = -1;
+                        for (const auto& phdr : phdrs) {
+                            if (toHost(phdr.p_type) != PT_LOAD)
+                                continue;
+
+                            const uint64_t vaddr = toHost(phdr.p_vaddr);
+                            if (strtabAddr >= vaddr && strtabAddr < vaddr + toHost(phdr.p_filesz)) {
+                                strtabOffset = strtabAddr - vaddr + toHost(phdr.p_offset);
+                                break;
+                            }
+                        }
+
+                        if (strtabOffset < 0 || strtabSize == 0)
+                            return false;
+
+                        std::vector<char> strtab(strtabSize + 1, '\0');
+                        if (!readAt(fd, strtab.data(), strtabSize, strtabOffset))
+                            return false;
+
+                        auto getString = [&strtab, strtabSize](uint64_t offset) {
+                            if (offset >= strtabSize)
+                                return std::string();
+                            return std::string(strtab.data() + offset);
+                        };
+
+                        for (const auto offset : neededOffsets)
+                            neededLibraries.push_back(getString(offset));
+
+                        if (sonameOffset >= 0)
+                            soname = getString(sonameOffset);
+
+                        if ((hasRPath = rpathOffset >= 0))
+                            rpath = getString(rpathOffset);
+
+                        if ((hasRunPath = runpathOffset >= 0))
+                            runpath = getString(runpathOffset);
+
+                        return true;
+                    }
+
+                    // read ELF header, program headers and dynamic section
+                    // returns false if the file is not a valid ELF file
+                    bool readElfHeaders() {
+                        if (headersRead)
+                            return isElf;
+
+                        headersRead = true;
+
+                        isElf = isDynamic = hasRPath = hasRunPath = false;
+                        interpreter.clear();
+                        soname.clear();
+                        neededLibraries.clear();
+                        rpath.clear();
+                        runpath.clear();
+
+                        auto& elfCache = elfcache::ElfCache::getInstance();
+                        identityKnown = elfCache.isEnabled() && elfcache::identify(path, identity);
+
+                        elfcache::ElfInfo info;
+
+                        if (identityKnown && elfCache.findInfo(identity, info)) {
+                            fromInfo(info);
+                            return isElf;
+                        }
+
+                        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+                        if (fd < 0)
+                            return false;
+
+                        unsigned char ident[EI_NIDENT];
+
+                        if (!readAt(fd, ident, sizeof(ident), 0) || memcmp(ident, ELFMAG, SELFMAG) != 0) {
+                            close(fd);
+                            return false;
+                        }
+
+                        elfClass = ident[EI_CLASS];
+                        elfData = ident[EI_DATA];
+
+                        switch (elfClass) {
+                            case ELFCLASS32:
+                                isElf = readDynamicSection<Elf32_Ehdr, Elf32_Phdr, Elf32_Dyn>(fd);
+                                break;
+                            case ELFCLASS64:
+                                isElf = readDynamicSection<Elf64_Ehdr, Elf64_Phdr, Elf64_Dyn>(fd);
+                                break;
+                            default:
+                                isElf = false;
+                                break;
+                        }
+
+                        close(fd);
+
+                        // files which aren't ELF files are cached, too, as they're probed just as often
+                        if (identityKnown)
+                            elfCache.storeInfo(identity, toInfo());
+
+                        return isElf;
+                    }
+
+                    elfcache::ElfInfo toInfo() const {
+                        return {isElf, isDynamic, elfClass, elfData, elfMachine, interpreter, soname, neededLibraries,
+                                hasRPath, hasRunPath, rpath, runpath};
+                    }
+
+                    void fromInfo(const elfcache::ElfInfo& info) {
+                        isElf = info.isElf;
+                        isDynamic = info.isDynamic;
+                        elfClass = info.elfClass;
+                        elfData = info.elfData;
+                        elfMachine = info.elfMachine;
+                        interpreter = info.interpreter;
+                        soname = info.soname;
+                        neededLibraries = info.neededLibraries;
+                        hasRPath = info.hasRPath;
+                        hasRunPath = info.hasRunPath;
+                        rpath = info.rpath;
+                        runpath = info.runpath;
+                    }
+
+                public:
+                    template<typename T> static FilePatch makePatch(uint64_t offset, const T& value) {
+                        return {offset, std::string(reinterpret_cast<const char*>(&value), sizeof(T))};
+                    }
+
+                    template<typename T> static FilePatch makePatch(uint64_t offset, const std::vector<T>& values) {
+                        return {offset, std::string(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T))};
+                    }
+
+                    // set field to value, converting it to the file's byte order
+                    template<typename T, typename V> void setField(T& field, V value) const {
+                        field = toHost(static_cast<T>(value));
+                    }
+
+                    // collect the offsets of all strings in the dynamic string table which are referenced by the dynamic
+                    // section (except for the entries in ignoredEntries), the dynamic symbol table and the symbol
+                    // versioning sections
+                    // returns false if the references cannot be determined reliably
+                    template<typename Ehdr, typename Shdr, typename Dyn, typename Sym>
+                    bool collectStringReferences(int fd, const Ehdr& ehdr, const std::vector<Dyn>& dyns,
+                                                 const std::set<size_t>& ignoredEntries, std::set<uint64_t>& references) {
+                        for (size_t i = 0; i < dyns.size(); i++) {
+                            if (ignoredEntries.find(i) != ignoredEntries.end())
+                                continue;
+
+                            switch (toHost(dyns[i].d_tag)) {
+                                case DT_NEEDED:
+                                case DT_SONAME:
+                                case DT_RPATH:
+                                case DT_RUNPATH:
+                                case DT_AUXILIARY:
+                                case DT_FILTER:
+                                case DT_CONFIG:
+                                case DT_DEPAUDIT:
+                                case DT_AUDIT:
+                                    references.insert(toHost(dyns[i].d_un.d_val));
+                                    break;
+                                default:
+                                    break;
+                            }
+                        }
+
+                        const uint64_t shoff = toHost(ehdr.e_shoff);
+                        const auto shnum = toHost(ehdr.e_shnum);
+
+                        // without section headers, the symbol tables cannot be located
+                        if (shoff == 0 || shnum == 0 || toHost(ehdr.e_shentsize) != sizeof(Shdr))
+                            return false;
+
+                        std::vector<Shdr> shdrs(shnum);
+                        if (!readAt(fd, shdrs.data(), shnum * sizeof(Shdr), shoff))
+                            return false;
+
+                        for (const auto& shdr : shdrs) {
+                            const auto type = toHost(shdr.sh_type);
+
+                            if (type != SHT_DYNSYM && type != SHT_GNU_verneed && type != SHT_GNU_verdef)
+                                continue;
+
+                            std::vector<char> data(toHost(shdr.sh_size));
+                            if (!readAt(fd, data.data(), data.size(), toHost(shdr.sh_offset)))
+                                return false;
+
+                            // reads a structure from the section, returns false if it's out of bounds
+                            auto readStruct = [&data](uint64_t offset, void* out, size_t size) {
+                                if (offset + size > data.size())
+                                    return false;
+                                memcpy(out, data.data() + offset, size);
+                                return true;
+                            };
+
+                            if (type == SHT_DYNSYM) {
+                                for (size_t offset = 0; offset + sizeof(Sym) <= data.size(); offset += sizeof(Sym)) {
+                                    Sym sym;
+                                    readStruct(offset, &sym, sizeof(sym));
+                                    references.insert(toHost(sym.st_name));
+                                }
+                            } else if (type == SHT_GNU_verneed) {
+                                // the versioning structures have the same layout in both ELF classes
+                                for (uint64_t offset = 0;;) {
+                                    Elf64_Verneed verneed;
+                                    if (!readStruct(offset, &verneed, sizeof(verneed)))
+                                        return false;
+
+                                    references.insert(toHost(verneed.vn_file));
+
+                                    for (uint64_t auxOffset = offset + toHost(verneed.vn_aux);;) {
+                                        Elf64_Vernaux vernaux;
+                                        if (!readStruct(auxOffset, &vernaux, sizeof(vernaux)))
+                                            return false;
+
+                                        references.insert(toHost(vernaux.vna_name));
+
+                                        if (toHost(vernaux.vna_next) == 0)
+                                            break;
+                                        auxOffset += toHost(vernaux.vna_next);
+                                    }
+
+                                    if (toHost(verneed.vn_next) == 0)
+                                        break;
+                                    offset += toHost(verneed.vn_next);
+                                }
+                            } else {
+                                for (uint64_t offset = 0;;) {
+                                    Elf64_Verdef verdef;
+                                    if (!readStruct(offset, &verdef, sizeof(verdef)))
+                                        return false;
+
+                                    for (uint64_t auxOffset = offset + toHost(verdef.vd_aux), i = 0; i < toHost(verdef.vd_cnt); i++) {
+                                        Elf64_Verdaux verdaux;
+                                        if (!readStruct(auxOffset, &verdaux, sizeof(verdaux)))
+                                            return false;
+
+                                        references.insert(toHost(verdaux.vda_name));
+                                        auxOffset += toHost(verdaux.vda_next);
+                                    }
+
+                                    if (toHost(verdef.vd_next) == 0)
+                                        break;
+                                    offset += toHost(verdef.vd_next);
+                                }
+                            }
+                        }
+
+                        return true;
+                    }
+
+                    // calculate the modifications required to set the DT_RUNPATH entry to the given value
+                    // like patchelf, an existing DT_RPATH entry is converted into a DT_RUNPATH one
+                    // if the new value fits into the space used by the old one, the string is replaced in place
+                    // otherwise, the dynamic string table (and, if there's no free slot for a new entry, the dynamic section)
+                    // is copied into a new loadable segment appended to the file, which uses the program header entry of an
+                    // unused or note segment
+                    // returns false if the file cannot be modified this way
+                    template<typename Ehdr, typename Phdr, typename Shdr, typename Dyn, typename Sym>
+                    bool planRPathChange(int fd, const std::string& value, std::vector<FilePatch>& patches) {
+                        struct stat st;
+                        if (fstat(fd, &st) != 0)
+                            return false;
+
+                        Ehdr ehdr;
+                        if (!readAt(fd, &ehdr, sizeof(ehdr), 0))
+                            return false;
+
+                        const uint64_t phoff = toHost(ehdr.e_phoff);
+                        const auto phnum = toHost(ehdr.e_phnum);
+
+                        if (phnum == 0 || toHost(ehdr.e_phentsize) != sizeof(Phdr))
+                            return false;
+
+                        std::vector<Phdr> phdrs(phnum);
+                        if (!readAt(fd, phdrs.data(), phnum * sizeof(Phdr), phoff))
+                            return false;
+
+                        auto dynamicPhdr = std::find_if(phdrs.begin(), phdrs.end(), [this](const Phdr& phdr) {
+                            return toHost(phdr.p_type) == PT_DYNAMIC;
+                        });
+
+                        if (dynamicPhdr == phdrs.end())
+                            return false;
+
+                        std::vector<Dyn> dyns(toHost(dynamicPhdr->p_filesz) / sizeof(Dyn));
+                        if (!readAt(fd, dyns.data(), dyns.size() * sizeof(Dyn), toHost(dynamicPhdr->p_offset)))
+                            return false;
+
+                        // find the relevant entries, and the number of entries up to the terminating DT_NULL
+                        size_t usedEntries = dyns.size();
+                        int strtabIndex = -1, strszIndex = -1, rpathIndex = -1, runpathIndex = -1;
+
+                        for (size_t i = 0; i < dyns.size(); i++) {
+                            switch (toHost(dyns[i].d_tag)) {
+                                case DT_NULL:
+                                    usedEntries = i;
+                                    break;
+                                case DT_STRTAB:
+                                    strtabIndex = i;
+                                    break;
+                                case DT_STRSZ:
+                                    strszIndex = i;
+                                    break;
+                                case DT_RPATH:
+                                    rpathIndex = i;
+                                    break;
+                                case DT_RUNPATH:
+                                    runpathIndex = i;
+                                    break;
+                                default:
+                                    continue;
+                            }
+
+                            if (usedEntries != dyns.size())
+                                break;
+                        }
+
+                        if (usedEntries == dyns.size() || strtabIndex < 0 || strszIndex < 0)
+                            return false;
+
+                        // map the string table's address to a file offset
+                        const uint64_t strtabAddr = toHost(dyns[strtabIndex].d_un.d_ptr);
+                        int64_t strtabOffset = -1;
+
+                        for (const auto& phdr : phdrs) {
+                            const uint64_t vaddr = toHost(phdr.p_vaddr);
+
+                            if (toHost(phdr.p_type) == PT_LOAD && strtabAddr >= vaddr && strtabAddr < vaddr + toHost(phdr.p_filesz)) {
+                                strtabOffset = strtabAddr - vaddr + toHost(phdr.p_offset);
+                                break;
+                            }
+                        }
+
+                        if (strtabOffset < 0)
+                            return false;
+
+                        std::string strtab(toHost(dyns[strszIndex].d_un.d_val), '\0');
+                        if (!readAt(fd, &strtab[0], strtab.size(), strtabOffset))
+                            return false;
+
+                        // find a place for the new string
+                        uint64_t stringOffset = 0;
+                        bool stringPlaced = false;
+
+                        const int existingIndex = runpathIndex >= 0 ? runpathIndex : rpathIndex;
+
+                        if (existingIndex >= 0) {
+                            const uint64_t oldOffset = toHost(dyns[existingIndex].d_un.d_val);
+
+                            if (oldOffset < strtab.size()) {
+                                const auto oldLength = strlen(strtab.c_str() + oldOffset);
+
+                                // the linker may merge strings, therefore the old string must not be shared with anything else
+                                // if it's overwritten
+                                // suffix merging makes the old string the tail of a longer one, which can start at any lower
+                                // offset, so the string must not be preceded by anything but the end of another string
+                                std::set<size_t> ignoredEntries;
+                                for (const auto index : {rpathIndex, runpathIndex}) {
+                                    if (index >= 0 && toHost(dyns[index].d_un.d_val) == oldOffset)
+                                        ignoredEntries.insert(index);
+                                }
+
+                                std::set<uint64_t> references;
+
+                                if (value.size() <= oldLength && (oldOffset == 0 || strtab[oldOffset - 1] == '\0') &&
+                                    collectStringReferences<Ehdr, Shdr, Dyn, Sym>(fd, ehdr, dyns, ignoredEntries, references) &&
+                                    references.lower_bound(oldOffset) == references.upper_bound(oldOffset + oldLength)) {
+                                    auto replacement = value;
+                                    replacement.resize(oldLength, '\0');
+
+                                    patches.push_back({strtabOffset + oldOffset, replacement});
+                                    strtab.replace(oldOffset, oldLength, replacement);
+
+                                    stringOffset = oldOffset;
+                                    stringPlaced = true;
+                                }
+                            }
+                        }
+
+                        // the string table might contain the value already, e.g., if the rpath has been set before
+                        if (!stringPlaced) {
+                            auto pos = strtab.find(std::string(value.c_str(), value.size() + 1));
+
+                            if (pos != std::string::npos) {
+                                stringOffset = pos;
+                                stringPlaced = true;
+                            }
+                        }
+
+                        const bool growStringTable = !stringPlaced;
+
+                        if (growStringTable) {
+                            stringOffset = strtab.size();
+                            strtab += value;
+                            strtab.push_back('\0');
+                        }
+
+                        // update the dynamic section
+                        std::vector<Dyn> newDyns(dyns.begin(), dyns.begin() + usedEntries);
+
+                        if (runpathIndex >= 0)
+                            setField(newDyns[runpathIndex].d_un.d_val, stringOffset);
+
+                        if (rpathIndex >= 0) {
+                            setField(newDyns[rpathIndex].d_un.d_val, stringOffset);
+
+                            if (runpathIndex < 0)
+                                setField(newDyns[rpathIndex].d_tag, DT_RUNPATH);
+                        }
+
+                        if (existingIndex < 0) {
+                            Dyn runpathEntry;
+                            setField(runpathEntry.d_tag, DT_RUNPATH);
+                            setField(runpathEntry.d_un.d_val, stringOffset);
+                            newDyns.push_back(runpathEntry);
+                        }
+
+                        // a new entry requires a spare DT_NULL entry, as the last one terminates the section
+                        const bool moveDynamicSection = newDyns.size() >= dyns.size();
+
+                        {
+                            Dyn nullEntry;
+                            setField(nullEntry.d_tag, DT_NULL);
+                            setField(nullEntry.d_un.d_val, 0);
+                            newDyns.resize(moveDynamicSection ? newDyns.size() + 1 : dyns.size(), nullEntry);
+                        }
+
+                        if (!growStringTable && !moveDynamicSection) {
+                            patches.push_back(makePatch(toHost(dynamicPhdr->p_offset), newDyns));
+                            return true;
+                        }
+
+                        // find a program header entry for the new segment
+                        int loadIndex = -1, replacedIndex = -1;
+                        uint64_t alignment = 4096, vaddrEnd = 0;
+
+                        for (size_t i = 0; i < phdrs.size(); i++) {
+                            const auto type = toHost(phdrs[i].p_type);
+
+                            if (type == PT_LOAD) {
+                                loadIndex = i;
+                                alignment = std::max<uint64_t>(alignment, toHost(phdrs[i].p_align));
+                                vaddrEnd = std::max<uint64_t>(vaddrEnd, toHost(phdrs[i].p_vaddr) + toHost(phdrs[i].p_memsz));
+                            } else if (type == PT_NULL || (type == PT_NOTE && (replacedIndex < 0 || toHost(phdrs[replacedIndex].p_type) != PT_NULL))) {
+                                replacedIndex = i;
+                            }
+                        }
+
+                        if (loadIndex < 0 || replacedIndex < 0) {
+                            ldLog() << LD_DEBUG << "No program header entry available for new segment in ELF file" << path << std::endl;
+                            return false;
+                        }
+
+                        // lay out the new segment at the end of the file, keeping file offset and address congruent modulo
+                        // the alignment
+                        const uint64_t segmentOffset = (static_cast<uint64_t>(st.st_size) + sizeof(Dyn) - 1) / sizeof(Dyn) * sizeof(Dyn);
+                        const uint64_t segmentAddr = (vaddrEnd + alignment - 1) / alignment * alignment + segmentOffset % alignment;
+
+                        const uint64_t dynamicSize = moveDynamicSection ? newDyns.size() * sizeof(Dyn) : 0;
+                        const uint64_t newStrtabOffset = growStringTable ? segmentOffset + dynamicSize : strtabOffset;
+                        const uint64_t newStrtabAddr = growStringTable ? segmentAddr + dynamicSize : strtabAddr;
+
+                        if (growStringTable) {
+                            setField(newDyns[strtabIndex].d_un.d_ptr, newStrtabAddr);
+                            setField(newDyns[strszIndex].d_un.d_val, strtab.size());
+                        }
+
+                        std::string segment;
+
+                        if (moveDynamicSection)
+                            segment += makePatch(0, newDyns).data;
+                        else
+                            patches.push_back(makePatch(toHost(dynamicPhdr->p_offset), newDyns));
+
+                        if (growStringTable)
+                            segment += strtab;
+
+                        patches.push_back({segmentOffset, segment});
+
+                        // rebuild the program header table, keeping the loadable segments sorted by address
+                        Phdr newLoad;
+                        memset(&newLoad, 0, sizeof(newLoad));
+                        setField(newLoad.p_type, PT_LOAD);
+                        setField(newLoad.p_flags, moveDynamicSection ? (PF_R | PF_W) : PF_R);
+                        setField(newLoad.p_offset, segmentOffset);
+                        setField(newLoad.p_vaddr, segmentAddr);
+                        setField(newLoad.p_paddr, segmentAddr);
+                        setField(newLoad.p_filesz, segment.size());
+                        setField(newLoad.p_memsz, segment.size());
+                        setField(newLoad.p_align, alignment);
+
+                        std::vector<Phdr> newPhdrs;
+
+                        for (size_t i = 0; i < phdrs.size(); i++) {
+                            if (static_cast<int>(i) != replacedIndex) {
+                                newPhdrs.push_back(phdrs[i]);
+
+                                auto& phdr = newPhdrs.back();
+
+                                if (moveDynamicSection && toHost(phdr.p_type) == PT_DYNAMIC) {
+                                    setField(phdr.p_offset, segmentOffset);
+                                    setField(phdr.p_vaddr, segmentAddr);
+                                    setField(phdr.p_paddr, segmentAddr);
+                                    setField(phdr.p_filesz, dynamicSize);
+                                    setField(phdr.p_memsz, dynamicSize);
+                                }
+                            }
+
+                            if (static_cast<int>(i) == loadIndex)
+                                newPhdrs.push_back(newLoad);
+                        }
+
+                        patches.push_back(makePatch(phoff, newPhdrs));
+
+                        // keep the section headers consistent with the new layout
+                        const uint64_t shoff = toHost(ehdr.e_shoff);
+                        const auto shnum = toHost(ehdr.e_shnum);
+
+                        if (shoff != 0 && shnum != 0 && toHost(ehdr.e_shentsize) == sizeof(Shdr)) {
+                            std::vector<Shdr> shdrs(shnum);
+                            if (!readAt(fd, shdrs.data(), shnum * sizeof(Shdr), shoff))
+                                return false;
+
+                            for (size_t i = 0; i < shdrs.size(); i++) {
+                                auto shdr = shdrs[i];
+                                const auto type = toHost(shdr.sh_type);
+
+                                if (moveDynamicSection && type == SHT_DYNAMIC) {
+                                    setField(shdr.sh_offset, segmentOffset);
+                                    setField(shdr.sh_addr, segmentAddr);
+                                    setField(shdr.sh_size, dynamicSize);
+                                } else if (growStringTable && type == SHT_STRTAB && toHost(shdr.sh_addr) == strtabAddr &&
+                                           (toHost(shdr.sh_flags) & SHF_ALLOC)) {
+                                    setField(shdr.sh_offset, newStrtabOffset);
+                                    setField(shdr.sh_addr, newStrtabAddr);
+                                    setField(shdr.sh_size, strtab.size());
+                                } else {
+                                    continue;
+                                }
+
+                                patches.push_back(makePatch(shoff + i * sizeof(Shdr), shdr));
+                            }
+                        }
+
+                        return true;
+                    }
+
+                    // calculate the modifications required to set the rpath, dispatching on the ELF class
+                    bool planRPathChange(const std::string& value, std::vector<FilePatch>& patches) {
+                        if (!readElfHeaders() || !isDynamic)
+                            return false;
+
+                        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+                        if (fd < 0)
+                            return false;
+
+                        bool rv;
+
+                        if (elfClass == ELFCLASS32)
+                            rv = planRPathChange<Elf32_Ehdr, Elf32_Phdr, Elf32_Shdr, Elf32_Dyn, Elf32_Sym>(fd, value, patches);
+                        else
+                            rv = planRPathChange<Elf64_Ehdr, Elf64_Phdr, Elf64_Shdr, Elf64_Dyn, Elf64_Sym>(fd, value, patches);
+
+                        close(fd);
+
+                        return rv;
+                    }
+
+                    // read section headers and section names, and check that all sections are within the file
+                    // files using extended section numbering aren't supported
+                    template<typename Ehdr, typename Shdr>
+                    bool readSectionHeaders(int fd, Ehdr& ehdr, std::vector<Shdr>& shdrs, std::vector<std::string>& names, uint64_t& fileSize) {
+                        struct stat st;
+
+                        if (fstat(fd, &st) != 0 || !readAt(fd, &ehdr, sizeof(ehdr), 0))
+                            return false;
+
+                        fileSize = static_cast<uint64_t>(st.st_size);
+
+                        const uint64_t shoff = toHost(ehdr.e_shoff);
+                        const auto shnum = toHost(ehdr.e_shnum);
+                        const auto shstrndx = toHost(ehdr.e_shstrndx);
+
+                        if (shoff == 0 || shnum == 0 || toHost(ehdr.e_shentsize) != sizeof(Shdr) || shstrndx == SHN_UNDEF || shstrndx >= shnum)
+                            return false;
+
+                        if (shoff + shnum * sizeof(Shdr) > fileSize)
+                            return false;
+
+                        shdrs.resize(shnum);
+                        if (!readAt(fd, shdrs.data(), shnum * sizeof(Shdr), shoff))
+                            return false;
+
+                        for (const auto& shdr : shdrs) {
+                            if (toHost(shdr.sh_type) != SHT_NOBITS && toHost(shdr.sh_offset) + toHost(shdr.sh_size) > fileSize)
+                                return false;
+                        }
+
+                        std::string shstrtab(toHost(shdrs[shstrndx].sh_size), '\0');
+                        if (!shstrtab.empty() && !readAt(fd, &shstrtab[0], shstrtab.size(), toHost(shdrs[shstrndx].sh_offset)))
+                            return false;
+
+                        names.clear();
+
+                        for (const auto& shdr : shdrs) {
+                            const auto nameOffset = toHost(shdr.sh_name);
+                            names.emplace_back(nameOffset < shstrtab.size() ? shstrtab.c_str() + nameOffset : "");
+                        }
+
+                        return true;
+                    }
+
+                    template<typename Ehdr, typename Shdr> bool readBuildId(int fd, std::string& buildId) {
+                        Ehdr ehdr;
+                        std::vector<Shdr> shdrs;
+                        std::vector<std::string> names;
+                        uint64_t fileSize;
+
+                        if (!readSectionHeaders(fd, ehdr, shdrs, names, fileSize))
+                            return false;
+
+                        for (const auto& shdr : shdrs) {
+                            if (toHost(shdr.sh_type) != SHT_NOTE)
+                                continue;
+
+                            std::string notes(toHost(shdr.sh_size), '\0');
+                            if (!notes.empty() && !readAt(fd, &notes[0], notes.size(), toHost(shdr.sh_offset)))
+                                return false;
+
+                            // notes are padded to the section's alignment, which is 4 bytes for the GNU notes
+                            const uint64_t alignment = toHost(shdr.sh_addralign) == 8 ? 8 : 4;
+
+                            for (uint64_t offset = 0; offset + 3 * sizeof(uint32_t) <= notes.size();) {
+                                uint32_t header[3];
+                                memcpy(header, notes.data() + offset, sizeof(header));
+
+                                const uint64_t nameSize = toHost(header[0]);
+                                const uint64_t descSize = toHost(header[1]);
+                                const auto noteType = toHost(header[2]);
+
+                                const auto nameOffset = offset + sizeof(header);
+                                const auto descOffset = nameOffset + alignUp(nameSize, alignment);
+
+                                if (descOffset + descSize > notes.size())
+                                    break;
+
+                                if (noteType == NT_GNU_BUILD_ID && nameSize == 4 && memcmp(notes.data() + nameOffset, "GNU", 4) == 0) {
+                                    static const char hexDigits[] = "0123456789abcdef";
+
+                                    buildId.clear();
+
+                                    for (uint64_t i = descOffset; i < descOffset + descSize; i++) {
+                                        const auto byte = static_cast<uint8_t>(notes[i]);
+                                        buildId += hexDigits[byte >> 4];
+                                        buildId += hexDigits[byte & 0xf];
+                                    }
+
+                                    return true;
+                                }
+
+                                offset = descOffset + alignUp(descSize, alignment);
+                            }
+                        }
+
+                        return false;
+                    }
+
+                    // calculate how to remove the debug sections and the symbol table
+                    // the removed sections' data is cut off, the remaining non-allocated sections (e.g., .comment and
+                    // .shstrtab) are moved in its place, followed by the new section header table
+                    template<typename Ehdr, typename Phdr, typename Shdr>
+                    bool planStrip(int fd, StripPlan& plan) {
+                        Ehdr ehdr;
+                        std::vector<Shdr> shdrs;
+                        std::vector<std::string> names;
+                        uint64_t fileSize;
+
+                        if (!readSectionHeaders(fd, ehdr, shdrs, names, fileSize))
+                            return false;
+
+                        // the symbol tables of relocatable objects are needed to link them
+                        const auto fileType = toHost(ehdr.e_type);
+                        if (fileType != ET_EXEC && fileType != ET_DYN)
+                            return false;
+
+                        const size_t shnum = shdrs.size();
+                        const size_t shstrndx = toHost(ehdr.e_shstrndx);
+
+                        // only sections which aren't loaded at runtime can be removed
+                        auto isRemovable = [&](size_t i) {
+                            return i != shstrndx && (toHost(shdrs[i].sh_flags) & SHF_ALLOC) == 0 && toHost(shdrs[i].sh_type) != SHT_NOBITS;
+                        };
+
+                        std::vector<bool> removed(shnum, false);
+
+                        for (size_t i = 1; i < shnum; i++) {
+                            if (isRemovable(i) && (isDebugSection(names[i]) || toHost(shdrs[i].sh_type) == SHT_SYMTAB))
+                                removed[i] = true;
+                        }
+
+                        // relocations of removed sections, and string tables only used by removed sections go, too
+                        std::vector<bool> linkedFromRemoved(shnum, false), linkedFromKept(shnum, false);
+
+                        for (size_t i = 1; i < shnum; i++) {
+                            const auto type = toHost(shdrs[i].sh_type);
+                            const size_t info = toHost(shdrs[i].sh_info);
+
+                            if (isRemovable(i) && (type == SHT_REL || type == SHT_RELA) && info < shnum && removed[info])
+                                removed[i] = true;
+                        }
+
+                        for (size_t i = 1; i < shnum; i++) {
+                            const size_t link = toHost(shdrs[i].sh_link);
+
+                            if (link < shnum)
+                                (removed[i] ? linkedFromRemoved : linkedFromKept)[link] = true;
+                        }
+
+                        for (size_t i = 1; i < shnum; i++) {
+                            if (isRemovable(i) && toHost(shdrs[i].sh_type) == SHT_STRTAB && linkedFromRemoved[i] && !linkedFromKept[i])
+                                removed[i] = true;
+                        }
+
+                        size_t firstRemoved = 0;
+                        uint64_t cutoff = fileSize;
+
+                        for (size_t i = 1; i < shnum; i++) {
+                            if (!removed[i])
+                                continue;
+
+                            if (firstRemoved == 0)
+                                firstRemoved = i;
+
+                            if (toHost(shdrs[i].sh_size) > 0)
+                                cutoff = std::min<uint64_t>(cutoff, toHost(shdrs[i].sh_offset));
+                        }
+
+                        if (firstRemoved == 0)
+                            return false;
+
+                        // the indices of the allocated sections must not change, as the dynamic symbols refer to them
+                        for (size_t i = firstRemoved; i < shnum; i++) {
+                            if (!removed[i] && (toHost(shdrs[i].sh_flags) & SHF_ALLOC))
+                                return false;
+                        }
+
+                        // everything needed at runtime must be located before the data which is cut off, the old section
+                        // header table after it
+                        const uint64_t phoff = toHost(ehdr.e_phoff);
+                        const auto phnum = toHost(ehdr.e_phnum);
+
+                        if (phnum > 0 && toHost(ehdr.e_phentsize) != sizeof(Phdr))
+                            return false;
+
+                        if (sizeof(Ehdr) > cutoff || phoff + phnum * sizeof(Phdr) > cutoff || toHost(ehdr.e_shoff) < cutoff)
+                            return false;
+
+                        std::vector<Phdr> phdrs(phnum);
+                        if (phnum > 0 && !readAt(fd, phdrs.data(), phnum * sizeof(Phdr), phoff))
+                            return false;
+
+                        for (const auto& phdr : phdrs) {
+                            if (toHost(phdr.p_filesz) > 0 && toHost(phdr.p_offset) + toHost(phdr.p_filesz) > cutoff)
+                                return false;
+                        }
+
+                        for (const auto& shdr : shdrs) {
+                            if ((toHost(shdr.sh_flags) & SHF_ALLOC) && toHost(shdr.sh_type) != SHT_NOBITS
+                                && toHost(shdr.sh_offset) + toHost(shdr.sh_size) > cutoff)
+                                return false;
+                        }
+
+                        std::vector<size_t> newIndices(shnum, 0);
+                        std::vector<Shdr> newShdrs;
+
+                        for (size_t i = 0; i < shnum; i++) {
+                            if (!removed[i]) {
+                                newIndices[i] = newShdrs.size();
+                                newShdrs.push_back(shdrs[i]);
+                            }
+                        }
+
+                        std::string tail;
+
+                        for (auto& shdr : newShdrs) {
+                            const auto type = toHost(shdr.sh_type);
+                            const uint64_t offset = toHost(shdr.sh_offset);
+                            const uint64_t size = toHost(shdr.sh_size);
+
+                            const size_t link = toHost(shdr.sh_link);
+                            if (link < shnum)
+                                setField(shdr.sh_link, newIndices[link]);
+
+                            // sh_info refers to a section only in relocation sections, or if explicitly flagged
+                            const size_t info = toHost(shdr.sh_info);
+                            if ((type == SHT_REL || type == SHT_RELA || (toHost(shdr.sh_flags) & SHF_INFO_LINK)) && info < shnum)
+                                setField(shdr.sh_info, newIndices[info]);
+
+                            if (offset + (type == SHT_NOBITS ? 0 : size) <= cutoff)
+                                continue;
+
+                            if (type != SHT_NOBITS && size > 0) {
+                                tail.resize(alignUp(cutoff + tail.size(), toHost(shdr.sh_addralign)) - cutoff, '\0');
+
+                                const auto tailOffset = tail.size();
+                                tail.resize(tailOffset + size);
+
+                                if (!readAt(fd, &tail[tailOffset], size, offset))
+                                    return false;
+                            }
+
+                            setField(shdr.sh_offset, cutoff + tail.size() - (type == SHT_NOBITS ? 0 : size));
+                        }
+
+                        tail.resize(alignUp(cutoff + tail.size(), sizeof(ehdr.e_shoff)) - cutoff, '\0');
+
+                        const uint64_t newShoff = cutoff + tail.size();
+                        tail.append(reinterpret_cast<const char*>(newShdrs.data()), newShdrs.size() * sizeof(Shdr));
+
+                        // there's nothing to gain if the removed sections are empty
+                        if (cutoff + tail.size() >= fileSize)
+                            return false;
+
+                        Ehdr newEhdr = ehdr;
+                        setField(newEhdr.e_shoff, newShoff);
+                        setField(newEhdr.e_shnum, newShdrs.size());
+                        setField(newEhdr.e_shstrndx, newIndices[shstrndx]);
+
+                        plan.length = cutoff;
+                        plan.patches = {makePatch(0, newEhdr), {cutoff, tail}};
+                        plan.originalSize = fileSize;
+                        plan.strippedSize = cutoff + tail.size();
+
+                        return true;
+                    }
+
+                    // write debug file in the format generated by objcopy --only-keep-debug
+                    // all sections are kept, so that the section indices match the original file's, but the allocated
+                    // ones (except for notes, which contain the build ID) are turned into empty SHT_NOBITS sections
+                    template<typename Ehdr, typename Shdr> bool writeDebugFile(int fd, int out) {
+                        Ehdr ehdr;
+                        std::vector<Shdr> shdrs;
+                        std::vector<std::string> names;
+                        uint64_t fileSize;
+
+                        if (!readSectionHeaders(fd, ehdr, shdrs, names, fileSize))
+                            return false;
+
+                        uint64_t offset = sizeof(Ehdr);
+
+                        for (size_t i = 1; i < shdrs.size(); i++) {
+                            auto& shdr = shdrs[i];
+
+                            const auto type = toHost(shdr.sh_type);
+
+                            if (type == SHT_NOBITS || ((toHost(shdr.sh_flags) & SHF_ALLOC) && type != SHT_NOTE)) {
+                                setField(shdr.sh_type, SHT_NOBITS);
+                                setField(shdr.sh_offset, offset);
+                                continue;
+                            }
+
+                            offset = alignUp(offset, toHost(shdr.sh_addralign));
+
+                            if (!copyAt(fd, toHost(shdr.sh_offset), out, offset, toHost(shdr.sh_size)))
+                                return false;
+
+                            setField(shdr.sh_offset, offset);
+                            offset += toHost(shdr.sh_size);
+                        }
+
+                        offset = alignUp(offset, sizeof(ehdr.e_shoff));
+
+                        // the debug file doesn't contain any segments
+                        setField(ehdr.e_phoff, 0);
+                        setField(ehdr.e_phnum, 0);
+                        setField(ehdr.e_shoff, offset);
+
+                        return writeAt(out, shdrs.data(), shdrs.size() * sizeof(Shdr), offset) && writeAt(out, &ehdr, sizeof(ehdr), 0);
+                    }
             };
 
+            bool ElfFile::PrivateData::useLdd = false;
+
             ElfFile::ElfFile(const boost::filesystem::path& path) {
                 d = new PrivateData(path);
             }
@@ -30,16 +1228,22 @@ namespace linuxdeploy {
                 delete d;
             }
 
-            std::vector<bf::path> ElfFile::traceDynamicDependencies() {
-                // this method's purpose is to abstract this process
-                // the caller doesn't care _how_ it's done, after all
+            void ElfFile::setUseLdd(bool useLdd) {
+                PrivateData::useLdd = useLdd;
+            }
+
+            bool ElfFile::getUseLdd() {
+                return PrivateData::useLdd;
+            }
 
-                // for now, we use the same ldd based method linuxdeployqt uses
+            static std::vector<bf::path> traceDynamicDependenciesWithLdd(const bf::path& path) {
+                trace::Span span("ldd", path);
+                trace::addToCounter(trace::COUNTER_SUBPROCESSES);
 
                 std::vector<bf::path> paths;
 
                 subprocess::Popen lddProc(
-                    {"ldd", d->path.string().c_str()},
+                    {"ldd", path.string().c_str()},
                     subprocess::output{subprocess::PIPE},
                     subprocess::error{subprocess::PIPE}
                 );
@@ -71,74 +1275,189 @@ namespace linuxdeploy {
                 return paths;
             }
 
-            std::string getPatchelfPath() {
-                // by default, try to use a patchelf next to the linuxdeploy binary
-                // if that isn't available, fall back to searching for patchelf in the PATH
-                std::string patchelfPath = "patchelf";
+            std::vector<bf::path> ElfFile::traceDynamicDependencies() {
+                // this method's purpose is to abstract this process
+                // the caller doesn't care _how_ it's done, after all
+
+                // ldd is only used on request, as it runs the dynamic loader for every single file
+                if (PrivateData::useLdd)
+                    return traceDynamicDependenciesWithLdd(d->path);
 
-                // FIXME: reading /proc/self/exe line is Linux specific
-                std::vector<char> buf(PATH_MAX, '\0');
-                if (readlink("/proc/self/exe", buf.data(), buf.size()) != -1) {
-                    auto binDirPath = bf::path(buf.data());
-                    auto localPatchelfPath = binDirPath.parent_path() / "patchelf";
-                    if (bf::exists(localPatchelfPath))
-                        patchelfPath = localPatchelfPath.string();
+                // the built-in resolver reads the dynamic sections and resolves the dependencies the same way the
+                // dynamic loader does, emulating ldd's output without ever running the binary
+                if (!d->readElfHeaders()) {
+                    ldLog() << LD_ERROR << "Failed to read ELF headers of file" << d->path << std::endl;
+                    return {};
                 }
 
-                ldLog() << LD_DEBUG << "Using patchelf:" << patchelfPath << std::endl;
+                if (!d->isDynamic) {
+                    ldLog() << LD_DEBUG << "Not a dynamic ELF file:" << d->path << std::endl;
+                    return {};
+                }
 
-                return patchelfPath;
-            }
+                std::vector<bf::path> paths;
 
-            std::string ElfFile::getRPath() {
-                try {
-                    subprocess::Popen patchelfProc(
-                        {getPatchelfPath().c_str(), "--print-rpath", d->path.c_str()},
-                        subprocess::output(subprocess::PIPE),
-                        subprocess::error(subprocess::PIPE)
-                    );
+                // all objects loaded so far, in load order (breadth first), along with the DT_RPATH entries they
+                // inherit from the objects that caused them to be loaded
+                std::vector<std::unique_ptr<PrivateData>> ownedObjects;
+                std::vector<PrivateData*> objects = {d};
+                std::vector<std::vector<InheritedRPath>> inheritedRPaths = {{}};
 
-                    auto patchelfOutput = patchelfProc.communicate();
-                    auto& patchelfStdout = patchelfOutput.first;
-                    auto& patchelfStderr = patchelfOutput.second;
+                // the dynamic loader doesn't load the same file twice, neither by name nor by identity
+                std::set<std::string> loadedNames;
+                std::set<std::pair<dev_t, ino_t>> loadedFiles;
 
-                    if (patchelfProc.retcode() != 0) {
-                        std::string errStr(patchelfStderr.buf.data());
+                auto registerFile = [&loadedFiles](const bf::path& path) {
+                    struct stat st;
+                    if (stat(path.c_str(), &st) != 0)
+                        return true;
+                    return loadedFiles.insert(std::make_pair(st.st_dev, st.st_ino)).second;
+                };
+
+                registerFile(d->path);
+                if (!d->soname.empty())
+                    loadedNames.insert(d->soname);
+
+                // the interpreter is loaded already, and is not reported by ldd as a regular dependency
+                if (!d->interpreter.empty()) {
+                    loadedNames.insert(bf::path(d->interpreter).filename().string());
+                    registerFile(d->interpreter);
+                }
 
-                        // if file is not an ELF executable, there is no need for a detailed error message
-                        if (patchelfProc.retcode() == 1 && errStr.find("not an ELF executable")) {
-                            return "";
-                        } else {
-                            ldLog() << LD_ERROR << "Call to patchelf failed:" << std::endl << errStr;
-                            return "";
+                for (size_t i = 0; i < objects.size(); i++) {
+                    // copy the lists, as they might be reallocated
+                    const auto neededLibraries = objects[i]->neededLibraries;
+                    const auto objectRPaths = inheritedRPaths[i];
+
+                    for (const auto& name : neededLibraries) {
+                        if (loadedNames.find(name) != loadedNames.end())
+                            continue;
+
+                        // libraries don't have an interpreter, in that case the loader is identified by its name
+                        if (d->interpreter.empty() && PrivateData::isDynamicLoader(name)) {
+                            loadedNames.insert(name);
+                            continue;
+                        }
+
+                        bf::path libraryPath;
+
+                        if (!PrivateData::findLibrary(objects[i], objectRPaths, name, libraryPath)) {
+                            ldLog() << LD_WARNING << "Could not find dependency" << name << "of ELF file" << objects[i]->path << std::endl;
+                            loadedNames.insert(name);
+                            continue;
                         }
+
+                        loadedNames.insert(name);
+
+                        if (!registerFile(libraryPath))
+                            continue;
+
+                        std::unique_ptr<PrivateData> library(new PrivateData(libraryPath));
+                        library->readElfHeaders();
+
+                        if (!library->soname.empty())
+                            loadedNames.insert(library->soname);
+
+                        paths.push_back(bf::absolute(libraryPath));
+
+                        objects.push_back(library.get());
+                        inheritedRPaths.push_back(objects[i]->rpathsForDependencies(objectRPaths));
+                        ownedObjects.push_back(std::move(library));
                     }
+                }
+
+                return paths;
+            }
 
+            std::vector<Dependency> ElfFile::resolveDirectDependencies(const std::vector<InheritedRPath>& inheritedRPaths) {
+                if (!d->readElfHeaders()) {
+                    ldLog() << LD_ERROR << "Failed to read ELF headers of file" << d->path << std::endl;
+                    return {};
+                }
 
-                    std::string retval = patchelfStdout.buf.data();
-                    util::trim(retval, '\n');
-                    util::trim(retval);
+                std::vector<Dependency> dependencies;
 
-                    return retval;
-                } catch (const std::exception&) {
-                    return "";
+                for (const auto& name : d->neededLibraries) {
+                    if (PrivateData::isDynamicLoader(name) || (!d->interpreter.empty() && name == bf::path(d->interpreter).filename()))
+                        continue;
+
+                    bf::path libraryPath;
+
+                    if (PrivateData::findLibrary(d, inheritedRPaths, name, libraryPath))
+                        libraryPath = bf::absolute(libraryPath);
+                    else
+                        libraryPath.clear();
+
+                    dependencies.push_back({name, libraryPath});
                 }
+
+                return dependencies;
             }
 
-            bool ElfFile::setRPath(const std::string& value) {
+            std::vector<InheritedRPath> ElfFile::getRPathsForDependencies(const std::vector<InheritedRPath>& inheritedRPaths) {
+                d->readElfHeaders();
+                return d->rpathsForDependencies(inheritedRPaths);
+            }
+
+            std::string ElfFile::getSoname() {
+                if (!d->readElfHeaders())
+                    return "";
+
+                return d->soname;
+            }
+
+            std::string getPatchelfPath() {
+                // the path doesn't change at runtime, therefore it's only looked up once
+                // initialization of function-local statics is thread-safe
+                static const std::string patchelfPath = []() {
+                    // by default, try to use a patchelf next to the linuxdeploy binary
+                    // if that isn't available, fall back to searching for patchelf in the PATH
+                    std::string path = "patchelf";
+
+                    // FIXME: reading /proc/self/exe line is Linux specific
+                    std::vector<char> buf(PATH_MAX, '\0');
+                    if (readlink("/proc/self/exe", buf.data(), buf.size()) != -1) {
+                        auto binDirPath = bf::path(buf.data());
+                        auto localPatchelfPath = binDirPath.parent_path() / "patchelf";
+                        if (bf::exists(localPatchelfPath))
+                            path = localPatchelfPath.string();
+                    }
+
+                    ldLog() << LD_DEBUG << "Using patchelf:" << path << std::endl;
+
+                    return path;
+                }();
+
+                return patchelfPath;
+            }
+
+            std::string ElfFile::getRPath() {
+                if (!d->readElfHeaders())
+                    return "";
+
+                // DT_RUNPATH takes precedence over DT_RPATH
+                if (d->hasRunPath)
+                    return d->runpath;
+
+                return d->rpath;
+            }
+
+            static bool setRPathWithPatchelf(const bf::path& path, const std::string& value) {
+                trace::Span span("patchelf", path);
+                trace::addToCounter(trace::COUNTER_SUBPROCESSES);
+
                 try {
                     subprocess::Popen patchelfProc(
-                        {getPatchelfPath().c_str(), "--set-rpath", value.c_str(), d->path.c_str()},
+                        {getPatchelfPath().c_str(), "--set-rpath", value.c_str(), path.c_str()},
                         subprocess::output(subprocess::PIPE),
                         subprocess::error(subprocess::PIPE)
                     );
 
                     auto patchelfOutput = patchelfProc.communicate();
-                    auto& patchelfStdout = patchelfOutput.first;
                     auto& patchelfStderr = patchelfOutput.second;
 
                     if (patchelfProc.retcode() != 0) {
-                        ldLog() << LD_ERROR << "Call to patchelf failed:" << std::endl << patchelfStderr.buf;
+                        ldLog() << LD_ERROR << "Call to patchelf failed:" << std::endl << patchelfStderr.buf.data() << std::endl;
                         return false;
                     }
                 } catch (const std::exception&) {
@@ -147,6 +1466,130 @@ namespace linuxdeploy {
 
                 return true;
             }
+
+            bool ElfFile::planRPathChange(const std::string& value, std::vector<FilePatch>& patches) {
+                trace::Span span("plan rpath change", d->path);
+
+                patches.clear();
+
+                // patches calculated before the plan failed must not be applied partially
+                if (!d->planRPathChange(value, patches)) {
+                    patches.clear();
+                    return false;
+                }
+
+                return true;
+            }
+
+            bool ElfFile::planStrip(StripPlan& plan) {
+                trace::Span span("plan strip", d->path);
+
+                if (!d->readElfHeaders())
+                    return false;
+
+                int fd = open(d->path.c_str(), O_RDONLY | O_CLOEXEC);
+                if (fd < 0)
+                    return false;
+
+                bool rv;
+
+                if (d->elfClass == ELFCLASS32)
+                    rv = d->planStrip<Elf32_Ehdr, Elf32_Phdr, Elf32_Shdr>(fd, plan);
+                else
+                    rv = d->planStrip<Elf64_Ehdr, Elf64_Phdr, Elf64_Shdr>(fd, plan);
+
+                close(fd);
+
+                return rv;
+            }
+
+            std::string ElfFile::getBuildId() {
+                if (!d->readElfHeaders())
+                    return "";
+
+                int fd = open(d->path.c_str(), O_RDONLY | O_CLOEXEC);
+                if (fd < 0)
+                    return "";
+
+                std::string buildId;
+
+                if (d->elfClass == ELFCLASS32)
+                    d->readBuildId<Elf32_Ehdr, Elf32_Shdr>(fd, buildId);
+                else
+                    d->readBuildId<Elf64_Ehdr, Elf64_Shdr>(fd, buildId);
+
+                close(fd);
+
+                return buildId;
+            }
+
+            bool ElfFile::writeDebugFile(const bf::path& path) {
+                trace::Span span("write debug file", d->path);
+
+                if (!d->readElfHeaders())
+                    return false;
+
+                int fd = open(d->path.c_str(), O_RDONLY | O_CLOEXEC);
+                if (fd < 0)
+                    return false;
+
+                int out = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+                if (out < 0) {
+                    close(fd);
+                    return false;
+                }
+
+                bool success;
+
+                if (d->elfClass == ELFCLASS32)
+                    success = d->writeDebugFile<Elf32_Ehdr, Elf32_Shdr>(fd, out);
+                else
+                    success = d->writeDebugFile<Elf64_Ehdr, Elf64_Shdr>(fd, out);
+
+                if (close(out) != 0)
+                    success = false;
+
+                close(fd);
+
+                return success;
+            }
+
+            bool ElfFile::setRPath(const std::string& value) {
+                trace::Span span("set rpath", d->path);
+
+                if (!d->readElfHeaders()) {
+                    ldLog() << LD_ERROR << "Not an ELF file:" << d->path << std::endl;
+                    return false;
+                }
+
+                std::vector<FilePatch> patches;
+
+                // files which can't be modified in-process are left to patchelf
+                if (!d->planRPathChange(value, patches)) {
+                    ldLog() << LD_DEBUG << "Cannot set rpath in-process, falling back to patchelf:" << d->path << std::endl;
+                    d->headersRead = false;
+                    return setRPathWithPatchelf(d->path, value);
+                }
+
+                int fd = open(d->path.c_str(), O_WRONLY | O_CLOEXEC);
+                if (fd < 0) {
+                    ldLog() << LD_ERROR << "Failed to open ELF file for writing:" << d->path << std::endl;
+                    return false;
+                }
+
+                bool success = applyPatches(fd, patches);
+
+                if (!success)
+                    ldLog() << LD_ERROR << "Failed to write to ELF file:" << d->path << std::endl;
+
+                if (close(fd) != 0)
+                    success = false;
+
+                // the cached information is outdated now
+                d->headersRead = false;
+
+                return success;
+            }
         }
     }
 }
@@ -0,0 +1,510 @@
+// system includes
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// local headers
+#include "linuxdeploy/core/elfcache.h"
+#include "linuxdeploy/core/log.h"
+#include "linuxdeploy/core/trace.h"
+
+using namespace linuxdeploy::core::log;
+
+namespace bf = boost::filesystem;
+
+namespace linuxdeploy {
+    namespace core {
+        namespace elfcache {
+            // the file is only meant to be read on the machine it's been written on, therefore everything is stored in
+            // host byte order, which is verified using the byte order mark
+            // the version must be increased whenever the format changes
+            static const char fileMagic[8] = {'L', 'D', 'E', 'L', 'F', 'C', 'A', 'C'};
+            static const uint32_t fileVersion = 2;
+            static const uint32_t byteOrderMark = 0x01020304;
+
+            // upper limit for the number of records in the file, records used in the current run take precedence
+            static const size_t maxRecords = 65536;
+
+            // modifications made within this period might not be reflected in the modification time yet
+            static const int64_t racyPeriod = 2000000000;
+
+            struct FileHeader {
+                char magic[8];
+                uint32_t version;
+                uint32_t byteOrderMark;
+                uint64_t numberOfRecords;
+            };
+
+            // the index is sorted by identity, the offsets are relative to the beginning of the record data
+            struct IndexEntry {
+                uint64_t device;
+                uint64_t inode;
+                uint64_t size;
+                int64_t mtime;
+                uint64_t offset;
+                uint64_t length;
+            };
+
+            struct IdentityLess {
+                template<typename A, typename B> bool operator()(const A& a, const B& b) const {
+                    if (a.device != b.device)
+                        return a.device < b.device;
+                    if (a.inode != b.inode)
+                        return a.inode < b.inode;
+                    if (a.size != b.size)
+                        return a.size < b.size;
+                    return a.mtime < b.mtime;
+                }
+            };
+
+            bool identify(const bf::path& path, FileIdentity& identity) {
+                struct stat st;
+
+                if (stat(path.c_str(), &st) != 0)
+                    return false;
+
+                identity.device = static_cast<uint64_t>(st.st_dev);
+                identity.inode = static_cast<uint64_t>(st.st_ino);
+                identity.size = static_cast<uint64_t>(st.st_size);
+                identity.mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+
+                return true;
+            }
+
+            static int64_t currentTime() {
+                struct timespec ts;
+                clock_gettime(CLOCK_REALTIME, &ts);
+                return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+            }
+
+            // read-only mapping of a cache file
+            class MappedFile {
+                public:
+                    void* address = nullptr;
+                    size_t mappingSize = 0;
+
+                    const IndexEntry* index = nullptr;
+                    size_t numberOfRecords = 0;
+                    const char* data = nullptr;
+                    size_t dataSize = 0;
+
+                public:
+                    MappedFile() = default;
+
+                    ~MappedFile() {
+                        if (address != nullptr)
+                            munmap(address, mappingSize);
+                    }
+
+                    MappedFile(const MappedFile&) = delete;
+                    MappedFile& operator=(const MappedFile&) = delete;
+
+                public:
+                    // returns false if the file doesn't exist or is invalid, in which case the mapping is empty
+                    bool open(const bf::path& path) {
+                        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+                        if (fd < 0)
+                            return false;
+
+                        struct stat st;
+
+                        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(FileHeader)) {
+                            close(fd);
+                            return false;
+                        }
+
+                        mappingSize = static_cast<size_t>(st.st_size);
+                        address = mmap(nullptr, mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+                        close(fd);
+
+                        if (address == MAP_FAILED) {
+                            address = nullptr;
+                            return false;
+                        }
+
+                        const auto* header = static_cast<const FileHeader*>(address);
+                        const auto available = (mappingSize - sizeof(FileHeader)) / sizeof(IndexEntry);
+
+                        if (memcmp(header->magic, fileMagic, sizeof(fileMagic)) != 0 || header->version != fileVersion ||
+                            header->byteOrderMark != byteOrderMark || header->numberOfRecords > available) {
+                            ldLog() << LD_DEBUG << "Ignoring invalid ELF cache file" << path << std::endl;
+                            munmap(address, mappingSize);
+                            address = nullptr;
+                            return false;
+                        }
+
+                        numberOfRecords = header->numberOfRecords;
+                        index = reinterpret_cast<const IndexEntry*>(static_cast<const char*>(address) + sizeof(FileHeader));
+                        data = reinterpret_cast<const char*>(index + numberOfRecords);
+                        dataSize = mappingSize - (data - static_cast<const char*>(address));
+
+                        return true;
+                    }
+
+                    // look up serialized record
+                    bool find(const FileIdentity& identity, std::string& record) const {
+                        const auto* end = index + numberOfRecords;
+                        const auto* entry = std::lower_bound(index, end, identity, IdentityLess());
+
+                        if (entry == end || IdentityLess()(identity, *entry))
+                            return false;
+
+                        if (entry->offset > dataSize || entry->length > dataSize - entry->offset)
+                            return false;
+
+                        record.assign(data + entry->offset, entry->length);
+                        return true;
+                    }
+            };
+
+            class ElfCache::PrivateData {
+                public:
+                    std::mutex mutex;
+
+                    // checked without holding the mutex
+                    std::atomic<bool> enabled{false};
+                    bf::path directory;
+
+                    MappedFile file;
+
+                    // records added in this process, which need to be written to the file
+                    std::map<FileIdentity, ElfInfo, IdentityLess> newRecords;
+
+                    // records read from the file which have been used in this process
+                    std::set<FileIdentity, IdentityLess> usedRecords;
+
+                public:
+                    bf::path cacheFilePath() const {
+                        return directory / "elf-cache";
+                    }
+
+                    static void putInteger(std::string& out, uint64_t value, size_t size) {
+                        out.append(reinterpret_cast<const char*>(&value), size);
+                    }
+
+                    static void putString(std::string& out, const std::string& value) {
+                        putInteger(out, value.size(), sizeof(uint32_t));
+                        out += value;
+                    }
+
+                    static void putStrings(std::string& out, const std::vector<std::string>& values) {
+                        putInteger(out, values.size(), sizeof(uint32_t));
+
+                        for (const auto& value : values)
+                            putString(out, value);
+                    }
+
+                    static std::string serialize(const ElfInfo& info) {
+                        std::string out;
+
+                        putInteger(out, info.isElf, 1);
+                        putInteger(out, info.isDynamic, 1);
+                        putInteger(out, info.elfClass, 1);
+                        putInteger(out, info.elfData, 1);
+                        putInteger(out, info.elfMachine, 2);
+                        putInteger(out, info.hasRPath, 1);
+                        putInteger(out, info.hasRunPath, 1);
+                        putString(out, info.interpreter);
+                        putString(out, info.soname);
+                        putString(out, info.rpath);
+                        putString(out, info.runpath);
+                        putStrings(out, info.neededLibraries);
+
+                        return out;
+                    }
+
+                    // bounds checked reader for serialized records
+                    class Reader {
+                        private:
+                            const std::string& in;
+                            size_t pos = 0;
+
+                        public:
+                            explicit Reader(const std::string& in) : in(in) {}
+
+                            template<typename T> bool getInteger(T& value, size_t size) {
+                                if (size > in.size() - pos)
+                                    return false;
+
+                                uint64_t raw = 0;
+                                memcpy(&raw, in.data() + pos, size);
+                                pos += size;
+
+                                value = static_cast<T>(raw);
+                                return true;
+                            }
+
+                            bool getString(std::string& value) {
+                                uint32_t size;
+
+                                if (!getInteger(size, sizeof(size)) || size > in.size() - pos)
+                                    return false;
+
+                                value.assign(in, pos, size);
+                                pos += size;
+                                return true;
+                            }
+
+                            bool getStrings(std::vector<std::string>& values) {
+                                uint32_t count;
+
+                                // every string takes at least the size of its length, which protects against huge
+                                // allocations for invalid records
+                                if (!getInteger(count, sizeof(count)) || count > (in.size() - pos) / sizeof(uint32_t))
+                                    return false;
+
+                                values.resize(count);
+
+                                for (auto& value : values) {
+                                    if (!getString(value))
+                                        return false;
+                                }
+
+                                return true;
+                            }
+                    };
+
+                    static bool deserialize(const std::string& in, ElfInfo& info) {
+                        Reader reader(in);
+
+                        return reader.getInteger(info.isElf, 1) && reader.getInteger(info.isDynamic, 1) &&
+                            reader.getInteger(info.elfClass, 1) && reader.getInteger(info.elfData, 1) &&
+                            reader.getInteger(info.elfMachine, 2) && reader.getInteger(info.hasRPath, 1) &&
+                            reader.getInteger(info.hasRunPath, 1) && reader.getString(info.interpreter) &&
+                            reader.getString(info.soname) && reader.getString(info.rpath) &&
+                            reader.getString(info.runpath) && reader.getStrings(info.neededLibraries);
+                    }
+
+                    bool findRecord(const FileIdentity& identity, ElfInfo& record) {
+                        auto newRecord = newRecords.find(identity);
+
+                        if (newRecord != newRecords.end()) {
+                            record = newRecord->second;
+                            return true;
+                        }
+
+                        std::string serialized;
+
+                        if (!file.find(identity, serialized))
+                            return false;
+
+                        if (!deserialize(serialized, record)) {
+                            ldLog() << LD_DEBUG << "Ignoring invalid record in ELF cache" << std::endl;
+                            return false;
+                        }
+
+                        usedRecords.insert(identity);
+                        return true;
+                    }
+
+                    // files whose modification time is too close to the current time could be modified again without
+                    // the modification being detectable
+                    static bool isCacheable(const FileIdentity& identity) {
+                        return identity.mtime < currentTime() - racyPeriod;
+                    }
+
+                    bool writeFile(const std::map<FileIdentity, std::string, IdentityLess>& records) {
+                        std::string contents;
+
+                        FileHeader header = {};
+                        memcpy(header.magic, fileMagic, sizeof(fileMagic));
+                        header.version = fileVersion;
+                        header.byteOrderMark = byteOrderMark;
+                        header.numberOfRecords = records.size();
+
+                        contents.append(reinterpret_cast<const char*>(&header), sizeof(header));
+
+                        uint64_t offset = 0;
+
+                        for (const auto& record : records) {
+                            const IndexEntry entry = {record.first.device, record.first.inode, record.first.size,
+                                                      record.first.mtime, offset, record.second.size()};
+                            contents.append(reinterpret_cast<const char*>(&entry), sizeof(entry));
+                            offset += record.second.size();
+                        }
+
+                        for (const auto& record : records)
+                            contents += record.second;
+
+                        const auto path = cacheFilePath();
+                        std::string tempPath = path.string() + ".XXXXXX";
+
+                        const auto fd = mkstemp(&tempPath[0]);
+
+                        if (fd < 0) {
+                            ldLog() << LD_WARNING << "Failed to create temporary file for ELF cache in" << directory << LD_NO_SPACE << ":" << strerror(errno) << std::endl;
+                            return false;
+                        }
+
+                        bool success = fchmod(fd, 0644) == 0;
+
+                        for (size_t written = 0; success && written < contents.size();) {
+                            const auto rv = write(fd, contents.data() + written, contents.size() - written);
+
+                            if (rv < 0) {
+                                if (errno == EINTR)
+                                    continue;
+
+                                success = false;
+                                break;
+                            }
+
+                            written += static_cast<size_t>(rv);
+                        }
+
+                        if (close(fd) != 0)
+                            success = false;
+
+                        // readers keep using the mapping of the file they've opened, therefore it's simply replaced
+                        if (success && rename(tempPath.c_str(), path.c_str()) != 0)
+                            success = false;
+
+                        if (!success) {
+                            ldLog() << LD_WARNING << "Failed to write ELF cache" << path << LD_NO_SPACE << ":" << strerror(errno) << std::endl;
+                            unlink(tempPath.c_str());
+                        }
+
+                        return success;
+                    }
+            };
+
+            ElfCache::ElfCache() {
+                d = new PrivateData();
+            }
+
+            ElfCache::~ElfCache() {
+                delete d;
+            }
+
+            ElfCache& ElfCache::getInstance() {
+                static ElfCache instance;
+                return instance;
+            }
+
+            void ElfCache::enable(const bf::path& directory) {
+                std::lock_guard<std::mutex> lock(d->mutex);
+
+                d->directory = directory;
+
+                if (d->file.open(d->cacheFilePath()))
+                    ldLog() << LD_DEBUG << "Loaded ELF cache with" << d->file.numberOfRecords << "records from" << d->cacheFilePath() << std::endl;
+
+                d->enabled = true;
+            }
+
+            bool ElfCache::isEnabled() const {
+                return d->enabled;
+            }
+
+            bool ElfCache::findInfo(const FileIdentity& identity, ElfInfo& info) {
+                std::lock_guard<std::mutex> lock(d->mutex);
+
+                if (!d->enabled || !d->findRecord(identity, info)) {
+                    trace::addToCounter(trace::COUNTER_ELF_CACHE_MISSES);
+                    return false;
+                }
+
+                trace::addToCounter(trace::COUNTER_ELF_CACHE_HITS);
+
+                return true;
+            }
+
+            void ElfCache::storeInfo(const FileIdentity& identity, const ElfInfo& info) {
+                std::lock_guard<std::mutex> lock(d->mutex);
+
+                if (!d->enabled || !PrivateData::isCacheable(identity))
+                    return;
+
+                d->newRecords[identity] = info;
+            }
+
+            bool ElfCache::save() {
+                trace::Span span("save ELF cache");
+
+                std::lock_guard<std::mutex> lock(d->mutex);
+
+                if (!d->enabled || d->newRecords.empty())
+                    return true;
+
+                boost::system::error_code ec;
+                bf::create_directories(d->directory, ec);
+
+                if (ec) {
+                    ldLog() << LD_WARNING << "Failed to create ELF cache directory" << d->directory << LD_NO_SPACE << ":" << ec.message() << std::endl;
+                    return false;
+                }
+
+                // concurrent writers would otherwise discard each other's records
+                const auto lockPath = d->directory / "elf-cache.lock";
+                int lockFd = open(lockPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+                if (lockFd < 0 || flock(lockFd, LOCK_EX) != 0) {
+                    ldLog() << LD_WARNING << "Failed to lock ELF cache" << lockPath << LD_NO_SPACE << ":" << strerror(errno) << std::endl;
+
+                    if (lockFd >= 0)
+                        close(lockFd);
+
+                    return false;
+                }
+
+                // other processes might have updated the file since it's been loaded
+                MappedFile current;
+                current.open(d->cacheFilePath());
+
+                std::map<FileIdentity, std::string, IdentityLess> records;
+
+                for (const auto& record : d->newRecords)
+                    records[record.first] = PrivateData::serialize(record.second);
+
+                // existing records are kept up to the limit, preferring the ones which have been used in this process
+                std::vector<const IndexEntry*> usedEntries, otherEntries;
+
+                for (size_t i = 0; i < current.numberOfRecords; i++) {
+                    const auto* entry = current.index + i;
+                    const FileIdentity identity = {entry->device, entry->inode, entry->size, entry->mtime};
+
+                    if (records.find(identity) != records.end())
+                        continue;
+
+                    if (d->usedRecords.find(identity) != d->usedRecords.end())
+                        usedEntries.push_back(entry);
+                    else
+                        otherEntries.push_back(entry);
+                }
+
+                for (const auto* entries : {&usedEntries, &otherEntries}) {
+                    for (const auto* entry : *entries) {
+                        if (records.size() >= maxRecords)
+                            break;
+
+                        if (entry->offset > current.dataSize || entry->length > current.dataSize - entry->offset)
+                            continue;
+
+                        const FileIdentity identity = {entry->device, entry->inode, entry->size, entry->mtime};
+                        records[identity].assign(current.data + entry->offset, entry->length);
+                    }
+                }
+
+                const bool success = d->writeFile(records);
+
+                if (success)
+                    ldLog() << LD_DEBUG << "Saved ELF cache with" << records.size() << "records to" << d->cacheFilePath() << std::endl;
+
+                close(lockFd);
+
+                return success;
+            }
+        }
+    }
+}
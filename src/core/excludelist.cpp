@@ -0,0 +1,327 @@
+// system includes
+#include <algorithm>
+#include <bitset>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <unordered_set>
+#include <vector>
+
+// local headers
+#include "linuxdeploy/core/excludelist.h"
+#include "linuxdeploy/core/log.h"
+#include "excludelist.h"
+
+using namespace linuxdeploy::core::log;
+
+namespace bf = boost::filesystem;
+
+namespace linuxdeploy {
+    namespace core {
+        namespace excludelist {
+            class Excludelist::PrivateData {
+                public:
+                    // state of the pattern automaton
+                    // every pattern is a sequence of states, followed by an accepting one
+                    struct State {
+                        enum Type {
+                            CHARACTER,
+                            ANY_CHARACTER,
+                            CHARACTER_CLASS,
+                            ANY_STRING,
+                            ACCEPT,
+                        };
+
+                        Type type;
+                        char character;
+                        std::bitset<256> characterClass;
+                    };
+
+                public:
+                    // the built-in literals are sorted at build time
+                    size_t generatedLiteralsCount = 0;
+                    std::unordered_set<std::string> literals;
+
+                    std::vector<State> states;
+                    std::vector<size_t> initialStates;
+
+                public:
+                    static bool isPattern(const std::string& entry) {
+                        return entry.find_first_of("*?[\\") != std::string::npos;
+                    }
+
+                    // parse bracket expression, e.g., [a-z] or [!.]
+                    // returns false if there's no closing bracket, in which case the bracket is matched literally
+                    static bool parseCharacterClass(const std::string& pattern, size_t& pos, State& state) {
+                        size_t i = pos + 1;
+                        bool negate = false;
+
+                        if (i < pattern.size() && (pattern[i] == '!' || pattern[i] == '^')) {
+                            negate = true;
+                            i++;
+                        }
+
+                        std::bitset<256> characters;
+                        bool first = true;
+
+                        for (; i < pattern.size(); i++, first = false) {
+                            unsigned char c = static_cast<unsigned char>(pattern[i]);
+
+                            // a closing bracket at the beginning is part of the class
+                            if (c == ']' && !first)
+                                break;
+
+                            // character classes like [:alpha:]
+                            if (c == '[' && i + 1 < pattern.size() && pattern[i + 1] == ':') {
+                                const auto end = pattern.find(":]", i + 2);
+
+                                if (end != std::string::npos) {
+                                    const auto name = pattern.substr(i + 2, end - i - 2);
+
+                                    static const std::vector<std::pair<std::string, int (*)(int)>> classes = {
+                                        {"alnum", isalnum}, {"alpha", isalpha}, {"blank", isblank}, {"cntrl", iscntrl},
+                                        {"digit", isdigit}, {"graph", isgraph}, {"lower", islower}, {"print", isprint},
+                                        {"punct", ispunct}, {"space", isspace}, {"upper", isupper}, {"xdigit", isxdigit},
+                                    };
+
+                                    for (const auto& cls : classes) {
+                                        if (cls.first == name) {
+                                            for (int ch = 0; ch < 256; ch++) {
+                                                if (cls.second(ch))
+                                                    characters.set(ch);
+                                            }
+                                        }
+                                    }
+
+                                    i = end + 1;
+                                    continue;
+                                }
+                            }
+
+                            if (c == '\\' && i + 1 < pattern.size())
+                                c = static_cast<unsigned char>(pattern[++i]);
+
+                            // ranges like a-z
+                            if (i + 2 < pattern.size() && pattern[i + 1] == '-' && pattern[i + 2] != ']') {
+                                i += 2;
+
+                                unsigned char last = static_cast<unsigned char>(pattern[i]);
+                                if (last == '\\' && i + 1 < pattern.size())
+                                    last = static_cast<unsigned char>(pattern[++i]);
+
+                                for (int ch = c; ch <= last; ch++)
+                                    characters.set(static_cast<size_t>(ch));
+
+                                continue;
+                            }
+
+                            characters.set(c);
+                        }
+
+                        if (i >= pattern.size())
+                            return false;
+
+                        if (negate)
+                            characters.flip();
+
+                        // like with FNM_PATHNAME, slashes must be matched explicitly
+                        characters.reset('/');
+
+                        state.type = State::CHARACTER_CLASS;
+                        state.characterClass = characters;
+                        pos = i;
+                        return true;
+                    }
+
+                    void addPattern(const std::string& pattern) {
+                        initialStates.push_back(states.size());
+
+                        for (size_t pos = 0; pos < pattern.size(); pos++) {
+                            State state = {};
+
+                            switch (pattern[pos]) {
+                                case '*':
+                                    // consecutive asterisks are equivalent to a single one
+                                    if (!states.empty() && states.back().type == State::ANY_STRING && states.size() > initialStates.back())
+                                        continue;
+
+                                    state.type = State::ANY_STRING;
+                                    break;
+                                case '?':
+                                    state.type = State::ANY_CHARACTER;
+                                    break;
+                                case '[':
+                                    if (!parseCharacterClass(pattern, pos, state)) {
+                                        state.type = State::CHARACTER;
+                                        state.character = '[';
+                                    }
+                                    break;
+                                case '\\':
+                                    // like with glibc's fnmatch(), patterns ending with a backslash never match, which
+                                    // is implemented by a character class without any characters
+                                    if (pos + 1 >= pattern.size()) {
+                                        state.type = State::CHARACTER_CLASS;
+                                        break;
+                                    }
+
+                                    state.type = State::CHARACTER;
+                                    state.character = pattern[++pos];
+                                    break;
+                                default:
+                                    state.type = State::CHARACTER;
+                                    state.character = pattern[pos];
+                                    break;
+                            }
+
+                            states.push_back(state);
+                        }
+
+                        State accept = {};
+                        accept.type = State::ACCEPT;
+                        states.push_back(accept);
+                    }
+
+                    // add state to the set of active states, following the empty transition of asterisks
+                    void activate(std::vector<size_t>& active, std::vector<size_t>& activeInStep, size_t step, size_t state) const {
+                        while (activeInStep[state] != step) {
+                            activeInStep[state] = step;
+                            active.push_back(state);
+
+                            if (states[state].type != State::ANY_STRING)
+                                break;
+
+                            state++;
+                        }
+                    }
+
+                    // simulate the automaton for all patterns at once
+                    bool matchesPattern(const std::string& fileName) const {
+                        if (initialStates.empty())
+                            return false;
+
+                        // remembers the step (i.e., position in the name plus one) a state has been activated in last,
+                        // which avoids clearing the set of active states for every step
+                        std::vector<size_t> activeInStep(states.size(), 0);
+
+                        std::vector<size_t> active, next;
+                        size_t step = 1;
+
+                        for (const auto initialState : initialStates)
+                            activate(active, activeInStep, step, initialState);
+
+                        for (const char c : fileName) {
+                            step++;
+                            next.clear();
+
+                            for (const auto state : active) {
+                                const auto& current = states[state];
+
+                                switch (current.type) {
+                                    case State::ANY_STRING:
+                                        if (c != '/')
+                                            activate(next, activeInStep, step, state);
+                                        break;
+                                    case State::ANY_CHARACTER:
+                                        if (c != '/')
+                                            activate(next, activeInStep, step, state + 1);
+                                        break;
+                                    case State::CHARACTER_CLASS:
+                                        if (current.characterClass.test(static_cast<unsigned char>(c)))
+                                            activate(next, activeInStep, step, state + 1);
+                                        break;
+                                    case State::CHARACTER:
+                                        if (current.character == c)
+                                            activate(next, activeInStep, step, state + 1);
+                                        break;
+                                    case State::ACCEPT:
+                                        break;
+                                }
+                            }
+
+                            if (next.empty())
+                                return false;
+
+                            active.swap(next);
+                        }
+
+                        return std::any_of(active.begin(), active.end(), [this](size_t state) {
+                            return states[state].type == State::ACCEPT;
+                        });
+                    }
+
+                    bool isGeneratedLiteral(const std::string& fileName) const {
+                        const auto* begin = generatedExcludelistLiterals;
+                        const auto* end = generatedExcludelistLiterals + generatedLiteralsCount;
+
+                        return std::binary_search(begin, end, fileName.c_str(), [](const char* a, const char* b) {
+                            return strcmp(a, b) < 0;
+                        });
+                    }
+            };
+
+            Excludelist::Excludelist() {
+                d = new PrivateData();
+
+                while (generatedExcludelistLiterals[d->generatedLiteralsCount] != nullptr)
+                    d->generatedLiteralsCount++;
+
+                for (auto* pattern = generatedExcludelistPatterns; *pattern != nullptr; pattern++)
+                    d->addPattern(*pattern);
+            }
+
+            Excludelist::~Excludelist() {
+                delete d;
+            }
+
+            void Excludelist::add(const std::string& entry) {
+                if (entry.empty())
+                    return;
+
+                if (PrivateData::isPattern(entry)) {
+                    d->addPattern(entry);
+                } else {
+                    d->literals.insert(entry);
+                }
+            }
+
+            bool Excludelist::addFromFile(const bf::path& path) {
+                std::ifstream ifs(path.string());
+
+                if (!ifs) {
+                    ldLog() << LD_ERROR << "Could not open excludelist:" << path << std::endl;
+                    return false;
+                }
+
+                std::string line;
+
+                while (std::getline(ifs, line)) {
+                    const auto commentStart = line.find('#');
+
+                    if (commentStart != std::string::npos)
+                        line.erase(commentStart);
+
+                    static const char whitespace[] = " \t\r";
+
+                    const auto first = line.find_first_not_of(whitespace);
+
+                    if (first == std::string::npos)
+                        continue;
+
+                    add(line.substr(first, line.find_last_not_of(whitespace) - first + 1));
+                }
+
+                return true;
+            }
+
+            bool Excludelist::isExcluded(const std::string& fileName) const {
+                if (d->isGeneratedLiteral(fileName))
+                    return true;
+
+                if (!d->literals.empty() && d->literals.find(fileName) != d->literals.end())
+                    return true;
+
+                return d->matchesPattern(fileName);
+            }
+        }
+    }
+}
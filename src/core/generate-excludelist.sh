@@ -7,45 +7,73 @@
 # linuxdeployqt (https://github.com/probonopd/linuxdeployqt).
 #
 # Changed to use C++ standard library containers instead of Qt ones.
+#
+# Generates a C++ header from the excludelist data file. Doesn't need network access, use update-excludelist.sh to
+# fetch the latest version of the excludelist.
+#
+# Usage: generate-excludelist.sh <excludelist> <output header>
 
 set -e
 
-# download excludelist
-blacklisted=($(wget --quiet https://raw.githubusercontent.com/probonopd/AppImages/master/excludelist -O - | sort | uniq | grep -v "^#.*" | grep "[^-\s]"))
+if [ "$#" -ne 2 ]; then
+    echo "Usage: $0 <excludelist> <output header>" >&2
+    exit 2
+fi
+
+input="$1"
+filename="$2"
+
+# strip comments and whitespace, sort bytewise so that the literals can be looked up with a binary search
+entries=$(sed -e 's/#.*$//' -e 's/[[:space:]]//g' "$input" | grep -v '^$' | LC_ALL=C sort -u)
 
 # sanity check
-if [ "$blacklisted" == "" ]; then
-    exit 1;
+if [ "$entries" == "" ]; then
+    echo "Error: excludelist is empty" >&2
+    exit 1
 fi
 
-filename=excludelist.h
+literals=$(echo "$entries" | grep -v '[][*?\\]' || true)
+patterns=$(echo "$entries" | grep '[][*?\\]' || true)
 
-# overwrite existing source file
-cat > "$filename" <<EOF
+# write to temporary file first so that an interrupted run doesn't leave a broken header behind
+cat > "$filename".tmp <<EOF2
 /*
  * List of libraries to exclude for different reasons.
  *
- * Automatically generated from
- * https://raw.githubusercontent.com/probonopd/AppImages/master/excludelist
- *
- * This file shall be committed by the developers occassionally,
- * otherwise systems without access to the internet won't be able to build
- * fully working versions of linuxdeployqt.
- *
- * See https://github.com/probonopd/linuxdeployqt/issues/274 for more
- * information.
+ * Automatically generated from src/core/excludelist, do not edit.
  */
 
-#include <string>
-#include <vector>
+#pragma once
+
+// file names, sorted bytewise, terminated by nullptr
+static const char* const generatedExcludelistLiterals[] = {
+EOF2
+
+# read line by line, as the shell would expand glob patterns in a for loop
+echo "$literals" | while read -r item; do
+    if [ "$item" != "" ]; then
+        echo '    "'"$item"'",' >> "$filename".tmp
+    fi
+done
+
+cat >> "$filename".tmp <<EOF2
+    nullptr
+};
 
-static const std::vector<std::string> generatedExcludelist = {
-EOF
+// glob patterns (fnmatch syntax), terminated by nullptr
+static const char* const generatedExcludelistPatterns[] = {
+EOF2
 
-# Create array
-for item in ${blacklisted[@]:0:${#blacklisted[@]}-1}; do
-    echo -e '    "'"$item"'",' >> "$filename"
+echo "$patterns" | while read -r item; do
+    # escape backslashes for the C++ string literal
+    if [ "$item" != "" ]; then
+        echo '    "'"${item//\\/\\\\}"'",' >> "$filename".tmp
+    fi
 done
-echo -e '    "'"${blacklisted[$((${#blacklisted[@]}-1))]}"'"' >> "$filename"
 
-echo "};" >> "$filename"
+cat >> "$filename".tmp <<EOF2
+    nullptr
+};
+EOF2
+
+mv "$filename".tmp "$filename"
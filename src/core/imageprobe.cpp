@@ -0,0 +1,309 @@
+// system includes
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+// local headers
+#include "linuxdeploy/core/imageprobe.h"
+
+namespace bf = boost::filesystem;
+
+namespace linuxdeploy {
+    namespace core {
+        namespace imageprobe {
+            static const unsigned char pngSignature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+
+            // SVG files might start with long comments or doctypes, but it's not worth reading huge files entirely
+            static const size_t maxTextHeaderSize = 64 * 1024;
+
+            static uint32_t readBigEndian32(const unsigned char* data) {
+                return (static_cast<uint32_t>(data[0]) << 24) | (static_cast<uint32_t>(data[1]) << 16)
+                       | (static_cast<uint32_t>(data[2]) << 8) | static_cast<uint32_t>(data[3]);
+            }
+
+            static uint32_t readLittleEndian(const unsigned char* data, size_t size) {
+                uint32_t value = 0;
+
+                for (size_t i = size; i > 0; i--)
+                    value = (value << 8) | data[i - 1];
+
+                return value;
+            }
+
+            static bool readAt(std::ifstream& ifs, uint64_t offset, unsigned char* buffer, size_t size) {
+                ifs.clear();
+                ifs.seekg(static_cast<std::streamoff>(offset));
+                return static_cast<bool>(ifs.read(reinterpret_cast<char*>(buffer), size));
+            }
+
+            // the IHDR chunk must come first, and contains the dimensions
+            static bool probePng(const unsigned char* header, size_t size, ImageInfo& info) {
+                if (size < 24 || memcmp(header + 12, "IHDR", 4) != 0)
+                    return false;
+
+                info.format = FORMAT_PNG;
+                info.width = readBigEndian32(header + 16);
+                info.height = readBigEndian32(header + 20);
+                return true;
+            }
+
+            // the directory lists all contained images, their size bytes use 0 for 256 and larger
+            // images in PNG format store their actual size in their own header
+            static bool probeIco(std::ifstream& ifs, const unsigned char* header, ImageInfo& info) {
+                const auto count = readLittleEndian(header + 4, 2);
+
+                if (count == 0)
+                    return false;
+
+                info.format = FORMAT_ICO;
+                info.width = info.height = 0;
+
+                for (uint32_t i = 0; i < count; i++) {
+                    unsigned char entry[16];
+
+                    if (!readAt(ifs, 6 + i * sizeof(entry), entry, sizeof(entry)))
+                        return false;
+
+                    unsigned int width = entry[0] == 0 ? 256 : entry[0];
+                    unsigned int height = entry[1] == 0 ? 256 : entry[1];
+
+                    unsigned char embedded[24];
+                    ImageInfo embeddedInfo;
+
+                    if (readAt(ifs, readLittleEndian(entry + 12, 4), embedded, sizeof(embedded))
+                        && memcmp(embedded, pngSignature, sizeof(pngSignature)) == 0
+                        && probePng(embedded, sizeof(embedded), embeddedInfo)) {
+                        width = embeddedInfo.width;
+                        height = embeddedInfo.height;
+                    }
+
+                    if (width > info.width) {
+                        info.width = width;
+                        info.height = height;
+                    }
+                }
+
+                return true;
+            }
+
+            // XPM files are C source files, the first string contains width, height, number of colors and characters
+            // per pixel
+            static bool probeXpm(const std::string& text, ImageInfo& info) {
+                const auto braces = text.find('{');
+                if (braces == std::string::npos)
+                    return false;
+
+                auto pos = braces + 1;
+
+                // skip comments and whitespace before the first string
+                while (pos < text.size() && text[pos] != '"') {
+                    if (text.compare(pos, 2, "/*") == 0) {
+                        pos = text.find("*/", pos + 2);
+                        if (pos == std::string::npos)
+                            return false;
+                        pos += 2;
+                    } else {
+                        pos++;
+                    }
+                }
+
+                if (pos >= text.size())
+                    return false;
+
+                const char* values = text.c_str() + pos + 1;
+                char* end;
+
+                const auto width = strtoul(values, &end, 10);
+                if (end == values)
+                    return false;
+
+                values = end;
+                const auto height = strtoul(values, &end, 10);
+                if (end == values)
+                    return false;
+
+                info.format = FORMAT_XPM;
+                info.width = static_cast<unsigned int>(width);
+                info.height = static_cast<unsigned int>(height);
+                return true;
+            }
+
+            // look up the value of an attribute in an XML start tag
+            static bool findAttribute(const std::string& tag, const std::string& name, std::string& value) {
+                for (size_t pos = tag.find(name); pos != std::string::npos; pos = tag.find(name, pos + 1)) {
+                    // make sure to not match suffixes of other attributes, e.g., stroke-width
+                    if (pos == 0 || !isspace(static_cast<unsigned char>(tag[pos - 1])))
+                        continue;
+
+                    auto i = pos + name.size();
+
+                    while (i < tag.size() && isspace(static_cast<unsigned char>(tag[i])))
+                        i++;
+
+                    if (i >= tag.size() || tag[i] != '=')
+                        continue;
+
+                    i++;
+
+                    while (i < tag.size() && isspace(static_cast<unsigned char>(tag[i])))
+                        i++;
+
+                    if (i >= tag.size() || (tag[i] != '"' && tag[i] != '\''))
+                        continue;
+
+                    const auto end = tag.find(tag[i], i + 1);
+                    if (end == std::string::npos)
+                        return false;
+
+                    value = tag.substr(i + 1, end - i - 1);
+                    return true;
+                }
+
+                return false;
+            }
+
+            // parse SVG length, only absolute lengths in pixels (with or without unit) are supported
+            static bool parseSvgLength(const std::string& value, unsigned int& length) {
+                const char* begin = value.c_str();
+                char* end;
+
+                const auto number = strtod(begin, &end);
+
+                if (end == begin || number <= 0)
+                    return false;
+
+                while (isspace(static_cast<unsigned char>(*end)))
+                    end++;
+
+                if (*end != '\0' && strcmp(end, "px") != 0)
+                    return false;
+
+                length = static_cast<unsigned int>(number + 0.5);
+                return true;
+            }
+
+            static bool probeSvg(const std::string& text, ImageInfo& info) {
+                // find root element, skipping the XML declaration, comments and doctype
+                size_t pos = 0;
+
+                while ((pos = text.find('<', pos)) != std::string::npos) {
+                    if (text.compare(pos, 4, "<!--") == 0) {
+                        pos = text.find("-->", pos);
+                        if (pos == std::string::npos)
+                            return false;
+                        continue;
+                    }
+
+                    if (text.compare(pos, 2, "<?") == 0 || text.compare(pos, 2, "<!") == 0) {
+                        pos++;
+                        continue;
+                    }
+
+                    break;
+                }
+
+                if (pos == std::string::npos || text.compare(pos, 4, "<svg") != 0
+                    || (pos + 4 < text.size() && !isspace(static_cast<unsigned char>(text[pos + 4])) && text[pos + 4] != '>'))
+                    return false;
+
+                const auto tagEnd = text.find('>', pos);
+                if (tagEnd == std::string::npos)
+                    return false;
+
+                const auto tag = text.substr(pos, tagEnd - pos);
+
+                info.format = FORMAT_SVG;
+                info.width = info.height = 0;
+
+                std::string width, height, viewBox;
+
+                if (findAttribute(tag, "width", width) && findAttribute(tag, "height", height)
+                    && parseSvgLength(width, info.width) && parseSvgLength(height, info.height)) {
+                    return true;
+                }
+
+                // fall back to the view box, which is specified in pixels
+                if (findAttribute(tag, "viewBox", viewBox)) {
+                    for (auto& c : viewBox) {
+                        if (c == ',')
+                            c = ' ';
+                    }
+
+                    double values[4];
+                    const char* begin = viewBox.c_str();
+
+                    for (auto& value : values) {
+                        char* end;
+                        value = strtod(begin, &end);
+
+                        if (end == begin)
+                            return true;
+
+                        begin = end;
+                    }
+
+                    if (values[2] > 0 && values[3] > 0) {
+                        info.width = static_cast<unsigned int>(values[2] + 0.5);
+                        info.height = static_cast<unsigned int>(values[3] + 0.5);
+                    }
+                }
+
+                return true;
+            }
+
+            bool probeImage(const bf::path& path, ImageInfo& info) {
+                info.format = FORMAT_UNKNOWN;
+                info.width = info.height = 0;
+
+                std::ifstream ifs(path.string(), std::ios::binary);
+                if (!ifs)
+                    return false;
+
+                unsigned char header[24] = {};
+                ifs.read(reinterpret_cast<char*>(header), sizeof(header));
+                const auto headerSize = static_cast<size_t>(ifs.gcount());
+
+                if (headerSize >= sizeof(pngSignature) && memcmp(header, pngSignature, sizeof(pngSignature)) == 0)
+                    return probePng(header, headerSize, info);
+
+                // reserved field and type 1 (icon)
+                if (headerSize >= 6 && readLittleEndian(header, 2) == 0 && readLittleEndian(header + 2, 2) == 1)
+                    return probeIco(ifs, header, info);
+
+                // the remaining formats are text based
+                std::vector<char> buffer(maxTextHeaderSize);
+                ifs.clear();
+                ifs.seekg(0);
+                ifs.read(buffer.data(), buffer.size());
+
+                const std::string text(buffer.data(), static_cast<size_t>(ifs.gcount()));
+
+                if (text.compare(0, 9, "/* XPM */") == 0)
+                    return probeXpm(text, info);
+
+                if (text.find("<svg") != std::string::npos)
+                    return probeSvg(text, info);
+
+                return false;
+            }
+
+            std::string formatName(ImageFormat format) {
+                switch (format) {
+                    case FORMAT_PNG:
+                        return "PNG";
+                    case FORMAT_XPM:
+                        return "XPM";
+                    case FORMAT_ICO:
+                        return "ICO";
+                    case FORMAT_SVG:
+                        return "SVG";
+                    default:
+                        return "unknown";
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,360 @@
+// system includes
+#include <cstring>
+#include <elf.h>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// local headers
+#include "linuxdeploy/core/ldcache.h"
+#include "linuxdeploy/core/log.h"
+#include "linuxdeploy/core/trace.h"
+
+using namespace linuxdeploy::core::log;
+
+namespace bf = boost::filesystem;
+
+namespace linuxdeploy {
+    namespace core {
+        namespace ldcache {
+            // structures used in /etc/ld.so.cache, see glibc's sysdeps/generic/dl-cache.h
+            static const char oldCacheMagic[] = "ld.so-1.7.0";
+            static const char newCacheMagic[] = "glibc-ld.so.cache1.1";
+
+            struct OldCacheHeader {
+                char magic[sizeof(oldCacheMagic)];
+                uint32_t nlibs;
+            };
+
+            struct OldCacheEntry {
+                int32_t flags;
+                uint32_t key;
+                uint32_t value;
+            };
+
+            struct NewCacheHeader {
+                char magic[sizeof(newCacheMagic) - 1];
+                uint32_t nlibs;
+                uint32_t lenStrings;
+                uint8_t flags;
+                uint8_t padding[3];
+                uint32_t extensionOffset;
+                uint32_t unused[3];
+            };
+
+            struct NewCacheEntry {
+                int32_t flags;
+                uint32_t key;
+                uint32_t value;
+                uint32_t osVersion;
+                uint64_t hwcap;
+            };
+
+            // entries for glibc-hwcaps subdirectories depend on the CPU the program runs on
+            static const uint64_t hwcapExtensionFlag = 1ull << 62;
+
+            class LibraryIndex::PrivateData {
+                public:
+                    // identifies an ELF file's ABI
+                    // class 0 and machine 0 mean the ABI is unknown and needs to be determined from the file
+                    struct CacheEntry {
+                        std::string path;
+                        uint8_t elfClass;
+                        uint16_t elfMachine;
+                    };
+
+                public:
+                    std::mutex mutex;
+
+                    bool cacheRead = false;
+                    std::unordered_map<std::string, std::vector<CacheEntry>> cacheEntries;
+
+                    // memoized results, keyed by the lookup's parameters
+                    // an empty path denotes a negative result
+                    std::unordered_map<std::string, std::string> cacheLookups;
+                    std::unordered_map<std::string, bool> directoryLookups;
+
+                    // ABI of every file probed so far, class 0 denotes non-ELF files
+                    std::unordered_map<std::string, std::pair<uint8_t, uint16_t>> probedFiles;
+
+                    size_t hits = 0;
+                    size_t misses = 0;
+
+                public:
+                    static std::string makeKey(const std::string& name, uint8_t elfClass, uint16_t elfMachine) {
+                        return name + '\0' + std::to_string(elfClass) + ':' + std::to_string(elfMachine);
+                    }
+
+                    // the cache entries' flags describe the ABI, except for the default one of the respective platform
+                    static void decodeFlags(int32_t flags, uint8_t& elfClass, uint16_t& elfMachine) {
+                        elfClass = ELFCLASSNONE;
+                        elfMachine = EM_NONE;
+
+                        switch (flags & 0xff00) {
+                            case 0x0100:
+                                elfClass = ELFCLASS64;
+                                elfMachine = EM_SPARCV9;
+                                break;
+                            case 0x0200:
+                                elfClass = ELFCLASS64;
+                                elfMachine = EM_IA_64;
+                                break;
+                            case 0x0300:
+                                elfClass = ELFCLASS64;
+                                elfMachine = EM_X86_64;
+                                break;
+                            case 0x0400:
+                                elfClass = ELFCLASS64;
+                                elfMachine = EM_S390;
+                                break;
+                            case 0x0500:
+                                elfClass = ELFCLASS64;
+                                elfMachine = EM_PPC64;
+                                break;
+                            case 0x0600:
+                            case 0x0c00:
+                            case 0x0d00:
+                                elfClass = ELFCLASS32;
+                                elfMachine = EM_MIPS;
+                                break;
+                            case 0x0700:
+                            case 0x0e00:
+                                elfClass = ELFCLASS64;
+                                elfMachine = EM_MIPS;
+                                break;
+                            case 0x0800:
+                                elfClass = ELFCLASS32;
+                                elfMachine = EM_X86_64;
+                                break;
+                            case 0x0900:
+                            case 0x0b00:
+                                elfClass = ELFCLASS32;
+                                elfMachine = EM_ARM;
+                                break;
+                            case 0x0a00:
+                                elfClass = ELFCLASS64;
+                                elfMachine = EM_AARCH64;
+                                break;
+                            default:
+                                break;
+                        }
+                    }
+
+                    void readCache() {
+                        if (cacheRead)
+                            return;
+
+                        cacheRead = true;
+
+                        std::ifstream ifs("/etc/ld.so.cache", std::ios::binary);
+                        if (!ifs) {
+                            ldLog() << LD_DEBUG << "Could not open dynamic loader cache" << std::endl;
+                            return;
+                        }
+
+                        const std::string data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+
+                        // the new format may be used standalone, or be embedded after the entries of the old one
+                        size_t newHeaderPos = std::string::npos;
+
+                        if (data.compare(0, sizeof(newCacheMagic) - 1, newCacheMagic) == 0) {
+                            newHeaderPos = 0;
+                        } else if (data.size() >= sizeof(OldCacheHeader) && data.compare(0, sizeof(oldCacheMagic) - 1, oldCacheMagic) == 0) {
+                            OldCacheHeader header;
+                            memcpy(&header, data.data(), sizeof(header));
+
+                            const size_t entriesEnd = sizeof(OldCacheHeader) + static_cast<size_t>(header.nlibs) * sizeof(OldCacheEntry);
+
+                            if (entriesEnd > data.size())
+                                return;
+
+                            newHeaderPos = data.find(newCacheMagic, entriesEnd);
+
+                            // glibc prefers the new format if it's available
+                            if (newHeaderPos == std::string::npos) {
+                                // string offsets are relative to the end of the entries
+                                for (uint32_t i = 0; i < header.nlibs; i++) {
+                                    OldCacheEntry entry;
+                                    memcpy(&entry, data.data() + sizeof(OldCacheHeader) + i * sizeof(OldCacheEntry), sizeof(entry));
+
+                                    addEntry(data, entriesEnd, entry.key, entry.value, entry.flags);
+                                }
+
+                                return;
+                            }
+                        }
+
+                        if (newHeaderPos == std::string::npos || newHeaderPos + sizeof(NewCacheHeader) > data.size()) {
+                            ldLog() << LD_WARNING << "Unsupported dynamic loader cache format" << std::endl;
+                            return;
+                        }
+
+                        NewCacheHeader header;
+                        memcpy(&header, data.data() + newHeaderPos, sizeof(header));
+
+                        if (newHeaderPos + sizeof(NewCacheHeader) + static_cast<size_t>(header.nlibs) * sizeof(NewCacheEntry) > data.size())
+                            return;
+
+                        // string offsets are relative to the beginning of the header
+                        for (uint32_t i = 0; i < header.nlibs; i++) {
+                            NewCacheEntry entry;
+                            memcpy(&entry, data.data() + newHeaderPos + sizeof(NewCacheHeader) + i * sizeof(NewCacheEntry), sizeof(entry));
+
+                            if (entry.hwcap & hwcapExtensionFlag)
+                                continue;
+
+                            addEntry(data, newHeaderPos, entry.key, entry.value, entry.flags);
+                        }
+                    }
+
+                    void addEntry(const std::string& data, size_t stringsBase, uint32_t key, uint32_t value, int32_t flags) {
+                        if (stringsBase + key >= data.size() || stringsBase + value >= data.size())
+                            return;
+
+                        CacheEntry entry;
+                        entry.path = data.c_str() + stringsBase + value;
+                        decodeFlags(flags, entry.elfClass, entry.elfMachine);
+
+                        // the entries are sorted by preference already
+                        cacheEntries[data.c_str() + stringsBase + key].push_back(entry);
+                    }
+
+                    // read ELF class and machine from the file, memoized
+                    std::pair<uint8_t, uint16_t> probe(const std::string& path) {
+                        auto it = probedFiles.find(path);
+                        if (it != probedFiles.end())
+                            return it->second;
+
+                        std::pair<uint8_t, uint16_t> abi(ELFCLASSNONE, EM_NONE);
+
+                        std::ifstream ifs(path, std::ios::binary);
+                        unsigned char ident[EI_NIDENT + 4];
+
+                        if (ifs.read(reinterpret_cast<char*>(ident), sizeof(ident)) && memcmp(ident, ELFMAG, SELFMAG) == 0) {
+                            // e_type and e_machine directly follow e_ident in both classes
+                            uint16_t machine;
+                            memcpy(&machine, ident + EI_NIDENT + 2, sizeof(machine));
+
+                            static const uint16_t byteOrderProbe = 1;
+                            const bool hostIsBigEndian = *reinterpret_cast<const uint8_t*>(&byteOrderProbe) == 0;
+
+                            if ((ident[EI_DATA] == ELFDATA2MSB) != hostIsBigEndian)
+                                machine = static_cast<uint16_t>((machine << 8) | (machine >> 8));
+
+                            abi = std::make_pair(ident[EI_CLASS], machine);
+                        }
+
+                        probedFiles[path] = abi;
+                        return abi;
+                    }
+
+                    bool isCompatible(const std::string& path, uint8_t elfClass, uint16_t elfMachine) {
+                        const auto abi = probe(path);
+                        return abi.first == elfClass && abi.second == elfMachine;
+                    }
+            };
+
+            LibraryIndex::LibraryIndex() {
+                d = new PrivateData();
+            }
+
+            LibraryIndex::~LibraryIndex() {
+                delete d;
+            }
+
+            LibraryIndex& LibraryIndex::getInstance() {
+                static LibraryIndex instance;
+                return instance;
+            }
+
+            bool LibraryIndex::isCompatible(const bf::path& path, uint8_t elfClass, uint16_t elfMachine) {
+                std::lock_guard<std::mutex> lock(d->mutex);
+                return d->isCompatible(path.string(), elfClass, elfMachine);
+            }
+
+            bool LibraryIndex::findInCache(const std::string& name, uint8_t elfClass, uint16_t elfMachine, bf::path& result) {
+                std::lock_guard<std::mutex> lock(d->mutex);
+
+                const auto key = PrivateData::makeKey(name, elfClass, elfMachine);
+
+                auto memoized = d->cacheLookups.find(key);
+                if (memoized != d->cacheLookups.end()) {
+                    d->hits++;
+                    trace::addToCounter(trace::COUNTER_LIBRARY_CACHE_HITS);
+
+                    if (memoized->second.empty())
+                        return false;
+
+                    result = memoized->second;
+                    return true;
+                }
+
+                d->misses++;
+                trace::addToCounter(trace::COUNTER_LIBRARY_CACHE_MISSES);
+                d->readCache();
+
+                std::string found;
+
+                auto entries = d->cacheEntries.find(name);
+                if (entries != d->cacheEntries.end()) {
+                    for (const auto& entry : entries->second) {
+                        // entries without ABI information need to be checked on the file system
+                        const bool compatible = entry.elfClass == ELFCLASSNONE
+                            ? d->isCompatible(entry.path, elfClass, elfMachine)
+                            : (entry.elfClass == elfClass && entry.elfMachine == elfMachine);
+
+                        if (compatible) {
+                            found = entry.path;
+                            break;
+                        }
+                    }
+                }
+
+                d->cacheLookups[key] = found;
+
+                if (found.empty())
+                    return false;
+
+                result = found;
+                return true;
+            }
+
+            bool LibraryIndex::findInDirectory(const bf::path& directory, const std::string& name,
+                                               uint8_t elfClass, uint16_t elfMachine, bf::path& result) {
+                std::lock_guard<std::mutex> lock(d->mutex);
+
+                const auto candidate = directory / name;
+                const auto key = PrivateData::makeKey(candidate.string(), elfClass, elfMachine);
+
+                auto memoized = d->directoryLookups.find(key);
+
+                if (memoized != d->directoryLookups.end()) {
+                    d->hits++;
+                    trace::addToCounter(trace::COUNTER_LIBRARY_CACHE_HITS);
+                } else {
+                    d->misses++;
+                    trace::addToCounter(trace::COUNTER_LIBRARY_CACHE_MISSES);
+                    memoized = d->directoryLookups.emplace(key, d->isCompatible(candidate.string(), elfClass, elfMachine)).first;
+                }
+
+                if (!memoized->second)
+                    return false;
+
+                result = candidate;
+                return true;
+            }
+
+            size_t LibraryIndex::cacheHits() const {
+                std::lock_guard<std::mutex> lock(d->mutex);
+                return d->hits;
+            }
+
+            size_t LibraryIndex::cacheMisses() const {
+                std::lock_guard<std::mutex> lock(d->mutex);
+                return d->misses;
+            }
+        }
+    }
+}
@@ -0,0 +1,311 @@
+// system includes
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// local headers
+#include "linuxdeploy/core/librarystore.h"
+#include "linuxdeploy/core/log.h"
+#include "linuxdeploy/core/sha256.h"
+
+using namespace linuxdeploy::core::log;
+
+namespace bf = boost::filesystem;
+
+// not defined by older kernel headers
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+
+namespace linuxdeploy {
+    namespace core {
+        namespace librarystore {
+            // temporary files older than this are considered leftovers of processes which have been interrupted
+            static const time_t staleTemporaryFileAge = 24 * 60 * 60;
+
+            static const std::string hashSuffix = ".sha256";
+
+            class LibraryStore::PrivateData {
+                public:
+                    const bf::path path;
+
+                public:
+                    explicit PrivateData(const bf::path& path) : path(path) {}
+
+                public:
+                    bf::path objectsPath() const {
+                        return path / "objects";
+                    }
+
+                    bf::path temporaryPath() const {
+                        return path / "tmp";
+                    }
+
+                    bf::path objectPath(const std::string& key) const {
+                        return objectsPath() / key.substr(0, 2) / key;
+                    }
+
+                    static bool createDirectories(const bf::path& directory) {
+                        boost::system::error_code ec;
+                        bf::create_directories(directory, ec);
+
+                        // another process might have created the directory concurrently
+                        return bf::is_directory(directory);
+                    }
+
+                    // unique name next to the given path, used to replace files atomically
+                    static bf::path siblingPath(const bf::path& path) {
+                        static std::atomic<unsigned int> counter(0);
+                        return path.parent_path() / ("." + path.filename().string() + ".linuxdeploy-" + std::to_string(getpid()) + "-" + std::to_string(counter++));
+                    }
+
+                    // create reflink of a file, used if the file can't be hardlinked
+                    static bool cloneFile(const bf::path& from, const bf::path& to) {
+                        int in = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+
+                        if (in < 0)
+                            return false;
+
+                        struct stat st;
+
+                        if (fstat(in, &st) != 0) {
+                            close(in);
+                            return false;
+                        }
+
+                        int out = open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR);
+
+                        if (out < 0) {
+                            close(in);
+                            return false;
+                        }
+
+                        bool success = ioctl(out, FICLONE, in) == 0 && fchmod(out, st.st_mode & 07777) == 0;
+
+                        if (close(out) != 0)
+                            success = false;
+
+                        close(in);
+
+                        if (!success)
+                            unlink(to.c_str());
+
+                        return success;
+                    }
+
+                    // link object to destination, replacing the destination atomically
+                    static bool linkObject(const bf::path& object, const bf::path& destination) {
+                        const auto tempPath = siblingPath(destination);
+
+                        if (link(object.c_str(), tempPath.c_str()) != 0) {
+                            // objects can't be linked across file systems, and the number of links per file is limited
+                            if ((errno != EXDEV && errno != EMLINK) || !cloneFile(object, tempPath))
+                                return false;
+                        }
+
+                        if (rename(tempPath.c_str(), destination.c_str()) != 0) {
+                            unlink(tempPath.c_str());
+                            return false;
+                        }
+
+                        return true;
+                    }
+
+                    static bool writeFile(const bf::path& path, const std::string& contents) {
+                        const auto tempPath = siblingPath(path);
+
+                        {
+                            std::ofstream ofs(tempPath.string());
+
+                            if (!(ofs << contents)) {
+                                unlink(tempPath.c_str());
+                                return false;
+                            }
+                        }
+
+                        if (rename(tempPath.c_str(), path.c_str()) != 0) {
+                            unlink(tempPath.c_str());
+                            return false;
+                        }
+
+                        return true;
+                    }
+
+                    static bool readHash(const bf::path& object, std::string& hash) {
+                        std::ifstream ifs(object.string() + hashSuffix);
+                        return static_cast<bool>(std::getline(ifs, hash)) && hash.size() == 64;
+                    }
+
+                    static bool isHashFile(const bf::path& path) {
+                        const auto name = path.filename().string();
+                        return name.size() > hashSuffix.size() && name.compare(name.size() - hashSuffix.size(), hashSuffix.size(), hashSuffix) == 0;
+                    }
+
+                    // call function for every object in the store
+                    template<typename F> bool forEachObject(F function) const {
+                        boost::system::error_code ec;
+
+                        if (!bf::is_directory(objectsPath()))
+                            return true;
+
+                        for (bf::directory_iterator prefix(objectsPath(), ec), end; !ec && prefix != end; prefix.increment(ec)) {
+                            if (!bf::is_directory(prefix->path()))
+                                continue;
+
+                            for (bf::directory_iterator entry(prefix->path(), ec); !ec && entry != end; entry.increment(ec)) {
+                                const auto& entryPath = entry->path();
+
+                                // temporary files of concurrent writers, see siblingPath()
+                                if (isHashFile(entryPath) || entryPath.filename().string()[0] == '.')
+                                    continue;
+
+                                function(entryPath);
+                            }
+                        }
+
+                        if (ec) {
+                            ldLog() << LD_ERROR << "Failed to list objects in library store" << path << LD_NO_SPACE << ":" << ec.message() << std::endl;
+                            return false;
+                        }
+
+                        return true;
+                    }
+            };
+
+            LibraryStore::LibraryStore(const bf::path& path) {
+                d = new PrivateData(path);
+            }
+
+            LibraryStore::~LibraryStore() {
+                delete d;
+            }
+
+            std::string LibraryStore::objectKey(const std::string& sourceHash, const std::string& rpath, bool stripped) {
+                return sha256::hashString(sourceHash + '\n' + rpath + (stripped ? "\nstripped" : ""));
+            }
+
+            const bf::path& LibraryStore::path() const {
+                return d->path;
+            }
+
+            bool LibraryStore::checkout(const std::string& key, const bf::path& destination) {
+                // the object might be removed by a concurrent garbage collection, in which case linking it fails and the
+                // caller adds it again
+                return PrivateData::linkObject(d->objectPath(key), destination);
+            }
+
+            bool LibraryStore::createTemporaryFile(bf::path& path) {
+                if (!PrivateData::createDirectories(d->temporaryPath())) {
+                    ldLog() << LD_ERROR << "Failed to create directory in library store:" << d->temporaryPath() << std::endl;
+                    return false;
+                }
+
+                std::string tempPath = (d->temporaryPath() / "object.XXXXXX").string();
+
+                const auto fd = mkstemp(&tempPath[0]);
+
+                if (fd < 0) {
+                    ldLog() << LD_ERROR << "Failed to create temporary file in library store" << d->path << LD_NO_SPACE << ":" << strerror(errno) << std::endl;
+                    return false;
+                }
+
+                close(fd);
+
+                path = tempPath;
+                return true;
+            }
+
+            bool LibraryStore::add(const std::string& key, const bf::path& preparedFile, const bf::path& destination) {
+                const auto objectPath = d->objectPath(key);
+
+                std::string hash;
+
+                if (!sha256::hashFile(preparedFile, hash) || !PrivateData::createDirectories(objectPath.parent_path()) ||
+                    !PrivateData::writeFile(objectPath.string() + hashSuffix, hash + "\n")) {
+                    ldLog() << LD_ERROR << "Failed to add file to library store:" << preparedFile << std::endl;
+                    unlink(preparedFile.c_str());
+                    return false;
+                }
+
+                // the destination is linked before the object is published, so that a concurrent garbage collection
+                // never sees the new object unreferenced
+                bool success = PrivateData::linkObject(preparedFile, destination);
+
+                if (success && link(preparedFile.c_str(), objectPath.c_str()) != 0 && errno == EEXIST) {
+                    // another process has been faster, its object is used instead, so that there's a single copy
+                    ldLog() << LD_DEBUG << "Object" << key << "has been added to library store concurrently" << std::endl;
+                    PrivateData::linkObject(objectPath, destination);
+                }
+
+                unlink(preparedFile.c_str());
+
+                return success;
+            }
+
+            bool LibraryStore::collectGarbage(size_t& removedObjects, uint64_t& freedBytes) {
+                removedObjects = 0;
+                freedBytes = 0;
+
+                // the store's own link is the last one once no AppDir references an object any more
+                const bool success = d->forEachObject([&removedObjects, &freedBytes](const bf::path& object) {
+                    struct stat st;
+
+                    if (stat(object.c_str(), &st) != 0 || st.st_nlink > 1)
+                        return;
+
+                    if (unlink(object.c_str()) != 0)
+                        return;
+
+                    unlink((object.string() + hashSuffix).c_str());
+
+                    ldLog() << LD_DEBUG << "Removed unreferenced object" << object << std::endl;
+
+                    removedObjects++;
+                    freedBytes += static_cast<uint64_t>(st.st_size);
+                });
+
+                // temporary files are only removed once they're old enough not to belong to a running process
+                boost::system::error_code ec;
+                const auto now = time(nullptr);
+
+                for (bf::directory_iterator entry(d->temporaryPath(), ec), end; !ec && entry != end; entry.increment(ec)) {
+                    struct stat st;
+
+                    if (stat(entry->path().c_str(), &st) == 0 && now - st.st_mtime > staleTemporaryFileAge && unlink(entry->path().c_str()) == 0)
+                        freedBytes += static_cast<uint64_t>(st.st_size);
+                }
+
+                return success;
+            }
+
+            bool LibraryStore::verify(std::vector<bf::path>& corruptObjects) {
+                corruptObjects.clear();
+
+                return d->forEachObject([&corruptObjects](const bf::path& object) {
+                    std::string expectedHash, actualHash;
+
+                    if (PrivateData::readHash(object, expectedHash) && sha256::hashFile(object, actualHash) && actualHash == expectedHash)
+                        return;
+
+                    struct stat st;
+                    const auto references = stat(object.c_str(), &st) == 0 ? st.st_nlink - 1 : 0;
+
+                    ldLog() << LD_WARNING << "Corrupt object in library store:" << object << LD_NO_SPACE << ", referenced by"
+                            << references << "files" << std::endl;
+
+                    unlink(object.c_str());
+                    unlink((object.string() + hashSuffix).c_str());
+
+                    corruptObjects.push_back(object);
+                });
+            }
+        }
+    }
+}
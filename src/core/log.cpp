@@ -1,118 +1,140 @@
+// system includes
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <string>
+#include <unistd.h>
+
 // local includes
 #include "linuxdeploy/core/log.h"
 
 namespace linuxdeploy {
     namespace core {
         namespace log {
-            LD_LOGLEVEL ldLog::verbosity = LD_INFO;
+            std::atomic<int> ldLog::verbosity(LD_INFO);
 
-            void ldLog::setVerbosity(LD_LOGLEVEL verbosity) {
-                ldLog::verbosity = verbosity;
+            // file descriptor the log is written to
+            // accessed only while holding the mutex, which also serializes the writes of concurrent threads
+            static std::mutex& targetMutex() {
+                static std::mutex mutex;
+                return mutex;
             }
 
-            ldLog::ldLog() {
-                prependSpace = false;
-                currentLogLevel = LD_INFO;
-                logLevelSet = false;
-            };
+            static int targetFd = STDOUT_FILENO;
+            static bool targetFdOwned = false;
 
-            ldLog::ldLog(bool prependSpace, bool logLevelSet, LD_LOGLEVEL logLevel) {
-                this->prependSpace = prependSpace;
-                this->currentLogLevel = logLevel;
-                this->logLevelSet = logLevelSet;
-            }
+            static void writeLine(const std::string& line) {
+                std::lock_guard<std::mutex> lock(targetMutex());
+
+                // the standard streams might be used by other code as well, e.g., to print help texts
+                std::cout.flush();
+
+                for (size_t written = 0; written < line.size();) {
+                    const auto rv = write(targetFd, line.data() + written, line.size() - written);
+
+                    if (rv < 0) {
+                        if (errno == EINTR)
+                            continue;
+
+                        // there's nowhere to report this to
+                        return;
+                    }
 
-            void ldLog::checkPrependSpace() {
-                if (prependSpace) {
-                    stream << " ";
-                    prependSpace = false;
+                    written += static_cast<size_t>(rv);
                 }
             }
 
-            bool ldLog::checkVerbosity() {
-//                std::cerr << "current: " << currentLogLevel << " verbosity: " << verbosity << std::endl;
-                return (currentLogLevel >= verbosity);
-            }
+            // incomplete lines are written when the thread exits
+            struct LineBuffer {
+                std::string data;
 
-            ldLog ldLog::operator<<(const std::string& message) {
-                if (checkVerbosity()) {
-                    checkPrependSpace();
-                    stream << message;
+                ~LineBuffer() {
+                    if (!data.empty())
+                        writeLine(data);
                 }
+            };
 
-                return ldLog(true, logLevelSet, currentLogLevel);
+            static LineBuffer& lineBuffer() {
+                static thread_local LineBuffer buffer;
+                return buffer;
             }
-            ldLog ldLog::operator<<(const char* message) {
-                if (checkVerbosity()) {
-                    checkPrependSpace();
-                    stream << message;
-                }
 
-                return ldLog(true, logLevelSet, currentLogLevel);
-            }
+            static void setTargetFd(int fd, bool owned) {
+                std::lock_guard<std::mutex> lock(targetMutex());
 
-            ldLog ldLog::operator<<(const boost::filesystem::path& path) {
-                if (checkVerbosity()) {
-                    checkPrependSpace();
-                    stream << path.string();
-                }
+                if (targetFdOwned)
+                    close(targetFd);
 
-                return ldLog(true, logLevelSet, currentLogLevel);
+                targetFd = fd;
+                targetFdOwned = owned;
             }
 
-            ldLog ldLog::operator<<(const double val) {
-                return ldLog::operator<<(std::to_string(val));
+            void ldLog::setVerbosity(LD_LOGLEVEL verbosity) {
+                ldLog::verbosity.store(verbosity, std::memory_order_relaxed);
             }
 
-            ldLog ldLog::operator<<(stdEndlType strm) {
-                if (checkVerbosity()) {
-                    checkPrependSpace();
-                    stream << strm;
-                }
-
-                return ldLog(false, logLevelSet, currentLogLevel);
+            void ldLog::setTarget(LD_LOG_TARGET target) {
+                setTargetFd(target == LD_STDERR ? STDERR_FILENO : STDOUT_FILENO, false);
             }
 
-            ldLog ldLog::operator<<(const LD_LOGLEVEL logLevel) {
-                if (logLevelSet) {
-                    throw std::runtime_error(
-                        "log level must be first element passed via the stream insertion operator");
-                }
+            bool ldLog::setLogFile(const boost::filesystem::path& path) {
+                const auto fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
 
-                logLevelSet = true;
-                currentLogLevel = logLevel;
-
-                if (checkVerbosity()) {
-                    switch (logLevel) {
-                        case LD_DEBUG:
-                            stream << "DEBUG: ";
-                            break;
-                        case LD_WARNING:
-                            stream << "WARNING: ";
-                            break;
-                        case LD_ERROR:
-                            stream << "ERROR: ";
-                            break;
-                        default:
-                            break;
-                    }
-                }
+                if (fd < 0)
+                    return false;
 
-                return ldLog(false, logLevelSet, currentLogLevel);
+                setTargetFd(fd, true);
+                return true;
             }
 
-            ldLog ldLog::operator<<(const LD_STREAM_CONTROL streamControl) {
-                bool prependSpace = true;
+            void ldLog::append(const char* data, size_t size) {
+                lineBuffer().data.append(data, size);
+            }
 
-                switch (streamControl) {
-                    case LD_NO_SPACE:
-                        prependSpace = false;
+            void ldLog::appendPrefix() {
+                switch (currentLogLevel) {
+                    case LD_DEBUG:
+                        append("DEBUG: ", 7);
+                        break;
+                    case LD_WARNING:
+                        append("WARNING: ", 9);
+                        break;
+                    case LD_ERROR:
+                        append("ERROR: ", 7);
                         break;
                     default:
                         break;
                 }
+            }
+
+            void ldLog::appendNumber(long long val) {
+                char buffer[32];
+                const auto size = snprintf(buffer, sizeof(buffer), "%lld", val);
+                append(buffer, static_cast<size_t>(size));
+            }
+
+            void ldLog::appendNumber(unsigned long long val) {
+                char buffer[32];
+                const auto size = snprintf(buffer, sizeof(buffer), "%llu", val);
+                append(buffer, static_cast<size_t>(size));
+            }
+
+            void ldLog::appendNumber(double val) {
+                // same format as std::to_string()
+                char buffer[512];
+                const auto size = snprintf(buffer, sizeof(buffer), "%f", val);
+                append(buffer, std::min(static_cast<size_t>(size), sizeof(buffer) - 1));
+            }
+
+            void ldLog::endLine() {
+                auto& buffer = lineBuffer();
 
-                return ldLog(prependSpace, logLevelSet, currentLogLevel);
+                buffer.data += '\n';
+                writeLine(buffer.data);
+                buffer.data.clear();
             }
         }
     }
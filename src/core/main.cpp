@@ -1,4 +1,5 @@
 // system headers
+#include <fstream>
 #include <glob.h>
 #include <iostream>
 
@@ -7,9 +8,14 @@
 
 // local headers
 #include "linuxdeploy/core/appdir.h"
+#include "linuxdeploy/core/batch.h"
 #include "linuxdeploy/core/desktopfile.h"
 #include "linuxdeploy/core/elf.h"
+#include "linuxdeploy/core/elfcache.h"
+#include "linuxdeploy/core/librarystore.h"
 #include "linuxdeploy/core/log.h"
+#include "linuxdeploy/core/trace.h"
+#include "linuxdeploy/core/util.h"
 
 using namespace linuxdeploy::core;
 using namespace linuxdeploy::core::log;
@@ -24,6 +30,8 @@ int main(int argc, char** argv) {
     args::HelpFlag help(parser, "help", "Display this help text.", {'h', "help"});
     args::Flag showVersion(parser, "", "Print version and exit", {'V', "version"});
     args::ValueFlag<int> verbosity(parser, "verbosity", "Verbosity of log output (0 = debug, 1 = info, 2 = warning, 3 = error)", {'v', "verbosity"});
+    args::Flag logToStderr(parser, "", "Write log output to stderr instead of stdout", {"log-to-stderr"});
+    args::ValueFlag<std::string> logFilePath(parser, "file", "Write log output to file instead of stdout", {"log-file"});
 
     args::Flag initAppDir(parser, "", "Create basic AppDir structure", {"init-appdir"});
     args::ValueFlag<std::string> appDirPath(parser, "appdir", "Path to target AppDir", {"appdir"});
@@ -37,6 +45,31 @@ int main(int argc, char** argv) {
     args::Flag createDesktopFile(parser, "", "Create basic desktop file that is good enough for some tests", {"create-desktop-file"});
 
     args::ValueFlagList<std::string> iconPaths(parser, "icon file", "Icon to deploy", {'i', "icon-file"});
+    args::ValueFlag<std::string> iconSourcePath(parser, "icon file", "High resolution PNG or SVG icon to generate icons in all standard sizes from", {"icon-source"});
+
+    args::ValueFlagList<std::string> manifestPaths(parser, "file", "List of files to deploy, either one entry per line (type, source, and optionally destination directory and rpath, separated by tabs) or JSON; use - to read from stdin", {"manifest"});
+
+    args::ValueFlagList<std::string> excludelistPaths(parser, "file", "Additional excludelist (one library file name or glob pattern per line)", {"excludelist"});
+
+    args::ValueFlag<int> jobs(parser, "jobs", "Number of files to copy and patch in parallel (default: number of CPUs)", {'j', "jobs"});
+
+    args::ValueFlag<std::string> deployMode(parser, "mode", "How to put files into the AppDir: copy (default), hardlink (falls back to copying when linking isn't possible or a file needs to be patched), or store (links files to a library store, see --library-store)", {"deploy-mode"});
+
+    args::ValueFlag<std::string> libraryStorePath(parser, "directory", "Library store shared between AppDirs, which files are linked to (implies --deploy-mode store)", {"library-store"});
+    args::Flag collectStoreGarbage(parser, "", "Remove objects no AppDir links to any more from the library store, and exit", {"library-store-gc"});
+    args::Flag verifyStore(parser, "", "Check the integrity of the library store, remove corrupt objects, and exit", {"library-store-verify"});
+
+    args::Flag stripDebugInfo(parser, "", "Remove debug information and symbol tables from the deployed ELF files", {"strip"});
+    args::ValueFlag<std::string> splitDebugPath(parser, "directory", "Move debug information and symbol tables of the deployed ELF files into debug files in directory (outside the AppDir), named after their build IDs", {"split-debug"});
+
+    args::ValueFlag<std::string> archivePath(parser, "file", "Write the AppDir into a gzip compressed tar archive while deploying the files", {"archive"});
+    args::Flag archiveOnly(parser, "", "Write the deployed files into the archive only, not into the AppDir (requires --archive)", {"archive-only"});
+
+    args::Flag useLdd(parser, "", "Use ldd to trace dependencies instead of the built-in resolver", {"use-ldd"});
+
+    args::Flag disableElfCache(parser, "", "Don't use the cache of ELF file information in the user's cache directory", {"disable-elf-cache"});
+
+    args::ValueFlag<std::string> traceFilePath(parser, "file", "Write timings of the deployment steps to file in Chrome trace event format, and print a summary", {"trace-file"});
 
     try {
         parser.ParseCLI(argc, argv);
@@ -57,9 +90,99 @@ int main(int argc, char** argv) {
         ldLog::setVerbosity((LD_LOGLEVEL) verbosity.Get());
     }
 
+    if (logToStderr)
+        ldLog::setTarget(LD_STDERR);
+
+    if (logFilePath && !ldLog::setLogFile(logFilePath.Get())) {
+        std::cerr << "Failed to open log file: " << logFilePath.Get() << std::endl;
+        return 1;
+    }
+
     if (showVersion)
         return 0;
 
+    // the trace is written on every exit path, as traces of failed runs are just as interesting
+    struct TraceWriter {
+        std::string path;
+
+        ~TraceWriter() {
+            if (path.empty())
+                return;
+
+            ldLog() << std::endl << "-- Trace summary --" << std::endl;
+            trace::logSummary();
+
+            if (!trace::writeChromeTrace(path))
+                ldLog() << LD_ERROR << "Failed to write trace file:" << path << std::endl;
+        }
+    } traceWriter;
+
+    if (traceFilePath) {
+        traceWriter.path = traceFilePath.Get();
+        trace::enable();
+    }
+
+    if (useLdd)
+        elf::ElfFile::setUseLdd(true);
+
+    // the information collected so far is valid regardless of the outcome, therefore the cache is saved on every exit
+    // path
+    struct ElfCacheWriter {
+        bool enabled = false;
+
+        ~ElfCacheWriter() {
+            if (enabled)
+                elfcache::ElfCache::getInstance().save();
+        }
+    } elfCacheWriter;
+
+    if (!disableElfCache) {
+        const auto cacheDirectory = util::getCacheDirectory();
+
+        if (!cacheDirectory.empty()) {
+            elfcache::ElfCache::getInstance().enable(cacheDirectory);
+            elfCacheWriter.enabled = true;
+        }
+    }
+
+    // maintenance of the library store doesn't involve any AppDir
+    if (collectStoreGarbage || verifyStore) {
+        if (!libraryStorePath) {
+            std::cerr << "--library-store parameter required" << std::endl;
+            return 1;
+        }
+
+        librarystore::LibraryStore libraryStore(libraryStorePath.Get());
+
+        if (verifyStore) {
+            ldLog() << std::endl << "-- Verifying library store --" << std::endl;
+
+            std::vector<bf::path> corruptObjects;
+
+            if (!libraryStore.verify(corruptObjects))
+                return 1;
+
+            if (!corruptObjects.empty()) {
+                ldLog() << LD_ERROR << "Removed" << corruptObjects.size() << "corrupt objects from library store, AppDirs linking to them need to be deployed again" << std::endl;
+                return 1;
+            }
+        }
+
+        if (collectStoreGarbage) {
+            ldLog() << std::endl << "-- Collecting garbage in library store --" << std::endl;
+
+            size_t removedObjects;
+            uint64_t freedBytes;
+
+            if (!libraryStore.collectGarbage(removedObjects, freedBytes))
+                return 1;
+
+            ldLog() << "Removed" << removedObjects << "objects, freed" << freedBytes << "bytes" << std::endl;
+        }
+
+        return 0;
+    }
+
     if (!appDirPath) {
         std::cerr << "--appdir parameter required" << std::endl;
         return 1;
@@ -67,6 +190,76 @@ int main(int argc, char** argv) {
 
     appdir::AppDir appDir(appDirPath.Get());
 
+    for (const auto& excludelistPath : excludelistPaths.Get()) {
+        if (!appDir.excludelist().addFromFile(excludelistPath))
+            return 1;
+    }
+
+    if (jobs) {
+        if (jobs.Get() < 1) {
+            std::cerr << "--jobs must be at least 1" << std::endl;
+            return 1;
+        }
+
+        appDir.setNumberOfJobs(static_cast<size_t>(jobs.Get()));
+    }
+
+    if (deployMode) {
+        if (deployMode.Get() == "copy") {
+            appDir.setDeployMode(appdir::DEPLOY_COPY);
+        } else if (deployMode.Get() == "hardlink") {
+            appDir.setDeployMode(appdir::DEPLOY_HARDLINK);
+        } else if (deployMode.Get() == "store") {
+            if (!libraryStorePath) {
+                std::cerr << "--deploy-mode store requires --library-store" << std::endl;
+                return 1;
+            }
+        } else {
+            std::cerr << "Invalid deploy mode: " << deployMode.Get() << std::endl;
+            return 1;
+        }
+    }
+
+    if (libraryStorePath) {
+        if (deployMode && deployMode.Get() != "store") {
+            std::cerr << "--library-store can only be used with --deploy-mode store" << std::endl;
+            return 1;
+        }
+
+        appDir.setLibraryStore(libraryStorePath.Get());
+        appDir.setDeployMode(appdir::DEPLOY_STORE);
+    }
+
+    if (stripDebugInfo && splitDebugPath) {
+        std::cerr << "--strip and --split-debug are mutually exclusive" << std::endl;
+        return 1;
+    }
+
+    if (stripDebugInfo)
+        appDir.setDebugInfoMode(appdir::DEBUG_INFO_STRIP);
+
+    if (splitDebugPath) {
+        const auto debugDirectory = bf::absolute(splitDebugPath.Get());
+        const auto absoluteAppDirPath = bf::absolute(appDirPath.Get()).string() + "/";
+
+        // debug files in the AppDir would end up in the final image
+        if ((debugDirectory.string() + "/").compare(0, absoluteAppDirPath.size(), absoluteAppDirPath) == 0) {
+            std::cerr << "--split-debug directory must be outside the AppDir" << std::endl;
+            return 1;
+        }
+
+        appDir.setDebugInfoMode(appdir::DEBUG_INFO_SPLIT, debugDirectory);
+    }
+
+    if (archiveOnly && !archivePath) {
+        std::cerr << "--archive-only requires --archive" << std::endl;
+        return 1;
+    }
+
+    // the files are streamed into the archive by the deferred operations, the rest of the AppDir is added at the end
+    if (archivePath && !appDir.setArchiveOutput(archivePath.Get(), !archiveOnly))
+        return 1;
+
     if (appName) {
         ldLog() << std::endl << "-- Deploying application \"" << LD_NO_SPACE << appName.Get() << LD_NO_SPACE << "\" --" << std::endl;
     }
@@ -75,6 +268,8 @@ int main(int argc, char** argv) {
     if (initAppDir) {
         ldLog() << std::endl << "-- Creating basic AppDir structure --" << std::endl;
 
+        trace::Span span("create AppDir structure");
+
         if (!appDir.createBasicStructure())
             return 1;
     }
@@ -83,6 +278,8 @@ int main(int argc, char** argv) {
     if (sharedLibraryPaths) {
         ldLog() << std::endl << "-- Deploying shared libraries --" << std::endl;
 
+        trace::Span span("deploy libraries");
+
         for (const auto& libraryPath : sharedLibraryPaths.Get()) {
             if (!bf::exists(libraryPath)) {
                 std::cerr << "No such file or directory: " << libraryPath << std::endl;
@@ -100,6 +297,8 @@ int main(int argc, char** argv) {
     if (executablePaths) {
         ldLog() << std::endl << "-- Deploying executables --" << std::endl;
 
+        trace::Span span("deploy executables");
+
         for (const auto& executablePath : executablePaths.Get()) {
             if (!bf::exists(executablePath)) {
                 std::cerr << "No such file or directory: " << executablePath << std::endl;
@@ -113,9 +312,23 @@ int main(int argc, char** argv) {
         }
     }
 
-    if (iconPaths) {
+    if (iconPaths || iconSourcePath) {
         ldLog() << std::endl << "-- Deploying icons --" << std::endl;
 
+        trace::Span span("deploy icons");
+
+        if (iconSourcePath) {
+            if (!bf::exists(iconSourcePath.Get())) {
+                std::cerr << "No such file or directory: " << iconSourcePath.Get() << std::endl;
+                return 1;
+            }
+
+            if (!appDir.deployIconFromSource(iconSourcePath.Get())) {
+                std::cerr << "Failed to generate icons from: " << iconSourcePath.Get() << std::endl;
+                return 1;
+            }
+        }
+
         for (const auto& iconPath : iconPaths.Get()) {
             if (!bf::exists(iconPath)) {
                 std::cerr << "No such file or directory: " << iconPath << std::endl;
@@ -132,6 +345,8 @@ int main(int argc, char** argv) {
     if (desktopFilePaths) {
         ldLog() << std::endl << "-- Deploying desktop files --" << std::endl;
 
+        trace::Span span("deploy desktop files");
+
         for (const auto& desktopFilePath : desktopFilePaths.Get()) {
             if (!bf::exists(desktopFilePath)) {
                 std::cerr << "No such file or directory: " << desktopFilePath << std::endl;
@@ -147,10 +362,86 @@ int main(int argc, char** argv) {
         }
     }
 
+    // all entries share the AppDir's duplicate check and dependency graph, so that common dependencies are only traced
+    // and deployed once
+    if (manifestPaths) {
+        ldLog() << std::endl << "-- Deploying files from manifest --" << std::endl;
+
+        trace::Span span("deploy files from manifest");
+
+        auto deployEntry = [&appDir](const batch::Entry& entry) {
+            if (!bf::exists(entry.source)) {
+                std::cerr << "No such file or directory: " << entry.source.string() << std::endl;
+                return false;
+            }
+
+            bool success;
+
+            switch (entry.type) {
+                case batch::ENTRY_LIBRARY:
+                    success = entry.destination.empty() && entry.rpath.empty()
+                        ? appDir.deployLibrary(entry.source)
+                        : appDir.deployLibrary(entry.source, entry.destination.empty() ? "usr/lib" : entry.destination, entry.rpath);
+                    break;
+                case batch::ENTRY_EXECUTABLE:
+                    success = entry.destination.empty() && entry.rpath.empty()
+                        ? appDir.deployExecutable(entry.source)
+                        : appDir.deployExecutable(entry.source, entry.destination.empty() ? "usr/bin" : entry.destination, entry.rpath);
+                    break;
+                case batch::ENTRY_ICON:
+                case batch::ENTRY_DESKTOP_FILE:
+                    if (!entry.destination.empty() || !entry.rpath.empty()) {
+                        ldLog() << LD_ERROR << "Destination and rpath are only supported for libraries and executables:" << entry.source << std::endl;
+                        return false;
+                    }
+
+                    success = entry.type == batch::ENTRY_ICON
+                        ? appDir.deployIcon(entry.source)
+                        : appDir.deployDesktopFile(desktopfile::DesktopFile(entry.source));
+                    break;
+                default:
+                    success = false;
+                    break;
+            }
+
+            if (!success)
+                std::cerr << "Failed to deploy file from manifest: " << entry.source.string() << std::endl;
+
+            return success;
+        };
+
+        for (const auto& manifestPath : manifestPaths.Get()) {
+            bool success;
+
+            if (manifestPath == "-") {
+                success = batch::readEntries(std::cin, deployEntry);
+            } else {
+                std::ifstream ifs(manifestPath);
+
+                if (!ifs) {
+                    std::cerr << "Failed to open manifest: " << manifestPath << std::endl;
+                    return 1;
+                }
+
+                success = batch::readEntries(ifs, deployEntry);
+            }
+
+            if (!success) {
+                std::cerr << "Failed to deploy files from manifest: " << manifestPath << std::endl;
+                return 1;
+            }
+        }
+    }
+
     // perform deferred copy operations before creating other files here or trying to copy the files to the AppDir root
-    ldLog() << std::endl << "-- Copying files into AppDir --" << std::endl;
-    if (!appDir.executeDeferredOperations()) {
-        return 1;
+    {
+        ldLog() << std::endl << "-- Copying files into AppDir --" << std::endl;
+
+        trace::Span span("copy files into AppDir");
+
+        if (!appDir.executeDeferredOperations()) {
+            return 1;
+        }
     }
 
     if (createDesktopFile) {
@@ -161,6 +452,8 @@ int main(int argc, char** argv) {
 
         ldLog() << std::endl << "-- Creating desktop file --" << std::endl;
 
+        trace::Span span("create desktop file");
+
         auto executableName = bf::path(executablePaths.Get().front()).filename().string();
 
         auto desktopFilePath = appDir.path() / "usr/share/applications" / (executableName + ".desktop");
@@ -186,19 +479,31 @@ int main(int argc, char** argv) {
     {
         ldLog() << std::endl << "-- Deploying files into AppDir root directory --" << std::endl;
 
-        auto deployedDesktopFiles = appDir.deployedDesktopFiles();
+        trace::Span span("create links in AppDir root");
 
-        if (deployedDesktopFiles.empty()) {
+        const auto deployedDesktopFilePaths = appDir.deployedDesktopFilePaths();
+
+        if (deployedDesktopFilePaths.empty()) {
             ldLog() << LD_WARNING << "Could not find desktop file in AppDir, cannot create links for AppRun, desktop file and icon in AppDir root" << std::endl;
         } else {
-            auto& desktopFile = deployedDesktopFiles[0];
+            // only the desktop file which is actually used needs to be parsed
+            desktopfile::DesktopFile desktopFile(deployedDesktopFilePaths[0]);
 
-            ldLog() << "Deploying desktop file:" << desktopFile.path();
+            ldLog() << "Deploying desktop file:" << desktopFile.path() << std::endl;
 
             if (!appDir.createLinksInAppDirRoot(desktopFile))
                 return 1;
         }
     }
 
+    if (archivePath) {
+        ldLog() << std::endl << "-- Writing archive --" << std::endl;
+
+        trace::Span span("write archive");
+
+        if (!appDir.finishArchive())
+            return 1;
+    }
+
     return 0;
 }
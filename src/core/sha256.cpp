@@ -0,0 +1,190 @@
+// system includes
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+
+// local headers
+#include "linuxdeploy/core/sha256.h"
+
+namespace bf = boost::filesystem;
+
+namespace linuxdeploy {
+    namespace core {
+        namespace sha256 {
+            static const uint32_t roundConstants[64] = {
+                0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+                0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+                0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+                0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+                0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+                0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+                0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+                0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+            };
+
+            static inline uint32_t rotateRight(uint32_t value, unsigned int bits) {
+                return (value >> bits) | (value << (32 - bits));
+            }
+
+            class Hash::PrivateData {
+                public:
+                    uint32_t state[8] = {
+                        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+                    };
+
+                    uint8_t block[64];
+                    size_t blockSize = 0;
+                    uint64_t totalSize = 0;
+
+                public:
+                    void processBlock(const uint8_t* data) {
+                        uint32_t w[64];
+
+                        for (int i = 0; i < 16; i++) {
+                            w[i] = (static_cast<uint32_t>(data[i * 4]) << 24) | (static_cast<uint32_t>(data[i * 4 + 1]) << 16)
+                                   | (static_cast<uint32_t>(data[i * 4 + 2]) << 8) | static_cast<uint32_t>(data[i * 4 + 3]);
+                        }
+
+                        for (int i = 16; i < 64; i++) {
+                            const auto s0 = rotateRight(w[i - 15], 7) ^ rotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+                            const auto s1 = rotateRight(w[i - 2], 17) ^ rotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+                            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+                        }
+
+                        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+                        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+                        for (int i = 0; i < 64; i++) {
+                            const auto s1 = rotateRight(e, 6) ^ rotateRight(e, 11) ^ rotateRight(e, 25);
+                            const auto ch = (e & f) ^ (~e & g);
+                            const auto temp1 = h + s1 + ch + roundConstants[i] + w[i];
+                            const auto s0 = rotateRight(a, 2) ^ rotateRight(a, 13) ^ rotateRight(a, 22);
+                            const auto maj = (a & b) ^ (a & c) ^ (b & c);
+                            const auto temp2 = s0 + maj;
+
+                            h = g;
+                            g = f;
+                            f = e;
+                            e = d + temp1;
+                            d = c;
+                            c = b;
+                            b = a;
+                            a = temp1 + temp2;
+                        }
+
+                        state[0] += a;
+                        state[1] += b;
+                        state[2] += c;
+                        state[3] += d;
+                        state[4] += e;
+                        state[5] += f;
+                        state[6] += g;
+                        state[7] += h;
+                    }
+            };
+
+            Hash::Hash() {
+                d = new PrivateData();
+            }
+
+            Hash::~Hash() {
+                delete d;
+            }
+
+            void Hash::update(const void* data, size_t size) {
+                auto* bytes = static_cast<const uint8_t*>(data);
+
+                d->totalSize += size;
+
+                // fill up partial block first
+                if (d->blockSize > 0) {
+                    const auto count = std::min(size, sizeof(d->block) - d->blockSize);
+                    memcpy(d->block + d->blockSize, bytes, count);
+
+                    d->blockSize += count;
+                    bytes += count;
+                    size -= count;
+
+                    if (d->blockSize < sizeof(d->block))
+                        return;
+
+                    d->processBlock(d->block);
+                    d->blockSize = 0;
+                }
+
+                for (; size >= sizeof(d->block); bytes += sizeof(d->block), size -= sizeof(d->block))
+                    d->processBlock(bytes);
+
+                memcpy(d->block, bytes, size);
+                d->blockSize = size;
+            }
+
+            std::string Hash::hexDigest() {
+                const uint64_t totalBits = d->totalSize * 8;
+
+                // padding: a single 1 bit, zeroes, and the message length in bits as 64-bit big endian integer
+                uint8_t padding[72] = {0x80};
+                const size_t paddingSize = (d->blockSize < 56 ? 56 : 120) - d->blockSize;
+
+                for (int i = 0; i < 8; i++)
+                    padding[paddingSize + i] = static_cast<uint8_t>(totalBits >> (56 - i * 8));
+
+                update(padding, paddingSize + 8);
+
+                static const char hexDigits[] = "0123456789abcdef";
+
+                std::string digest;
+                digest.reserve(64);
+
+                for (const auto word : d->state) {
+                    for (int shift = 28; shift >= 0; shift -= 4)
+                        digest += hexDigits[(word >> shift) & 0xf];
+                }
+
+                return digest;
+            }
+
+            std::string hashString(const std::string& data) {
+                Hash hash;
+                hash.update(data.data(), data.size());
+                return hash.hexDigest();
+            }
+
+            bool hashFile(const bf::path& path, std::string& hexDigest) {
+                int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+                if (fd < 0)
+                    return false;
+
+                Hash hash;
+                std::vector<char> buffer(1024 * 1024);
+
+                while (true) {
+                    const auto bytesRead = read(fd, buffer.data(), buffer.size());
+
+                    if (bytesRead < 0) {
+                        if (errno == EINTR)
+                            continue;
+
+                        close(fd);
+                        return false;
+                    }
+
+                    if (bytesRead == 0)
+                        break;
+
+                    hash.update(buffer.data(), static_cast<size_t>(bytesRead));
+                }
+
+                close(fd);
+
+                hexDigest = hash.hexDigest();
+                return true;
+            }
+        }
+    }
+}
@@ -0,0 +1,114 @@
+// system includes
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// local headers
+#include "linuxdeploy/core/threadpool.h"
+
+namespace linuxdeploy {
+    namespace core {
+        namespace threadpool {
+            class ThreadPool::PrivateData {
+                public:
+                    size_t numberOfThreads;
+                    std::vector<std::thread> workers;
+
+                    std::mutex mutex;
+                    std::condition_variable taskAvailable;
+                    std::condition_variable allTasksDone;
+
+                    std::deque<std::function<void()>> tasks;
+
+                    // number of tasks which are queued or running
+                    size_t pendingTasks = 0;
+                    bool terminate = false;
+
+                public:
+                    void work() {
+                        while (true) {
+                            std::function<void()> task;
+
+                            {
+                                std::unique_lock<std::mutex> lock(mutex);
+                                taskAvailable.wait(lock, [this]() { return terminate || !tasks.empty(); });
+
+                                if (tasks.empty())
+                                    return;
+
+                                task = std::move(tasks.front());
+                                tasks.pop_front();
+                            }
+
+                            task();
+
+                            {
+                                std::lock_guard<std::mutex> lock(mutex);
+
+                                if (--pendingTasks == 0)
+                                    allTasksDone.notify_all();
+                            }
+                        }
+                    }
+            };
+
+            ThreadPool::ThreadPool(size_t numberOfThreads) {
+                d = new PrivateData();
+                d->numberOfThreads = numberOfThreads < 1 ? 1 : numberOfThreads;
+
+                if (d->numberOfThreads > 1) {
+                    for (size_t i = 0; i < d->numberOfThreads; i++)
+                        d->workers.emplace_back(&PrivateData::work, d);
+                }
+            }
+
+            ThreadPool::~ThreadPool() {
+                wait();
+
+                {
+                    std::lock_guard<std::mutex> lock(d->mutex);
+                    d->terminate = true;
+                }
+
+                d->taskAvailable.notify_all();
+
+                for (auto& worker : d->workers)
+                    worker.join();
+
+                delete d;
+            }
+
+            size_t ThreadPool::defaultNumberOfThreads() {
+                // hardware_concurrency() may return 0 if the value is not computable
+                const auto concurrency = std::thread::hardware_concurrency();
+                return concurrency > 0 ? concurrency : 1;
+            }
+
+            void ThreadPool::submit(std::function<void()> task) {
+                if (d->workers.empty()) {
+                    task();
+                    return;
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(d->mutex);
+                    d->tasks.push_back(std::move(task));
+                    d->pendingTasks++;
+                }
+
+                d->taskAvailable.notify_one();
+            }
+
+            void ThreadPool::wait() {
+                std::unique_lock<std::mutex> lock(d->mutex);
+                d->allTasksDone.wait(lock, [this]() { return d->pendingTasks == 0; });
+            }
+
+            size_t ThreadPool::numberOfThreads() const {
+                return d->numberOfThreads;
+            }
+        }
+    }
+}
@@ -0,0 +1,246 @@
+// system includes
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unistd.h>
+#include <vector>
+
+// local headers
+#include "linuxdeploy/core/log.h"
+#include "linuxdeploy/core/trace.h"
+
+using namespace linuxdeploy::core::log;
+
+namespace bf = boost::filesystem;
+
+namespace linuxdeploy {
+    namespace core {
+        namespace trace {
+            std::atomic<bool> enabled(false);
+
+            static const char* const counterNames[NUMBER_OF_COUNTERS] = {
+                "bytes copied",
+                "files copied",
+                "files linked",
+                "files unchanged",
+                "subprocesses",
+                "library cache hits",
+                "library cache misses",
+                "icon cache hits",
+                "ELF cache hits",
+                "ELF cache misses",
+                "library store hits",
+                "library store misses",
+                "bytes stripped",
+            };
+
+            static std::atomic<uint64_t> counters[NUMBER_OF_COUNTERS];
+
+            struct Event {
+                const char* name;
+                std::string detail;
+
+                // microseconds since tracing has been enabled
+                int64_t start;
+                int64_t duration;
+            };
+
+            // events recorded by a single thread
+            // the buffers outlive their threads, so that events of finished threads can still be exported
+            struct ThreadBuffer {
+                uint32_t threadId;
+
+                // only contended while the events are exported
+                std::mutex mutex;
+                std::vector<Event> events;
+            };
+
+            static std::mutex registryMutex;
+            static std::vector<std::shared_ptr<ThreadBuffer>> threadBuffers;
+
+            static std::chrono::steady_clock::time_point epoch;
+
+            static int64_t now() {
+                return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch).count();
+            }
+
+            static ThreadBuffer& threadBuffer() {
+                static thread_local std::shared_ptr<ThreadBuffer> buffer;
+
+                if (buffer == nullptr) {
+                    buffer = std::make_shared<ThreadBuffer>();
+
+                    std::lock_guard<std::mutex> lock(registryMutex);
+                    buffer->threadId = static_cast<uint32_t>(threadBuffers.size() + 1);
+                    threadBuffers.push_back(buffer);
+                }
+
+                return *buffer;
+            }
+
+            void enable() {
+                epoch = std::chrono::steady_clock::now();
+                enabled.store(true);
+            }
+
+            void addToCounterImpl(Counter counter, uint64_t value) {
+                counters[counter].fetch_add(value, std::memory_order_relaxed);
+            }
+
+            void Span::begin() {
+                start = now();
+            }
+
+            void Span::end() {
+                const auto duration = now() - start;
+
+                auto& buffer = threadBuffer();
+
+                std::lock_guard<std::mutex> lock(buffer.mutex);
+                buffer.events.push_back({name, std::move(detail), start, duration});
+            }
+
+            static std::string escapeJson(const std::string& value) {
+                std::string escaped;
+                escaped.reserve(value.size());
+
+                for (const auto c : value) {
+                    switch (c) {
+                        case '"':
+                            escaped += "\\\"";
+                            break;
+                        case '\\':
+                            escaped += "\\\\";
+                            break;
+                        case '\n':
+                            escaped += "\\n";
+                            break;
+                        case '\t':
+                            escaped += "\\t";
+                            break;
+                        default:
+                            if (static_cast<unsigned char>(c) < 0x20) {
+                                char buffer[8];
+                                snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                                escaped += buffer;
+                            } else {
+                                escaped += c;
+                            }
+                            break;
+                    }
+                }
+
+                return escaped;
+            }
+
+            bool writeChromeTrace(const bf::path& path) {
+                std::ofstream ofs(path.string());
+
+                if (!ofs)
+                    return false;
+
+                const auto pid = getpid();
+
+                ofs << "{\"traceEvents\":[" << std::endl;
+
+                bool first = true;
+
+                auto separator = [&first, &ofs]() {
+                    if (!first)
+                        ofs << "," << std::endl;
+                    first = false;
+                };
+
+                std::lock_guard<std::mutex> registryLock(registryMutex);
+
+                for (const auto& buffer : threadBuffers) {
+                    std::lock_guard<std::mutex> lock(buffer->mutex);
+
+                    for (const auto& event : buffer->events) {
+                        separator();
+
+                        ofs << "{\"name\":\"" << escapeJson(event.name) << "\",\"cat\":\"linuxdeploy\",\"ph\":\"X\""
+                            << ",\"ts\":" << event.start << ",\"dur\":" << event.duration
+                            << ",\"pid\":" << pid << ",\"tid\":" << buffer->threadId;
+
+                        if (!event.detail.empty())
+                            ofs << ",\"args\":{\"detail\":\"" << escapeJson(event.detail) << "\"}";
+
+                        ofs << "}";
+                    }
+                }
+
+                // counters are only recorded as totals, therefore they're emitted once at the end of the trace
+                const auto end = now();
+
+                for (int i = 0; i < NUMBER_OF_COUNTERS; i++) {
+                    separator();
+
+                    ofs << "{\"name\":\"" << counterNames[i] << "\",\"cat\":\"linuxdeploy\",\"ph\":\"C\",\"ts\":" << end
+                        << ",\"pid\":" << pid << ",\"tid\":0,\"args\":{\"value\":" << counters[i].load() << "}}";
+                }
+
+                ofs << std::endl << "]}" << std::endl;
+
+                return static_cast<bool>(ofs);
+            }
+
+            void logSummary() {
+                struct Totals {
+                    uint64_t count;
+                    int64_t total;
+                    int64_t max;
+                };
+
+                std::map<std::string, Totals> totalsByName;
+
+                {
+                    std::lock_guard<std::mutex> registryLock(registryMutex);
+
+                    for (const auto& buffer : threadBuffers) {
+                        std::lock_guard<std::mutex> lock(buffer->mutex);
+
+                        for (const auto& event : buffer->events) {
+                            auto& totals = totalsByName[event.name];
+                            totals.count++;
+                            totals.total += event.duration;
+                            totals.max = std::max(totals.max, event.duration);
+                        }
+                    }
+                }
+
+                std::vector<std::pair<std::string, Totals>> sorted(totalsByName.begin(), totalsByName.end());
+
+                std::sort(sorted.begin(), sorted.end(), [](const std::pair<std::string, Totals>& a, const std::pair<std::string, Totals>& b) {
+                    return a.second.total > b.second.total;
+                });
+
+                char line[256];
+
+                // nested spans are included in their parents' times, and spans of concurrent threads add up
+                snprintf(line, sizeof(line), "%-36s %10s %14s %12s", "span", "count", "total [ms]", "max [ms]");
+                ldLog() << line << std::endl;
+
+                for (const auto& entry : sorted) {
+                    snprintf(line, sizeof(line), "%-36s %10llu %14.3f %12.3f", entry.first.c_str(),
+                             static_cast<unsigned long long>(entry.second.count), entry.second.total / 1000.0, entry.second.max / 1000.0);
+                    ldLog() << line << std::endl;
+                }
+
+                ldLog() << std::endl;
+
+                snprintf(line, sizeof(line), "%-36s %10s", "counter", "value");
+                ldLog() << line << std::endl;
+
+                for (int i = 0; i < NUMBER_OF_COUNTERS; i++) {
+                    snprintf(line, sizeof(line), "%-36s %10llu", counterNames[i], static_cast<unsigned long long>(counters[i].load()));
+                    ldLog() << line << std::endl;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,23 @@
+#!/bin/bash
+
+# Downloads the latest version of the excludelist into the source tree.
+# The result should be reviewed and committed by the developers occasionally. Builds use the committed copy only, and
+# therefore work without access to the internet.
+#
+# See https://github.com/probonopd/linuxdeployqt/issues/274 for more information.
+
+set -e
+
+url=https://raw.githubusercontent.com/probonopd/AppImages/master/excludelist
+target="$(dirname "$0")"/excludelist
+
+wget --quiet "$url" -O "$target".new
+
+# sanity check
+if ! grep -q '^libc\.so\.6' "$target".new; then
+    echo "Error: downloaded excludelist looks invalid" >&2
+    rm "$target".new
+    exit 1
+fi
+
+mv "$target".new "$target"